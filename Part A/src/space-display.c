@@ -18,6 +18,7 @@
 #include <zmq.h>
 #include "config.h"
 #include "space-display.h"
+#include "state-parser.h"
 #include <time.h>
 #include <string.h>
 
@@ -109,11 +110,13 @@ void initialize_display() {
  * This function clears the current grid and player statuses, then parses the update message
  * to update the grid with new player positions, alien positions, laser beams, and player scores.
  * It also sets a flag if the game is over.
+ * The message is parsed in place, it is not modified and does not need to be null terminated.
  *
  * @param msg A string containing the update information, with each line representing
  *            a different update command (e.g., player positions, alien positions, laser beams, scores).
+ * @param len The length of the message in bytes.
  */
-void update_grid(char* msg) {
+void update_grid(const char* msg, size_t len) {
     // Clear the grid first
     for (int y = 0; y < GRID_HEIGHT; y++) {
         for (int x = 0; x < GRID_WIDTH; x++) {
@@ -125,38 +128,41 @@ void update_grid(char* msg) {
         players_disp[i].active = 0;
     }
 
-     // Parse the message line by line
-    char* line = strtok(msg, "\n");
-    while (line != NULL) {
-        if (line[0] == CMD_GAME_OVER) {
+    // Parse the message line by line
+    StateParser_t parser;
+    StateEntry_t entry;
+    state_parser_init(&parser, msg, len);
+    while (state_parser_next(&parser, &entry)) {
+        if (entry.type == CMD_GAME_OVER) {
             game_over_display = 1; // Set a flag to indicate the game is over
 
 
-        } else if (line[0] == CMD_PLAYER) {
-            char id;
-            int x, y;
-            sscanf(line, "%*c %c %d %d", &id, &x, &y);
-            
+        } else if (entry.type == CMD_PLAYER) {
+            int x = entry.x;
+            int y = entry.y;
             if (x >= 0 && x < GRID_WIDTH && y >= 0 && y < GRID_HEIGHT) {
-                grid[y][x].ch = id;
+                grid[y][x].ch = entry.id;
                 // Update player status
-                int idx = id - 'A';
+                int idx = entry.id - 'A';
                 if (idx >= 0 && idx < MAX_PLAYERS) {
-                    players_disp[idx].id = id;
+                    players_disp[idx].id = entry.id;
                     players_disp[idx].active = 1;
                 }
             }
-        } else if (line[0] == CMD_ALIEN) {
+        } else if (entry.type == CMD_ALIEN) {
             // Format: ALIEN <x> <y>
-            int x, y;
-            sscanf(line, "%*c %d %d", &x, &y);
+            int x = entry.x;
+            int y = entry.y;
             if (x >= 0 && x < GRID_WIDTH && y >= 0 && y < GRID_HEIGHT) {
                 grid[y][x].ch = '*'; // Represent aliens with '*'
             }
-        } else if (line[0] == CMD_LASER) {
-            int x, y;
-            int zone;
-            sscanf(line, "%*c %d %d %d", &x, &y, &zone);
+        } else if (entry.type == CMD_LASER) {
+            int x = entry.x;
+            int y = entry.y;
+            int zone = entry.value;
+            if (x < 0 || x >= GRID_WIDTH || y < 0 || y >= GRID_HEIGHT) {
+                continue; // Laser outside the grid
+            }
             
             time_t now = time(NULL);
             
@@ -183,19 +189,13 @@ void update_grid(char* msg) {
                 }
             }
             
-        } else if (line[0] == CMD_SCORE) {
-            char id;
-            int player_score;
-            sscanf(line, "%*c %c %d", &id, &player_score);
-            
-            int idx = id - 'A';
+        } else if (entry.type == CMD_SCORE) {
+            int idx = entry.id - 'A';
             if (idx >= 0 && idx < MAX_PLAYERS) {
                 players_disp[idx].active = 1;
-                players_disp[idx].score = player_score;
+                players_disp[idx].score = entry.value;
             }
         }
-        // Move to the next line
-        line = strtok(NULL, "\n");
     }
 }
 
@@ -418,10 +418,12 @@ void display_main(void* sub) {
     // Main loop
     while (!game_over_display) {
         char buffer[BUFFER_SIZE];
-        int recv_size = zmq_recv(subscriber, buffer, sizeof(buffer) - 1, ZMQ_DONTWAIT);
+        int recv_size = zmq_recv(subscriber, buffer, sizeof(buffer), ZMQ_DONTWAIT);
         if (recv_size != -1) {
-            buffer[recv_size] = '\0';
-            update_grid(buffer);
+            if (recv_size > (int)sizeof(buffer)) {
+                recv_size = sizeof(buffer); // Message was truncated
+            }
+            update_grid(buffer, recv_size);
         } else {
             int err = zmq_errno();
             if (err == EAGAIN) {
@@ -16,6 +16,7 @@
 #ifndef SPACE_DISPLAY_H
 #define SPACE_DISPLAY_H
 
+#include <stddef.h>
 #include <time.h>
 
 /**
@@ -63,8 +64,11 @@ void initialize_display();
  * 
  * This function refreshes the game grid based on the current state
  * of the game. It should be called whenever the game state changes.
+ *
+ * @param msg The game state message, does not need to be null terminated.
+ * @param len The length of the message in bytes.
  */
-void update_grid();
+void update_grid(const char* msg, size_t len);
 
 /**
  * @brief Draws the scores on the display.
@@ -0,0 +1,170 @@
+/*
+ * PSIS 2024/2025 - Project Part 1
+ *
+ * Filename: state-parser.c
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Parser for the game state messages published by the server.
+ * Single pass over the received bytes, does not modify the message and does not allocate memory.
+ */
+
+#include "config.h"
+#include "state-parser.h"
+
+// Largest number of digits accepted in a number, avoids int overflow
+#define MAX_DIGITS 9
+
+
+/**
+ * @brief Skips spaces and tabs.
+ *
+ * @param p Current position.
+ * @param end One past the last byte of the line.
+ * @return The position of the first byte that is not a space or tab.
+ */
+static const char* skip_blanks(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * @brief Parses a single character field.
+ *
+ * @param p Pointer to the current position, advanced past the field on success.
+ * @param end One past the last byte of the line.
+ * @param out Where the character is stored.
+ * @return 1 on success, 0 if the field is missing.
+ */
+static int parse_char(const char** p, const char* end, char* out) {
+    const char* q = skip_blanks(*p, end);
+    if (q >= end) {
+        return 0;
+    }
+    *out = *q;
+    *p = q + 1;
+    return 1;
+}
+
+/**
+ * @brief Parses a decimal integer field with an optional sign.
+ *
+ * @param p Pointer to the current position, advanced past the field on success.
+ * @param end One past the last byte of the line.
+ * @param out Where the number is stored.
+ * @return 1 on success, 0 if the field is missing, malformed or too long.
+ */
+static int parse_int(const char** p, const char* end, int* out) {
+    const char* q = skip_blanks(*p, end);
+    int negative = 0;
+    if (q < end && (*q == '-' || *q == '+')) {
+        negative = (*q == '-');
+        q++;
+    }
+
+    int value = 0;
+    int digits = 0;
+    while (q < end && *q >= '0' && *q <= '9') {
+        if (++digits > MAX_DIGITS) {
+            return 0;
+        }
+        value = value * 10 + (*q - '0');
+        q++;
+    }
+    if (digits == 0) {
+        return 0;
+    }
+
+    *out = negative ? -value : value;
+    *p = q;
+    return 1;
+}
+
+
+/**
+ * @brief Starts parsing a game state message.
+ *
+ * @param parser The parser to initialize.
+ * @param msg The message, does not need to be null terminated.
+ * @param len The length of the message in bytes.
+ */
+void state_parser_init(StateParser_t* parser, const char* msg, size_t len) {
+    parser->pos = msg;
+    parser->end = msg + len;
+}
+
+/**
+ * @brief Parses the next line of the game state message.
+ *
+ * The line formats are the ones written by the server:
+ * - CMD_PLAYER <id> <x> <y>
+ * - CMD_SCORE <id> <score>
+ * - CMD_LASER <x> <y> <zone>
+ * - CMD_ALIEN <x> <y>
+ * - CMD_GAME_OVER
+ *
+ * Lines that are malformed or have an unknown command are skipped.
+ *
+ * @param parser The parser.
+ * @param entry Where the parsed line is stored.
+ * @return 1 if a line was parsed, 0 when the end of the message was reached.
+ */
+int state_parser_next(StateParser_t* parser, StateEntry_t* entry) {
+    while (parser->pos < parser->end) {
+        // Find the end of the current line
+        const char* line = parser->pos;
+        const char* eol = line;
+        while (eol < parser->end && *eol != '\n' && *eol != '\0') {
+            eol++;
+        }
+        if (eol < parser->end && *eol == '\0') {
+            // Null terminator ends the message
+            parser->end = eol;
+        }
+        parser->pos = (eol < parser->end) ? eol + 1 : parser->end;
+
+        if (line == eol) {
+            continue; // Empty line
+        }
+
+        const char* p = line + 1;
+        int ok = 0;
+        entry->type = line[0];
+        switch (entry->type) {
+            case CMD_PLAYER:
+                ok = parse_char(&p, eol, &entry->id) &&
+                     parse_int(&p, eol, &entry->x) &&
+                     parse_int(&p, eol, &entry->y);
+                break;
+            case CMD_SCORE:
+                ok = parse_char(&p, eol, &entry->id) &&
+                     parse_int(&p, eol, &entry->value);
+                break;
+            case CMD_LASER:
+                ok = parse_int(&p, eol, &entry->x) &&
+                     parse_int(&p, eol, &entry->y) &&
+                     parse_int(&p, eol, &entry->value);
+                break;
+            case CMD_ALIEN:
+                ok = parse_int(&p, eol, &entry->x) &&
+                     parse_int(&p, eol, &entry->y);
+                break;
+            case CMD_GAME_OVER:
+                ok = 1;
+                break;
+        }
+
+        if (ok) {
+            return 1;
+        }
+        // Malformed or unknown line, skip it
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * PSIS 2024/2025 - Project Part 1
+ *
+ * Filename: state-parser.h
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Header file for state-parser.c
+ */
+
+#ifndef STATE_PARSER_H
+#define STATE_PARSER_H
+
+#include <stddef.h>
+
+/**
+ * @struct StateEntry_t
+ * @brief Represents one line of a game state message.
+ *
+ * @var StateEntry_t::type
+ * Command of the line (CMD_PLAYER, CMD_SCORE, CMD_LASER, CMD_ALIEN or CMD_GAME_OVER).
+ *
+ * @var StateEntry_t::id
+ * Player ID, set for CMD_PLAYER and CMD_SCORE lines.
+ *
+ * @var StateEntry_t::x
+ * X coordinate, set for CMD_PLAYER, CMD_LASER and CMD_ALIEN lines.
+ *
+ * @var StateEntry_t::y
+ * Y coordinate, set for CMD_PLAYER, CMD_LASER and CMD_ALIEN lines.
+ *
+ * @var StateEntry_t::value
+ * Score for CMD_SCORE lines, laser zone for CMD_LASER lines.
+ */
+typedef struct {
+    char type;
+    char id;
+    int x;
+    int y;
+    int value;
+} StateEntry_t;
+
+/**
+ * @struct StateParser_t
+ * @brief Cursor over a game state message.
+ *
+ * The parser only reads the message, it never modifies or copies it.
+ *
+ * @var StateParser_t::pos
+ * Next byte to be parsed.
+ *
+ * @var StateParser_t::end
+ * One past the last byte of the message.
+ */
+typedef struct {
+    const char* pos;
+    const char* end;
+} StateParser_t;
+
+/**
+ * @brief Starts parsing a game state message.
+ *
+ * @param parser The parser to initialize.
+ * @param msg The message, does not need to be null terminated.
+ * @param len The length of the message in bytes.
+ */
+void state_parser_init(StateParser_t* parser, const char* msg, size_t len);
+
+/**
+ * @brief Parses the next line of the game state message.
+ *
+ * Lines that are malformed or have an unknown command are skipped.
+ *
+ * @param parser The parser.
+ * @param entry Where the parsed line is stored.
+ * @return 1 if a line was parsed, 0 when the end of the message was reached.
+ */
+int state_parser_next(StateParser_t* parser, StateEntry_t* entry);
+
+#endif
@@ -11,6 +11,14 @@
  *
  * Description:
  * Code that handles astronaut client application with display.
+ *
+ * Usage: ./astronaut-display-client [--arena N | --lobby] [--ipc] [--session FILE] [--latency]
+ * --arena joins a specific arena, otherwise the server picks one. The display shows the arena joined.
+ * --lobby connects through the lobby of the server, which packs players into arenas
+ * --ipc connects through the Unix domain sockets of a server on the same host instead of TCP
+ * --session keeps the session in FILE, a restarted client resumes it with the same slot, score and position
+ * --latency measures the time from each key press to the reply, to the game state that includes the command
+ *           and to the frame that draws it, printed to stderr when the client exits (see latency.c)
  */
 
 #include <zmq.h>
@@ -23,12 +31,22 @@
 #include "../src/config.h"
 #include "../src/client-logic.h"
 #include "../src/space-display.h"
+#include "../src/envelope.h"
+#include "../src/heartbeat.h"
+#include "../src/prediction.h"
+#include "../src/latency.h"
 
 // ZeroMQ subscriber socket
 void* context;
 void* requester;
+void* lobby_requester = NULL;
 void* subscriber_gamestate;
-void* heartbeat_subscriber;
+
+// Connect through the Unix domain sockets of the server instead of TCP
+bool use_ipc = false;
+
+// Measure the latency of the commands, from the key press to the screen
+bool measure_latency = false;
 
 // Flags to indicate thread ending
 pthread_mutex_t lock;
@@ -45,9 +63,14 @@ void cleanup() {
     // We need to wait for the display thread to finish message processing
     endwin();
     zmq_close(requester);
+    if (lobby_requester != NULL) {
+        zmq_close(lobby_requester);
+    }
     zmq_close(subscriber_gamestate);
-    zmq_close(heartbeat_subscriber);
     pthread_mutex_destroy(&lock);
+    if (measure_latency) {
+        print_latency_report(stderr); // After endwin, so that it stays on the terminal
+    }
 }
 
 /**
@@ -70,6 +93,41 @@ void *thread_client_routine(void *arg) {
     exit(0);
 }
 
+/**
+ * @brief Subscribes to the snapshots and game over of an arena, or unsubscribes from them.
+ *
+ * @param arena The arena.
+ * @param option ZMQ_SUBSCRIBE or ZMQ_UNSUBSCRIBE.
+ */
+void subscribe_arena(int arena, int option) {
+    char prefix[ENVELOPE_PREFIX_LEN + 1];
+    envelope_prefix(prefix, arena, MSG_TYPE_SNAPSHOT);
+    zmq_setsockopt(subscriber_gamestate, option, prefix, ENVELOPE_PREFIX_LEN);
+    envelope_prefix(prefix, arena, MSG_TYPE_GAME_OVER);
+    zmq_setsockopt(subscriber_gamestate, option, prefix, ENVELOPE_PREFIX_LEN);
+}
+
+/**
+ * @brief Draws the current state of an arena without waiting for the next published message.
+ *
+ * @param arena The arena.
+ * @param last Where the envelope of the snapshot is stored, zeroed if there was no snapshot.
+ */
+void draw_arena_snapshot(int arena, Envelope_t* last) {
+    memset(last, 0, sizeof(*last));
+    char snapshot[BUFFER_SIZE];
+    Envelope_t snapshot_envelope;
+    int snapshot_size = envelope_request_snapshot(context, use_ipc ? IPC_ENDPOINT_SNAPSHOT : CLIENT_CONNECT_SNAPSHOT, arena, &snapshot_envelope, snapshot, sizeof(snapshot));
+    if (snapshot_size != -1) {
+        if (measure_latency) {
+            latency_state_received(snapshot, snapshot_size);
+        }
+        set_display_game_state(snapshot, snapshot_size);
+        prediction_reconcile(snapshot_envelope.seq, snapshot, snapshot_size);
+        *last = snapshot_envelope;
+    }
+}
+
 /**
  * @brief Thread routine for communication with the server.
  *
@@ -77,6 +135,14 @@ void *thread_client_routine(void *arg) {
  * from the server to update the display grid. It handles various errors
  * that may occur during message reception and ensures proper cleanup
  * before exiting.
+ * It first waits for the client to connect, and subscribes to the snapshots and game over of the arena joined.
+ * Then it draws the snapshot of the arena, and only the published messages newer than it.
+ * A message from a restarted server is drawn whatever its sequence number (see envelope_is_newer),
+ * and the moves predicted with the sequence numbers of the old server are dropped.
+ * A client that connects again after losing its session may join another arena, the
+ * subscriptions then move to the new arena and its snapshot is drawn.
+ * Each game state drawn is also reconciled with the moves of the astronaut drawn ahead of it,
+ * and checked for the commands it includes when measuring the latency.
  *
  * @param arg Unused argument.
  * @return void* Always returns NULL.
@@ -85,6 +151,18 @@ void *thread_comm_routine(void *arg) {
     // Avoid unused argument warning
     (void)arg;
 
+    // Subscribe to the messages of the arena joined
+    int arena = get_client_arena();
+    if (arena < 0) {
+        // The client thread ends the program
+        pthread_exit(NULL);
+    }
+    subscribe_arena(arena, ZMQ_SUBSCRIBE);
+
+    // Draw the current state without waiting for the next published message
+    Envelope_t last;
+    draw_arena_snapshot(arena, &last);
+
     // Read messages from the server and update the display grid
     while (1) {
         pthread_mutex_lock(&lock);
@@ -94,13 +172,44 @@ void *thread_comm_routine(void *arg) {
         }
         pthread_mutex_unlock(&lock);
 
+        // The client connected again in another arena, its messages replace the ones of the old arena
+        // The prediction and latency measurement are restarted by the client thread for the new player
+        int joined = get_client_arena();
+        if (joined >= 0 && joined != arena) {
+            subscribe_arena(arena, ZMQ_UNSUBSCRIBE);
+            subscribe_arena(joined, ZMQ_SUBSCRIBE);
+            arena = joined;
+            draw_arena_snapshot(arena, &last);
+        }
 
+        // Messages have the envelope frame, followed by the game state
+        // The frames of a message arrive together, only the first one can be missing
+        char frame[ENVELOPE_MAX_LEN];
         char buffer[BUFFER_SIZE];
-        int recv_size = zmq_recv(subscriber_gamestate, buffer, sizeof(buffer) - 1, ZMQ_DONTWAIT);
+        int frame_size = zmq_recv(subscriber_gamestate, frame, sizeof(frame), ZMQ_DONTWAIT);
+        int recv_size = frame_size;
+        if (recv_size != -1) {
+            recv_size = zmq_recv(subscriber_gamestate, buffer, sizeof(buffer), 0);
+        }
         if (recv_size != -1) {
-            buffer[recv_size] = '\0';
-            // Copy the message to display
-            set_display_game_state(buffer);
+            if (recv_size > (int)sizeof(buffer)) {
+                recv_size = sizeof(buffer); // Message was truncated
+            }
+            // Parse the message into the display, unless it is not newer than the state drawn
+            // Messages of the old arena received before unsubscribing are dropped
+            Envelope_t envelope;
+            if (envelope_parse(frame, frame_size, &envelope) == 0 && envelope.arena == arena &&
+                envelope_is_newer(&envelope, &last)) {
+                if (last.epoch != 0 && envelope.epoch != last.epoch) {
+                    prediction_reset();
+                }
+                last = envelope;
+                if (measure_latency) {
+                    latency_state_received(buffer, recv_size);
+                }
+                set_display_game_state(buffer, recv_size);
+                prediction_reconcile(envelope.seq, buffer, recv_size);
+            }
         } else {
             int err = zmq_errno();
             if (err == EAGAIN) {
@@ -156,7 +265,8 @@ void *thread_display_routine(void *arg) {
  * using the `getch()` function. The input character is then passed to the `input_key()` function.
  *
  * It blocks in getch() until a key is pressed.
- * It blocks in input_key() until the client thread process the key request
+ * Keys are queued by input_key() while the client thread waits for the server,
+ * it only blocks there if the queue is full.
  * 
  * @param arg Unused argument.
  */
@@ -183,58 +293,6 @@ void *thread_input_routine(void *arg) {
     }
 }
 
-/**
- * @brief Thread routine to handle heartbeat messages.
- *
- * This function runs in an infinite loop, receiving heartbeat messages
- * from a ZeroMQ subscriber socket. If a message is received that is not
- * the expected heartbeat ("H"), the function logs an error, performs
- * cleanup, and exits the program.
- *
- * @param arg Unused argument.
- * @return This function does not return.
- */
-void* thread_heartbeat_routine(void* arg) {
-    // Avoid unused argument warning
-    (void)arg;
-
-    while (1) {
-        char buffer[2];
-        int rc = zmq_recv(heartbeat_subscriber, buffer, 1, 0);
-        if (rc == -1) {
-            // Do not exit if game is over, will wait for input
-            pthread_mutex_lock(&lock);
-            if (thread_display_finished) {
-                // Do not timeout, server closed and we want to keep game over screen
-                pthread_mutex_unlock(&lock);
-                pthread_exit(NULL);
-            }
-            pthread_mutex_unlock(&lock);
-            perror("Failed to receive heartbeat");
-            cleanup();
-            exit(1);
-        }
-        buffer[rc] = '\0';
-        if (strcmp(buffer, "H") != 0) {
-            // Do not exit if game is over, will wait for input
-            pthread_mutex_lock(&lock);
-            if (thread_display_finished) {
-                // Do not timeout, server closed and we want to keep game over screen
-                pthread_mutex_unlock(&lock);
-                pthread_exit(NULL);
-            }
-            pthread_mutex_unlock(&lock);
-            fprintf(stderr, "Invalid heartbeat received\n");
-            cleanup();
-            exit(1);
-        }
-    }
-
-    // End thread
-    // Note: program should not reach this point
-    pthread_exit(NULL);
-}
-
 /**
  * @brief Main function for the astronaut client application.
  * 
@@ -242,9 +300,36 @@ void* thread_heartbeat_routine(void* arg) {
  * sets up a ZeroMQ context and socket for communication with the server, and enters
  * the main game loop where it handles key input and sends messages to the server.
  * 
+ * @param argc Number of arguments.
+ * @param argv Optional --arena N to join a specific arena, or --lobby to let the lobby pick one, --ipc, --session FILE and --latency.
  * @return int Exit status of the program.
  */
-int main() {
+int main(int argc, char* argv[]) {
+    bool use_lobby = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--arena") == 0 && i + 1 < argc) {
+            set_client_arena(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--lobby") == 0) {
+            use_lobby = true;
+        } else if (strcmp(argv[i], "--ipc") == 0) {
+            use_ipc = true;
+        } else if (strcmp(argv[i], "--session") == 0 && i + 1 < argc) {
+            set_client_session_file(argv[++i]);
+        } else if (strcmp(argv[i], "--latency") == 0) {
+            measure_latency = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--arena N | --lobby] [--ipc] [--session FILE] [--latency]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    // Draw the moves of the astronaut without waiting for the server
+    set_client_prediction(1);
+    if (measure_latency) {
+        set_client_latency(1);
+        set_display_frame_hook(latency_state_drawn);
+    }
+
     // Initialize the mutexes
     if (pthread_mutex_init(&lock, NULL) != 0) {
         perror("Mutex init failed");
@@ -256,10 +341,11 @@ int main() {
     context = zmq_ctx_new();
     requester = zmq_socket(context, ZMQ_REQ);
     subscriber_gamestate = zmq_socket(context, ZMQ_SUB);
-    heartbeat_subscriber = zmq_socket(context, ZMQ_SUB);
+    set_socket_heartbeat(requester);
+    set_socket_heartbeat(subscriber_gamestate);
     
     // Connect to server's REQ/REP socket
-    if (zmq_connect(requester, CLIENT_CONNECT_REQ) != 0) {
+    if (zmq_connect(requester, use_ipc ? IPC_ENDPOINT_REQ : CLIENT_CONNECT_REQ) != 0) {
         perror("Failed to connect to server");
         endwin();
         zmq_close(requester);
@@ -267,27 +353,26 @@ int main() {
         exit(1);
     }
 
-    // Connect to server's PUB socket
-    if (zmq_connect(subscriber_gamestate, CLIENT_CONNECT_SUB) != 0) {
-        perror("Failed to connect to game server");
-        cleanup();
-        exit(1);
+    // Connect to server's lobby, used only for the connect message
+    if (use_lobby) {
+        lobby_requester = zmq_socket(context, ZMQ_REQ);
+        set_socket_heartbeat(lobby_requester);
+        if (zmq_connect(lobby_requester, use_ipc ? IPC_ENDPOINT_LOBBY : CLIENT_CONNECT_LOBBY) != 0) {
+            perror("Failed to connect to server lobby");
+            cleanup();
+            exit(1);
+        }
+        set_client_lobby(lobby_requester);
     }
 
-    // Subscribe to all messages
-    zmq_setsockopt(subscriber_gamestate, ZMQ_SUBSCRIBE, "", 0);
-
-    // Connect to server's heartbeat PUB socket
-    if (zmq_connect(heartbeat_subscriber, CLIENT_CONNECT_HEARTBEAT) != 0) {
+    // Connect to server's PUB socket
+    if (zmq_connect(subscriber_gamestate, use_ipc ? IPC_ENDPOINT_PUB : CLIENT_CONNECT_SUB) != 0) {
         perror("Failed to connect to game server");
         cleanup();
         exit(1);
     }
 
-    // Subscribe to heartbeat messages
-    zmq_setsockopt(heartbeat_subscriber, ZMQ_SUBSCRIBE, "", 0);
-    int timeout = HEARTBEAT_FREQUENCY*2*1000; // Accepting one missed heartbeat
-    zmq_setsockopt(heartbeat_subscriber, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    // Note: the subscription to the arena is made by the comm thread, once connected
 
     // Initialize ncurses
     initscr();
@@ -302,7 +387,6 @@ int main() {
     pthread_t thread_comm;
     pthread_t thread_display;
     pthread_t thread_input;
-    pthread_t thread_heartbeat;
     int ret;
 
     ret = pthread_create(&thread_client, NULL, thread_client_routine, NULL);
@@ -325,11 +409,6 @@ int main() {
         perror("Failed to create thread_input");
         return 1;
     }
-    ret = pthread_create(&thread_heartbeat, NULL, thread_heartbeat_routine, NULL);
-    if (ret != 0) {
-        perror("Failed to create thread_heartbeat");
-        return 1;
-    }
 
     // Note: program should not reach this point, as threads will manage program exit
     pthread_join(thread_client, NULL);
@@ -11,6 +11,12 @@
  *
  * Description:
  * Code that handles astronaut client application.
+ *
+ * Usage: ./astronaut-client [--arena N | --lobby] [--ipc] [--session FILE]
+ * --arena joins a specific arena, otherwise the server picks one
+ * --lobby connects through the lobby of the server, which packs players into arenas
+ * --ipc connects through the Unix domain sockets of a server on the same host instead of TCP
+ * --session keeps the session in FILE, a restarted client resumes it with the same slot, score and position
  */
 
 
@@ -23,22 +29,25 @@
 #include <unistd.h>
 #include "../src/config.h"
 #include "../src/client-logic.h"
+#include "../src/heartbeat.h"
 
 // ZeroMQ socket
 void* context;
 void* requester;
-void* subscriber_heartbeat;
+void* lobby_requester = NULL;
 
 /**
  * @brief Cleans up resources before the program exits.
  * 
  * This function performs cleanup operations by ending the ncurses window
- * and closing the ZeroMQ sockets for the requester and subscriber heartbeat.
+ * and closing the ZeroMQ sockets for the requester and the lobby.
  */
 void cleanup() {
     endwin();
     zmq_close(requester);
-    zmq_close(subscriber_heartbeat);
+    if (lobby_requester != NULL) {
+        zmq_close(lobby_requester);
+    }
 }
 
 /**
@@ -68,7 +77,8 @@ void *thread_client_routine(void *arg) {
  * using the `getch()` function. The input character is then passed to the `input_key()` function.
  *
  * It blocks in getch() until a key is pressed.
- * It blocks in input_key() until the client thread process the key request
+ * Keys are queued by input_key() while the client thread waits for the server,
+ * it only blocks there if the queue is full.
  * 
  * @param arg Unused argument.
  */
@@ -90,78 +100,61 @@ void *thread_input_routine(void *arg) {
     pthread_exit(NULL);
 }
 
-/**
- * @brief Thread routine to handle heartbeat messages.
- *
- * This function runs in an infinite loop, receiving heartbeat messages
- * from a ZeroMQ subscriber socket. If a message is received that is not
- * the expected heartbeat ("H"), the function logs an error, performs
- * cleanup, and exits the program.
- *
- * @param arg Unused argument.
- * @return This function does not return.
- */
-void* thread_heartbeat_routine(void* arg) {
-    // Avoid unused argument warning
-    (void)arg;
-
-    while (1) {
-        char buffer[2];
-        int rc = zmq_recv(subscriber_heartbeat, buffer, 1, 0);
-        if (rc == -1) {
-            perror("Failed to receive heartbeat");
-            cleanup();
-            exit(1);
-        }
-        buffer[rc] = '\0';
-        if (strcmp(buffer, "H") != 0) {
-            fprintf(stderr, "Invalid heartbeat received\n");
-            cleanup();
-            exit(1);
-        }
-    }
-
-    // End thread
-    // Note: program should not reach this point
-    pthread_exit(NULL);
-}
-
 
 
 /**
  * @brief Main function for the astronaut client application.
  *
  * This function initializes the ZeroMQ context and sockets, connects to the game server,
- * sets up ncurses for terminal handling, and creates three threads for client operations,
- * input handling, and heartbeat monitoring.
+ * sets up ncurses for terminal handling, and creates two threads for client operations
+ * and input handling. The server is watched by the client thread, see client_main.
  *
+ * @param argc Number of arguments.
+ * @param argv Optional --arena N to join a specific arena, or --lobby to let the lobby pick one, --ipc and --session FILE.
  * @return int Exit status of the program.
  */
-int main() {
+int main(int argc, char* argv[]) {
+    bool use_lobby = false;
+    bool use_ipc = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--arena") == 0 && i + 1 < argc) {
+            set_client_arena(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--lobby") == 0) {
+            use_lobby = true;
+        } else if (strcmp(argv[i], "--ipc") == 0) {
+            use_ipc = true;
+        } else if (strcmp(argv[i], "--session") == 0 && i + 1 < argc) {
+            set_client_session_file(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--arena N | --lobby] [--ipc] [--session FILE]\n", argv[0]);
+            exit(1);
+        }
+    }
+
     // Initialize ZeroMQ
     context = zmq_ctx_new();
     requester = zmq_socket(context, ZMQ_REQ);
-    subscriber_heartbeat = zmq_socket(context, ZMQ_SUB);
+    set_socket_heartbeat(requester);
     
     // Connect to server's REQ/REP socket
-    if (zmq_connect(requester, CLIENT_CONNECT_REQ) != 0) {
+    if (zmq_connect(requester, use_ipc ? IPC_ENDPOINT_REQ : CLIENT_CONNECT_REQ) != 0) {
         perror("Failed to connect to game server");
         cleanup();
         exit(1);
     }
 
-    // Connect to server's heartbeat PUB socket
-    if (zmq_connect(subscriber_heartbeat, CLIENT_CONNECT_HEARTBEAT) != 0) {
-        perror("Failed to connect to game server");
-        cleanup();
-        exit(1);
+    // Connect to server's lobby, used only for the connect message
+    if (use_lobby) {
+        lobby_requester = zmq_socket(context, ZMQ_REQ);
+        set_socket_heartbeat(lobby_requester);
+        if (zmq_connect(lobby_requester, use_ipc ? IPC_ENDPOINT_LOBBY : CLIENT_CONNECT_LOBBY) != 0) {
+            perror("Failed to connect to game server lobby");
+            cleanup();
+            exit(1);
+        }
+        set_client_lobby(lobby_requester);
     }
 
-    // Subscribe to heartbeat messages
-    zmq_setsockopt(subscriber_heartbeat, ZMQ_SUBSCRIBE, "", 0);
-    int timeout = HEARTBEAT_FREQUENCY*2*1000; // Accepting one missed heartbeat
-    zmq_setsockopt(subscriber_heartbeat, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
-
     // Initialize ncurses
     initscr();
     noecho();
@@ -171,7 +164,6 @@ int main() {
     // Create threads
     pthread_t thread_client;
     pthread_t thread_input;
-    pthread_t thread_heartbeat;
     int ret;
 
     ret = pthread_create(&thread_client, NULL, thread_client_routine, NULL);
@@ -184,11 +176,6 @@ int main() {
         perror("Failed to create thread_ncurses");
         return 1;
     }
-    ret = pthread_create(&thread_heartbeat, NULL, thread_heartbeat_routine, NULL);
-    if (ret != 0) {
-        perror("Failed to create thread_heartbeat");
-        return 1;
-    }
 
     // Wait for threads to finish
     // Note: program should not reach this point, as threads will manage program exit
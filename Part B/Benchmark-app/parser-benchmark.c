@@ -0,0 +1,241 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: parser-benchmark.c
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Microbenchmark of the game state parser used by update_grid against the previous
+ * strcpy + strtok + sscanf implementation, using game state frames recorded from a server.
+ *
+ * Usage: ./parser-benchmark [frames_file] [iterations]
+ * The frames file contains the published messages separated by an empty line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/config.h"
+#include "../src/space-display.h"
+
+#define DEFAULT_FRAMES_FILE "Benchmark-app/recorded-frames.txt"
+#define DEFAULT_ITERATIONS 200
+#define MAX_FRAMES 4096
+
+// Display state written by update_grid in space-display.c
+extern disp_Cell_t grid[GRID_HEIGHT][GRID_WIDTH];
+extern disp_Player_t players_disp[MAX_PLAYERS];
+
+// State written by the previous implementation
+disp_Cell_t legacy_grid[GRID_HEIGHT][GRID_WIDTH];
+disp_Player_t legacy_players[MAX_PLAYERS];
+char legacy_buffer[BUFFER_SIZE];
+
+// Recorded frames
+char* frames[MAX_FRAMES];
+size_t frame_lens[MAX_FRAMES];
+int frame_count = 0;
+
+
+/**
+ * @brief Returns a monotonic timestamp in nanoseconds.
+ *
+ * @return The current time in nanoseconds.
+ */
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/**
+ * @brief Previous update_grid implementation, kept as the benchmark baseline.
+ *
+ * Copies the message into a shared buffer, then tokenizes it with strtok and parses each line with sscanf.
+ *
+ * @param msg The null terminated game state message.
+ */
+void legacy_update_grid(const char* msg) {
+    strcpy(legacy_buffer, msg);
+
+    for (int y = 0; y < GRID_HEIGHT; y++) {
+        for (int x = 0; x < GRID_WIDTH; x++) {
+            legacy_grid[y][x].ch = ' ';
+        }
+    }
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        legacy_players[i].active = 0;
+    }
+
+    char* line = strtok(legacy_buffer, "\n");
+    while (line != NULL) {
+        if (line[0] == CMD_PLAYER) {
+            char id;
+            int x, y;
+            sscanf(line, "%*c %c %d %d", &id, &x, &y);
+            if (x >= 0 && x < GRID_WIDTH && y >= 0 && y < GRID_HEIGHT) {
+                legacy_grid[y][x].ch = id;
+                int idx = id - 'A';
+                if (idx >= 0 && idx < MAX_PLAYERS) {
+                    legacy_players[idx].id = id;
+                    legacy_players[idx].active = 1;
+                }
+            }
+        } else if (line[0] == CMD_ALIEN) {
+            int x, y;
+            sscanf(line, "%*c %d %d", &x, &y);
+            if (x >= 0 && x < GRID_WIDTH && y >= 0 && y < GRID_HEIGHT) {
+                legacy_grid[y][x].ch = '*';
+            }
+        } else if (line[0] == CMD_LASER) {
+            int x, y;
+            int zone;
+            sscanf(line, "%*c %d %d %d", &x, &y, &zone);
+            if (zone == ZONE_A || zone == ZONE_H) {
+                for (int i = x; i < GRID_WIDTH; i++) {
+                    legacy_grid[y][i].ch = LASER_HORIZONTAL;
+                }
+            } else if (zone == ZONE_D || zone == ZONE_F) {
+                for (int i = x; i >= 0; i--) {
+                    legacy_grid[y][i].ch = LASER_HORIZONTAL;
+                }
+            }
+            if (zone == ZONE_E || zone == ZONE_G) {
+                for (int i = y; i < GRID_HEIGHT; i++) {
+                    legacy_grid[i][x].ch = LASER_VERTICAL;
+                }
+            } else if (zone == ZONE_B || zone == ZONE_C) {
+                for (int i = y; i >= 0; i--) {
+                    legacy_grid[i][x].ch = LASER_VERTICAL;
+                }
+            }
+        } else if (line[0] == CMD_SCORE) {
+            char id;
+            int player_score;
+            sscanf(line, "%*c %c %d", &id, &player_score);
+            int idx = id - 'A';
+            if (idx >= 0 && idx < MAX_PLAYERS) {
+                legacy_players[idx].active = 1;
+                legacy_players[idx].score = player_score;
+            }
+        }
+        line = strtok(NULL, "\n");
+    }
+}
+
+/**
+ * @brief Loads the recorded frames from a file.
+ *
+ * @param path The path of the frames file.
+ * @return 0 on success, -1 on failure.
+ */
+int load_frames(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        perror("Failed to open frames file");
+        return -1;
+    }
+
+    static char data[MAX_FRAMES * 256];
+    size_t size = fread(data, 1, sizeof(data) - 1, f);
+    fclose(f);
+    data[size] = '\0';
+
+    // Frames are separated by an empty line
+    char* p = data;
+    while (*p != '\0' && frame_count < MAX_FRAMES) {
+        char* sep = strstr(p, "\n\n");
+        size_t len = sep ? (size_t)(sep - p) + 1 : strlen(p);
+        if (len >= BUFFER_SIZE) {
+            fprintf(stderr, "Frame %d is too long\n", frame_count);
+            return -1;
+        }
+        frames[frame_count] = p;
+        frame_lens[frame_count] = len;
+        frame_count++;
+        if (sep == NULL) {
+            break;
+        }
+        sep[1] = '\0'; // Terminate the frame for the strcpy based implementation
+        p = sep + 2;
+    }
+    return frame_count > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Checks that both implementations decode every frame to the same grid and scores.
+ *
+ * @return The number of frames that were decoded differently.
+ */
+int compare_implementations() {
+    int mismatches = 0;
+    for (int i = 0; i < frame_count; i++) {
+        update_grid(frames[i], frame_lens[i]);
+        legacy_update_grid(frames[i]);
+        if (memcmp(grid, legacy_grid, sizeof(grid)) != 0) {
+            mismatches++;
+            continue;
+        }
+        for (int j = 0; j < MAX_PLAYERS; j++) {
+            if (players_disp[j].active != legacy_players[j].active ||
+                (players_disp[j].active && players_disp[j].score != legacy_players[j].score)) {
+                mismatches++;
+                break;
+            }
+        }
+    }
+    return mismatches;
+}
+
+/**
+ * @brief Main function of the parser benchmark.
+ *
+ * Decodes all recorded frames the given number of times with each implementation
+ * and prints the average time per frame.
+ *
+ * @param argc Number of arguments.
+ * @param argv Optional frames file and number of iterations.
+ * @return int Exit status of the program.
+ */
+int main(int argc, char* argv[]) {
+    const char* path = argc > 1 ? argv[1] : DEFAULT_FRAMES_FILE;
+    int iterations = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+    if (iterations <= 0) {
+        iterations = DEFAULT_ITERATIONS;
+    }
+
+    if (load_frames(path) != 0) {
+        return 1;
+    }
+
+    int mismatches = compare_implementations();
+    printf("Frames: %d, iterations: %d, mismatching frames: %d\n", frame_count, iterations, mismatches);
+
+    double start = now_ns();
+    for (int it = 0; it < iterations; it++) {
+        for (int i = 0; i < frame_count; i++) {
+            legacy_update_grid(frames[i]);
+        }
+    }
+    double legacy_ns = (now_ns() - start) / ((double)iterations * frame_count);
+
+    start = now_ns();
+    for (int it = 0; it < iterations; it++) {
+        for (int i = 0; i < frame_count; i++) {
+            update_grid(frames[i], frame_lens[i]);
+        }
+    }
+    double parser_ns = (now_ns() - start) / ((double)iterations * frame_count);
+
+    printf("strcpy + strtok + sscanf: %8.1f ns/frame\n", legacy_ns);
+    printf("state parser:             %8.1f ns/frame\n", parser_ns);
+    printf("Speedup:                  %8.2fx\n", legacy_ns / parser_ns);
+
+    return mismatches == 0 ? 0 : 1;
+}
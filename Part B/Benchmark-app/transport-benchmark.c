@@ -0,0 +1,245 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: transport-benchmark.c
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Benchmark of the ZeroMQ transports available to clients on the same host as the server,
+ * TCP over loopback against Unix domain sockets (ipc://).
+ * Measures the round trip of REQ/REP, as used by the astronauts, and the throughput
+ * of a one way stream of game state sized messages, as sent to the displays.
+ *
+ * Usage: ./transport-benchmark [round_trips] [messages] [message_size]
+ * Uses its own endpoints, it can run while a game server is running.
+ */
+
+#include <zmq.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/config.h"
+
+#define DEFAULT_ROUND_TRIPS 20000
+#define DEFAULT_MESSAGES 200000
+#define DEFAULT_MESSAGE_SIZE 512 // Close to the size of a game state with a few players
+#define WARMUP_ROUND_TRIPS 100 // Not measured, the first ones include the connection
+
+/**
+ * @struct Transport_t
+ * @brief A transport to benchmark and the endpoint used for it.
+ *
+ * @var Transport_t::name
+ * Name printed in the results.
+ *
+ * @var Transport_t::round_trip_endpoint
+ * Endpoint of the echo thread, connected by the main thread.
+ *
+ * @var Transport_t::stream_endpoint
+ * Endpoint of the sink thread, a different one because a closed socket releases its endpoint asynchronously.
+ */
+typedef struct {
+    const char* name;
+    const char* round_trip_endpoint;
+    const char* stream_endpoint;
+} Transport_t;
+
+Transport_t transports[] = {
+    { "tcp", "tcp://127.0.0.1:5570", "tcp://127.0.0.1:5571" },
+    { "ipc", "ipc:///tmp/spcinvdrs-benchmark-req", "ipc:///tmp/spcinvdrs-benchmark-stream" },
+};
+
+// ZeroMQ context shared by all threads
+void* context;
+
+// Benchmark parameters
+int round_trips = DEFAULT_ROUND_TRIPS;
+int messages = DEFAULT_MESSAGES;
+int message_size = DEFAULT_MESSAGE_SIZE;
+
+
+/**
+ * @brief Returns a monotonic timestamp in nanoseconds.
+ *
+ * @return The current time in nanoseconds.
+ */
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/**
+ * @brief Comparison function for qsort, orders doubles ascending.
+ */
+int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Thread routine that replies to every request with the same message.
+ *
+ * @param arg The REP socket, already bound.
+ * @return None.
+ */
+void* thread_echo_routine(void* arg) {
+    void* socket = arg;
+    char* buffer = malloc(message_size);
+    for (int i = 0; i < WARMUP_ROUND_TRIPS + round_trips; i++) {
+        int len = zmq_recv(socket, buffer, message_size, 0);
+        if (len == -1) {
+            break;
+        }
+        zmq_send(socket, buffer, len, 0);
+    }
+    free(buffer);
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief Thread routine that receives the messages of the stream.
+ *
+ * @param arg The PULL socket, already bound.
+ * @return None.
+ */
+void* thread_sink_routine(void* arg) {
+    void* socket = arg;
+    char* buffer = malloc(message_size);
+    for (int i = 0; i < messages; i++) {
+        if (zmq_recv(socket, buffer, message_size, 0) == -1) {
+            break;
+        }
+    }
+    free(buffer);
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief Measures the REQ/REP round trip on a transport and prints the latency percentiles.
+ *
+ * @param transport The transport.
+ * @return 0 on success, -1 if the endpoint could not be bound.
+ */
+int benchmark_round_trip(const Transport_t* transport) {
+    void* responder = zmq_socket(context, ZMQ_REP);
+    if (zmq_bind(responder, transport->round_trip_endpoint) != 0) {
+        fprintf(stderr, "Failed to bind %s: %s\n", transport->round_trip_endpoint, zmq_strerror(zmq_errno()));
+        zmq_close(responder);
+        return -1;
+    }
+    void* requester = zmq_socket(context, ZMQ_REQ);
+    zmq_connect(requester, transport->round_trip_endpoint);
+
+    pthread_t thread_echo;
+    pthread_create(&thread_echo, NULL, thread_echo_routine, responder);
+
+    char* buffer = malloc(message_size);
+    memset(buffer, 'A', message_size);
+    double* samples = malloc(sizeof(double) * round_trips);
+    for (int i = 0; i < WARMUP_ROUND_TRIPS + round_trips; i++) {
+        double start = now_ns();
+        zmq_send(requester, buffer, message_size, 0);
+        zmq_recv(requester, buffer, message_size, 0);
+        if (i >= WARMUP_ROUND_TRIPS) {
+            samples[i - WARMUP_ROUND_TRIPS] = now_ns() - start;
+        }
+    }
+    pthread_join(thread_echo, NULL);
+
+    double total = 0;
+    for (int i = 0; i < round_trips; i++) {
+        total += samples[i];
+    }
+    qsort(samples, round_trips, sizeof(double), compare_doubles);
+    printf("%s round trip: mean %7.1f us, p50 %7.1f us, p99 %7.1f us, max %8.1f us\n",
+           transport->name, total / round_trips / 1e3, samples[round_trips / 2] / 1e3,
+           samples[(int)(round_trips * 0.99)] / 1e3, samples[round_trips - 1] / 1e3);
+
+    free(samples);
+    free(buffer);
+    zmq_close(requester);
+    zmq_close(responder);
+    return 0;
+}
+
+/**
+ * @brief Measures the throughput of a one way stream on a transport.
+ *
+ * PUSH/PULL is used instead of PUB/SUB, so that no message is dropped while the
+ * subscription is not yet made. The framing and transport are the same.
+ *
+ * @param transport The transport.
+ * @return 0 on success, -1 if the endpoint could not be bound.
+ */
+int benchmark_throughput(const Transport_t* transport) {
+    void* sink = zmq_socket(context, ZMQ_PULL);
+    if (zmq_bind(sink, transport->stream_endpoint) != 0) {
+        fprintf(stderr, "Failed to bind %s: %s\n", transport->stream_endpoint, zmq_strerror(zmq_errno()));
+        zmq_close(sink);
+        return -1;
+    }
+    void* source = zmq_socket(context, ZMQ_PUSH);
+    zmq_connect(source, transport->stream_endpoint);
+
+    pthread_t thread_sink;
+    pthread_create(&thread_sink, NULL, thread_sink_routine, sink);
+
+    char* buffer = malloc(message_size);
+    memset(buffer, 'A', message_size);
+    double start = now_ns();
+    for (int i = 0; i < messages; i++) {
+        zmq_send(source, buffer, message_size, 0);
+    }
+    pthread_join(thread_sink, NULL);
+    double seconds = (now_ns() - start) / 1e9;
+
+    printf("%s throughput: %10.0f msg/s, %8.1f MB/s\n", transport->name,
+           messages / seconds, (double)messages * message_size / seconds / 1e6);
+
+    free(buffer);
+    zmq_close(source);
+    zmq_close(sink);
+    return 0;
+}
+
+/**
+ * @brief Main function of the transport benchmark.
+ *
+ * Runs the round trip and throughput benchmarks on each transport.
+ *
+ * @param argc Number of arguments.
+ * @param argv Optional number of round trips, number of messages and message size in bytes.
+ * @return int Exit status of the program.
+ */
+int main(int argc, char* argv[]) {
+    if (argc > 1 && atoi(argv[1]) > 0) {
+        round_trips = atoi(argv[1]);
+    }
+    if (argc > 2 && atoi(argv[2]) > 0) {
+        messages = atoi(argv[2]);
+    }
+    if (argc > 3 && atoi(argv[3]) > 0) {
+        message_size = atoi(argv[3]);
+    }
+
+    printf("Round trips: %d, messages: %d, message size: %d bytes\n", round_trips, messages, message_size);
+
+    context = zmq_ctx_new();
+    int ret = 0;
+    for (size_t i = 0; i < sizeof(transports) / sizeof(transports[0]); i++) {
+        if (benchmark_round_trip(&transports[i]) != 0 || benchmark_throughput(&transports[i]) != 0) {
+            ret = 1;
+        }
+    }
+    zmq_ctx_term(context);
+    return ret;
+}
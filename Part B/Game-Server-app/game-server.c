@@ -11,10 +11,31 @@
  * 
  * Description:
  * Code that handles game server application. Calls game.logic.c and space-display.c
+ *
+ * Usage: ./game-server [--daemon] [--arenas N] [--workers N] [--trace FILE]
+ * --daemon runs without the ncurses console, for process supervisors without a terminal.
+ *          The server is stopped with SIGTERM (or SIGINT) instead of the 'q' key.
+ *          SIGUSR2 prints the latency histograms of the server stages to stderr.
+ *          SIGHUP starts a trace capture, or stops the running one and writes the timeline
+ *          to the --trace file, or DEFAULT_TRACE_FILE.
+ * --arenas sets the number of independent games created at startup (default DEFAULT_ARENAS).
+ *          The lobby creates more when players connect and all arenas are full, so the server
+ *          keeps running after all arenas are over, until it is stopped.
+ *          The ncurses console shows arena 0.
+ * --workers sets the number of threads that update the arenas (default one per online core).
+ * --trace records the timeline of the server threads from the start, written to FILE when the server
+ *          ends in the Chrome trace event format, to open in Perfetto or chrome://tracing.
+ * The metrics of the server are served in the Prometheus text format on SERVER_ENDPOINT_METRICS,
+ * a REQ socket sending any request gets them as the reply. The rates are computed by the server
+ * over METRICS_RATE_WINDOW, as the REP socket cannot be scraped by Prometheus directly.
+ * When the server ends, the jobs run by each worker, the deadlines missed by each arena and the latency
+ * histograms of the server stages are printed to stderr.
  */
 
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
+#include <signal.h>
 #include <sys/wait.h>
 #include <zmq.h>
 #include <pthread.h>
@@ -22,28 +43,75 @@
 #include "../src/config.h" 
 #include "../src/game-logic.h" 
 #include "../src/space-display.h" 
+#include "../src/envelope.h"
+#include "../src/heartbeat.h"
+#include "../src/stage-metrics.h"
+#include "../src/trace.h"
 
 // ZeroMQ context and sockets
 void* context;
-void* responder;  // For REQ/REP with astronauts
+void* responder;  // For REQ/ROUTER with astronauts
 void* publisher_gamestate;  // For PUB/SUB with display
 void* publisher_scores;  // For PUB/SUB with scores
-void* publisher_heartbeat;  // For PUB/SUB with heartbeat
+void* lobby_responder;  // For REQ/REP with astronauts looking for an arena
+void* snapshot_responder;  // For REQ/REP with displays asking for the current state of an arena
+void* metrics_responder;  // For REQ/REP with monitoring asking for the metrics of the server
 
 // Flags to indicate thread ending
 pthread_mutex_t lock;
 bool thread_server_finished = false;
 bool thread_display_finished = false;
 
+// Daemon mode, no ncurses console and no display threads
+bool daemon_mode = false;
+
+// File of the trace captures, NULL when --trace is not given
+const char* trace_file = NULL;
+
+/**
+ * @brief Binds a socket to the Unix domain socket endpoint of its channel.
+ *
+ * The TCP endpoint stays the main one, so a failure is only reported,
+ * e.g. on platforms without ipc:// support or when the path is not writable.
+ *
+ * @param socket The socket, already bound to its TCP endpoint.
+ * @param endpoint The ipc:// endpoint.
+ */
+void bind_ipc(void* socket, const char* endpoint) {
+    if (zmq_bind(socket, endpoint) != 0) {
+        fprintf(stderr, "Failed to bind %s: %s\n", endpoint, zmq_strerror(zmq_errno()));
+    }
+}
+
+/**
+ * @brief Stops the trace capture, if one is running, and writes it to its file.
+ */
+void write_trace() {
+    if (!atomic_load(&trace_active)) {
+        return;
+    }
+    trace_stop();
+    const char* path = trace_file != NULL ? trace_file : DEFAULT_TRACE_FILE;
+    int events = trace_write(path);
+    if (events < 0) {
+        fprintf(stderr, "Failed to write the trace to %s\n", path);
+    } else {
+        fprintf(stderr, "Trace of %d events written to %s\n", events, path);
+    }
+}
+
 void cleanup() {
     zmq_close(responder);
     zmq_close(publisher_gamestate);
     zmq_close(publisher_scores);
-    zmq_close(publisher_heartbeat);
-    zmq_ctx_destroy(context);
-    zmq_ctx_term(context);
+    zmq_close(lobby_responder);
+    zmq_close(snapshot_responder);
+    zmq_close(metrics_responder);
+    zmq_ctx_term(context); // Terminating the context twice aborts in libzmq
     pthread_mutex_destroy(&lock);
-    endwin();
+    if (!daemon_mode) {
+        endwin();
+    }
 }
 
 /**
@@ -52,6 +120,7 @@ void cleanup() {
  * This function serves as the entry point for the game server thread. It starts the game logic
  * by calling the server_logic function and handles any errors that occur. Upon completion,
  * it sets the thread_server_finished flag to true and exits the thread.
+ * In daemon mode it also sends SIGUSR1 to the process to wake up the main thread.
  *
  * @param arg Unused argument.
  * @return None.
@@ -61,7 +130,7 @@ void* thread_server_routine(void* arg) {
     (void)arg;
 
     // Start the game logic
-    int ret = server_logic(responder, publisher_gamestate, publisher_scores);
+    int ret = server_logic(context, responder, publisher_gamestate, publisher_scores, lobby_responder, snapshot_responder, metrics_responder);
     if (ret != 0) {
         perror("Error in server_logic");
         cleanup();
@@ -74,56 +143,51 @@ void* thread_server_routine(void* arg) {
     pthread_mutex_lock(&lock);
     thread_server_finished = true;
     pthread_mutex_unlock(&lock);
-    pthread_exit(NULL);
-}
 
-/**
- * @brief Thread routine to send heartbeat messages at regular intervals.
- *
- * This function runs in a separate thread and sends a heartbeat message
- * every second to indicate that the server is alive. It continues to send
- * these messages until the `thread_server_finished` flag is set to true.
- *
- * @param arg Unused argument.
- * @return void* Always returns NULL when the thread exits.
- */
-void* thread_heartbeat_routine(void* arg) {
-    // Avoid unused argument warning
-    (void)arg;
-
-    while (1) {
-        // Send a heartbeat message every second
-        zmq_send(publisher_heartbeat, "H", 1, 0);
-        sleep(HEARTBEAT_FREQUENCY);
-
-        pthread_mutex_lock(&lock);
-        if (thread_server_finished) {
-            pthread_mutex_unlock(&lock);
-            break;
-        }
-        pthread_mutex_unlock(&lock);
+    // Wake up the main thread waiting for signals in daemon mode
+    if (daemon_mode) {
+        kill(getpid(), SIGUSR1);
     }
-
-    // End thread
     pthread_exit(NULL);
 }
 
 /**
- * @brief Thread routine to display game state data.
+ * @brief Thread routine to receive the game state of the embedded display.
  *
- * This function runs in a separate thread and continuously updates the display
- * with the current game state from the server. It locks a mutex to check if the
- * display thread should finish, copies the game state string from the server to
- * the display, and then unlocks the mutex. The function will block in 
- * get_server_game_state or set_display_game_state until data is received or sent.
+ * The embedded display subscribes to the snapshots and game over of arena 0 like the external
+ * displays, through the SERVER_INPROC_PUB endpoint of the same publisher. Inside one ZeroMQ context
+ * the messages are handed over without copies or network stack. It first draws the snapshot of the
+ * arena, then only the published messages newer than it.
+ * The subscriber socket is closed by this thread before it exits, so that the context can be terminated.
  *
  * @param arg Unused argument.
  * @return None.
  */
-void* thread_display_data_routine(void* arg) {
+void* thread_comm_routine(void* arg) {
     // Avoid unused argument warning
     (void)arg;
 
+    void* subscriber = zmq_socket(context, ZMQ_SUB);
+    int timeout = LISTENER_POLL_INTERVAL;
+    zmq_setsockopt(subscriber, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    zmq_connect(subscriber, SERVER_INPROC_PUB);
+    char prefix[ENVELOPE_PREFIX_LEN + 1];
+    envelope_prefix(prefix, 0, MSG_TYPE_SNAPSHOT);
+    zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, prefix, ENVELOPE_PREFIX_LEN);
+    envelope_prefix(prefix, 0, MSG_TYPE_GAME_OVER);
+    zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, prefix, ENVELOPE_PREFIX_LEN);
+
+    // Draw the current state without waiting for the next published message
+    Envelope_t last;
+    memset(&last, 0, sizeof(last));
+    char snapshot[BUFFER_SIZE];
+    Envelope_t snapshot_envelope;
+    int snapshot_size = envelope_request_snapshot(context, SERVER_INPROC_SNAPSHOT, 0, &snapshot_envelope, snapshot, sizeof(snapshot));
+    if (snapshot_size != -1) {
+        set_display_game_state(snapshot, snapshot_size);
+        last = snapshot_envelope;
+    }
+
     while (1) {
         pthread_mutex_lock(&lock);
         if (thread_display_finished) {
@@ -132,19 +196,34 @@ void* thread_display_data_routine(void* arg) {
         }
         pthread_mutex_unlock(&lock);
 
-
-        // Copy the game state string in the server to the display
-        // Display will then parse it to get the state
-        // This bypasses the use of sockets for the display created by the game server
+        // Messages have the envelope frame, followed by the game state
+        char frame[ENVELOPE_MAX_LEN];
         char buffer[BUFFER_SIZE];
-        get_server_game_state(buffer);
-        set_display_game_state(buffer);
-
-        // Note: No need to sleep here, function will not active wait
-        //  because it will be blocked in get_server_game_state or set_display_game_state and only unblocks when data is received/sent
+        int frame_size = zmq_recv(subscriber, frame, sizeof(frame), 0);
+        int recv_size = frame_size;
+        if (recv_size != -1) {
+            recv_size = zmq_recv(subscriber, buffer, sizeof(buffer), 0);
+        }
+        if (recv_size == -1) {
+            if (zmq_errno() == EAGAIN) {
+                continue; // No message received, check if the display finished
+            }
+            break; // The context is being terminated
+        }
+        if (recv_size > (int)sizeof(buffer)) {
+            recv_size = sizeof(buffer); // Message was truncated
+        }
 
+        // Parse the message into the display, unless it is not newer than the state drawn
+        Envelope_t envelope;
+        if (envelope_parse(frame, frame_size, &envelope) == 0 && envelope_is_newer(&envelope, &last)) {
+            last = envelope;
+            set_display_game_state(buffer, recv_size);
+        }
     }
 
+    zmq_close(subscriber);
+
     // End thread
     pthread_exit(NULL);
 }
@@ -214,6 +293,9 @@ void* thread_input_routine(void* arg) {
         pthread_mutex_lock(&lock);
         if (thread_display_finished && thread_server_finished) {
             cleanup();
+            print_scheduler_report(stderr); // After endwin, so that it stays on the terminal
+            print_stage_metrics(stderr);
+            write_trace();
             exit(0);
         }
         pthread_mutex_unlock(&lock);
@@ -226,40 +308,100 @@ void* thread_input_routine(void* arg) {
  * @brief Main function to initialize and run the game server.
  * 
  * This function sets up the ZeroMQ context and various sockets for communication
- * with astronaut clients, display clients, and for broadcasting game state, scores,
- * and heartbeat signals. It also initializes ncurses for terminal display and creates
- * multiple threads to handle server operations, heartbeat signals, display data, 
+ * with astronaut clients, display clients, and for broadcasting game state and scores.
+ * The liveness of the clients is tracked with the ZMTP heartbeats of these sockets.
+ * It also initializes ncurses for terminal display and creates
+ * multiple threads to handle server operations, display data, 
  * display updates, and user input. The function ensures proper cleanup and resource 
  * deallocation in case of errors.
+ *
+ * In daemon mode ncurses and the display and input threads are not started. The main thread
+ * waits for SIGTERM or SIGINT to end the game, or for the game to end on its own, prints
+ * the stage histograms on SIGUSR2 and starts or stops a trace capture on SIGHUP.
  * 
+ * @param argc Number of arguments.
+ * @param argv Optional --daemon flag, number of arenas, number of workers and trace file.
  * @return int Exit status of the program.
  */
-int main() {
+int main(int argc, char* argv[]) {
     pthread_t thread_server;
-    pthread_t thread_heartbeat;
-    pthread_t thread_display_data;
+    pthread_t thread_comm;
     pthread_t thread_display;
     pthread_t thread_input;
     int ret;
 
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--daemon") == 0) {
+            daemon_mode = true;
+        } else if (strcmp(argv[i], "--arenas") == 0 && i + 1 < argc) {
+            set_server_arena_count(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            set_server_worker_count(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_file = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--daemon] [--arenas N] [--workers N] [--trace FILE]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    // In daemon mode the signals are handled by the main thread with sigwait
+    // They are blocked before creating the threads, so that all threads inherit the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    sigaddset(&signals, SIGHUP);
+    if (daemon_mode) {
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    }
+
+    if (trace_file != NULL) {
+        trace_start();
+    }
+
     // Initialize zeroMQ context
     context = zmq_ctx_new();
 
-    // Set up REQ/REP socket for astronaut clients
-    responder = zmq_socket(context, ZMQ_REP);
+    // Set up ROUTER socket for astronaut clients, which use REQ sockets
+    // ROUTER instead of REP so that the listener can queue the requests per client and serve them in turn
+    responder = zmq_socket(context, ZMQ_ROUTER);
+    set_socket_heartbeat(responder);
     zmq_bind(responder, SERVER_ENDPOINT_REQ);
+    bind_ipc(responder, IPC_ENDPOINT_REQ);
 
-    // Set up PUB socket for display client
+    // Set up PUB socket for display client, and for the embedded display in the same process
     publisher_gamestate = zmq_socket(context, ZMQ_PUB);
+    set_socket_heartbeat(publisher_gamestate);
     zmq_bind(publisher_gamestate, SERVER_ENDPOINT_PUB);
+    zmq_bind(publisher_gamestate, SERVER_INPROC_PUB);
+    bind_ipc(publisher_gamestate, IPC_ENDPOINT_PUB);
 
     // Set up PUB socket for scores
     publisher_scores = zmq_socket(context, ZMQ_PUB);
+    set_socket_heartbeat(publisher_scores);
     zmq_bind(publisher_scores, SERVER_ENDPOINT_SCORES);
+    bind_ipc(publisher_scores, IPC_ENDPOINT_SCORES);
+
+    // Set up REQ/REP socket for the lobby
+    lobby_responder = zmq_socket(context, ZMQ_REP);
+    set_socket_heartbeat(lobby_responder);
+    zmq_bind(lobby_responder, SERVER_ENDPOINT_LOBBY);
+    bind_ipc(lobby_responder, IPC_ENDPOINT_LOBBY);
+
+    // Set up REQ/REP socket for the snapshots of late joining displays
+    snapshot_responder = zmq_socket(context, ZMQ_REP);
+    set_socket_heartbeat(snapshot_responder);
+    zmq_bind(snapshot_responder, SERVER_ENDPOINT_SNAPSHOT);
+    zmq_bind(snapshot_responder, SERVER_INPROC_SNAPSHOT);
+    bind_ipc(snapshot_responder, IPC_ENDPOINT_SNAPSHOT);
 
-    // Set up PUB socket for heartbeat
-    publisher_heartbeat = zmq_socket(context, ZMQ_PUB);
-    zmq_bind(publisher_heartbeat, SERVER_ENDPOINT_HEARTBEAT);
+    // Set up REQ/REP socket for the metrics, in the Prometheus text format
+    metrics_responder = zmq_socket(context, ZMQ_REP);
+    zmq_bind(metrics_responder, SERVER_ENDPOINT_METRICS);
+    bind_ipc(metrics_responder, IPC_ENDPOINT_METRICS);
 
 
     // Initialize the mutex
@@ -269,14 +411,6 @@ int main() {
         exit(1);
     }
 
-    // Initialize ncurses mode
-    initscr();
-    noecho();
-    curs_set(FALSE); // Hide the cursor
-    cbreak();
-    keypad(stdscr, TRUE);
-    start_color();
-
     // Create the threads
     ret = pthread_create(&thread_server, NULL, thread_server_routine, NULL);
     if (ret != 0) {
@@ -284,15 +418,54 @@ int main() {
         cleanup();
         exit(1);
     }
-    ret = pthread_create(&thread_heartbeat, NULL, thread_heartbeat_routine, NULL);
-    if (ret != 0) {
-        perror("Failed to create thread_heartbeat");
+
+    if (daemon_mode) {
+        // Wait for a shutdown signal, or for the server thread to finish the game
+        int sig;
+        while (1) {
+            sigwait(&signals, &sig);
+            if (sig == SIGUSR2) {
+                print_stage_metrics(stderr);
+            } else if (sig == SIGHUP) {
+                if (atomic_load(&trace_active)) {
+                    write_trace();
+                } else {
+                    trace_start();
+                    fprintf(stderr, "Trace capture started\n");
+                }
+            } else if (sig == SIGUSR1) {
+                // Only the server thread ending the game counts, a SIGUSR1 sent from outside is ignored
+                pthread_mutex_lock(&lock);
+                bool finished = thread_server_finished;
+                pthread_mutex_unlock(&lock);
+                if (finished) {
+                    break;
+                }
+            } else {
+                end_server_logic();
+                break;
+            }
+        }
+
+        // Wait for the game over state to be sent
+        pthread_join(thread_server, NULL);
         cleanup();
-        exit(1);
+        print_scheduler_report(stderr);
+        print_stage_metrics(stderr);
+        write_trace();
+        exit(0);
     }
-    ret = pthread_create(&thread_display_data, NULL, thread_display_data_routine, NULL);
+
+    // Initialize ncurses mode
+    initscr();
+    noecho();
+    curs_set(FALSE); // Hide the cursor
+    cbreak();
+    keypad(stdscr, TRUE);
+    start_color();
+    ret = pthread_create(&thread_comm, NULL, thread_comm_routine, NULL);
     if (ret != 0) {
-        perror("Failed to create thread_display_data");
+        perror("Failed to create thread_comm");
         cleanup();
         exit(1);
     }
@@ -311,7 +484,7 @@ int main() {
 
     // Note: program should not reach this point, as threads will manage program exit
     pthread_join(thread_server, NULL);
-    pthread_join(thread_display_data, NULL);
+    pthread_join(thread_comm, NULL);
     pthread_join(thread_display, NULL);
     pthread_join(thread_input, NULL);
 
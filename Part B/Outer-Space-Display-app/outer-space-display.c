@@ -11,6 +11,17 @@
  *
  * Description:
  * Code that handles gameplay display. Calls space-display.c
+ *
+ * Usage: ./outer-space-display [--arena N] [--ipc] [--relay ENDPOINT] [--snapshot ENDPOINT] [--ansi | --headless] [--dump FILE] [--dump-interval MS] [--replay FILE]
+ * --arena shows the given arena of the server (default 0)
+ * --ipc connects through the Unix domain sockets of a server on the same host instead of TCP
+ * --relay receives the game state from a spectator relay (e.g. CLIENT_CONNECT_RELAY) instead of the server
+ * --snapshot sets the snapshot service used to draw the current state at start (default CLIENT_CONNECT_SNAPSHOT, or IPC_ENDPOINT_SNAPSHOT with --ipc)
+ * --ansi draws with the direct ANSI renderer instead of ncurses
+ * --headless draws into an in-memory screen, no terminal is needed
+ * --dump writes the headless screen to FILE, at most once every --dump-interval milliseconds
+ * --replay draws the game states recorded in FILE (separated by an empty line) instead of connecting to the server
+ * The decode and render timing is printed to stderr at exit in headless and replay modes
  */
 
 #include <zmq.h>
@@ -22,34 +33,122 @@
 #include <string.h>
 #include "../src/config.h" 
 #include "../src/space-display.h" 
+#include "../src/envelope.h"
+#include "../src/heartbeat.h"
 
 // ZeroMQ subscriber socket
 void* context;
 void* subscriber_gamestate;
-void* subscriber_heartbeat;
+
+// Arena shown and snapshot service used when starting
+int arena = 0;
+const char* snapshot_endpoint = NULL;
 
 // Flags to indicate thread ending
 pthread_mutex_t lock;
 bool thread_display_finished = false;
 
+// Benchmark options
+bool headless = false;
+FILE* dump_file = NULL;
+char* replay_data = NULL; // Recorded game states, NULL when connected to the server
+
 /**
  * @brief Cleans up resources used by the application.
  * 
  * This function closes the ZeroMQ subscriber, destroys the ZeroMQ context,
  * terminates the ZeroMQ context, destroys the display mutex, and ends the
- * ncurses window session.
+ * terminal session.
  */
 void cleanup() {
-    endwin();
+    display_end_terminal();
+    if (headless || replay_data != NULL) {
+        display_report_timing(stderr);
+    }
+    if (dump_file != NULL) {
+        fclose(dump_file);
+    }
     zmq_close(subscriber_gamestate);
-    zmq_close(subscriber_heartbeat);
     pthread_mutex_destroy(&lock);
 }
 
+/**
+ * @brief Loads the recorded game states to replay.
+ *
+ * @param path The path of the file, game states are separated by an empty line.
+ * @return 0 on success, -1 on failure.
+ */
+int load_replay(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        perror("Failed to open replay file");
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size <= 0) {
+        fclose(f);
+        fprintf(stderr, "Replay file is empty\n");
+        return -1;
+    }
+
+    replay_data = malloc(size + 1);
+    if (replay_data == NULL) {
+        fclose(f);
+        perror("Failed to allocate replay buffer");
+        return -1;
+    }
+    size_t read_size = fread(replay_data, 1, size, f);
+    fclose(f);
+    replay_data[read_size] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Thread routine to replay recorded game states.
+ *
+ * Feeds the recorded game states to the display one at a time, waiting for each one to be drawn,
+ * and exits the program after the last one. Stops early if a game state ends the game.
+ *
+ * @param arg Unused argument.
+ */
+void* thread_replay_routine(void* arg) {
+    // Avoid unused argument warning
+    (void)arg;
+
+    char* p = replay_data;
+    while (*p != '\0') {
+        if (display_wait_idle()) {
+            // Game over, the display thread shows the victory screen and ends the program
+            pthread_exit(NULL);
+        }
+
+        char* sep = strstr(p, "\n\n");
+        size_t len = sep ? (size_t)(sep - p) + 1 : strlen(p);
+        set_display_game_state(p, len);
+        if (sep == NULL) {
+            break;
+        }
+        p = sep + 2;
+    }
+
+    if (display_wait_idle()) {
+        pthread_exit(NULL);
+    }
+    cleanup();
+    exit(0);
+}
+
 /**
  * @brief Thread routine to handle communication with the server.
  *
  * This function continuously reads messages from the server using ZeroMQ and updates the display grid.
+ * It first draws the snapshot of the arena, then only the published messages newer than it,
+ * the messages already subscribed while the snapshot was requested are dropped.
+ * A message from a restarted server is drawn whatever its sequence number (see envelope_is_newer).
+ * The server publishes the arena every tick, so no message for SERVER_TIMEOUT means it is gone,
+ * unless the game is over and the game over screen is kept.
  * It checks for termination conditions and handles various ZeroMQ errors appropriately.
  * The function will exit the thread when the display is finished or if a critical error occurs.
  *
@@ -60,6 +159,21 @@ void *thread_comm_routine(void *arg) {
     // Avoid unused argument warning
     (void)arg;
 
+    // Draw the current state without waiting for the next published message
+    // The subscription is already made, so no message after the snapshot is missed
+    Envelope_t last;
+    memset(&last, 0, sizeof(last));
+    bool game_over_received = false;
+    char snapshot[BUFFER_SIZE];
+    Envelope_t snapshot_envelope;
+    int snapshot_size = envelope_request_snapshot(context, snapshot_endpoint, arena, &snapshot_envelope, snapshot, sizeof(snapshot));
+    if (snapshot_size != -1) {
+        set_display_game_state(snapshot, snapshot_size);
+        last = snapshot_envelope;
+        // An arena that already ended publishes nothing more, the game over screen is kept
+        game_over_received = snapshot_envelope.type == MSG_TYPE_GAME_OVER;
+    }
+
     // Read messages from the server and update the display grid
     while (1) {
         pthread_mutex_lock(&lock);
@@ -70,16 +184,35 @@ void *thread_comm_routine(void *arg) {
         pthread_mutex_unlock(&lock);
 
 
+        // Messages have the envelope frame, followed by the game state
+        char frame[ENVELOPE_MAX_LEN];
         char buffer[BUFFER_SIZE];
-        int recv_size = zmq_recv(subscriber_gamestate, buffer, sizeof(buffer) - 1, 0);
+        int frame_size = zmq_recv(subscriber_gamestate, frame, sizeof(frame), 0);
+        int recv_size = frame_size;
+        if (recv_size != -1) {
+            recv_size = zmq_recv(subscriber_gamestate, buffer, sizeof(buffer), 0);
+        }
         if (recv_size != -1) {
-            buffer[recv_size] = '\0';
-            // Copy the message to display
-            set_display_game_state(buffer);
+            if (recv_size > (int)sizeof(buffer)) {
+                recv_size = sizeof(buffer); // Message was truncated
+            }
+            // Parse the message into the display, only snapshots and game over are subscribed
+            // Messages that are not newer than the state drawn are dropped
+            Envelope_t envelope;
+            if (envelope_parse(frame, frame_size, &envelope) == 0 && envelope_is_newer(&envelope, &last)) {
+                last = envelope;
+                game_over_received = envelope.type == MSG_TYPE_GAME_OVER;
+                set_display_game_state(buffer, recv_size);
+            }
         } else {
             int err = zmq_errno();
             if (err == EAGAIN) {
-                // No message received, continue
+                if (!game_over_received) {
+                    // No game state for SERVER_TIMEOUT, the server is gone
+                    cleanup();
+                    fprintf(stderr, "No game state received from the server\n");
+                    exit(1);
+                }
             } else if (err == ETERM || err == ENOTSOCK) {
                 // The context was terminated or socket invalid, exit program
                 cleanup();
@@ -158,62 +291,59 @@ void *thread_input_routine(void *arg) {
 }
 
 /**
- * @brief Thread routine to handle heartbeat messages.
+ * @brief Main function for the outer space display application.
  *
- * This function continuously reads heartbeat messages from the server using ZeroMQ.
- * If a heartbeat is not received or an invalid heartbeat is received, the program exits.
+ * This function initializes the ZeroMQ context and sockets, connects to the game server,
+ * and creates threads to handle communication, display and user input.
  *
- * @param arg Unused argument.
+ * @param argc Number of arguments.
+ * @param argv Renderer and benchmark options, see the usage at the top of the file.
+ * @return int Exit status of the program.
  */
-void* thread_heartbeat_routine(void* arg) {
-    // Avoid unused argument warning
-    (void)arg;
-
-    while (1) {
-        char buffer[2];
-        int rc = zmq_recv(subscriber_heartbeat, buffer, 1, 0);
-        if (rc == -1) {
-            pthread_mutex_lock(&lock);
-            if (thread_display_finished) {
-                // Do not timeout, server closed and we want to keep game over screen
-                pthread_mutex_unlock(&lock);
-                pthread_exit(NULL);
-            }
-            pthread_mutex_unlock(&lock);
-            perror("Failed to receive heartbeat");
-            cleanup();
-            exit(1);
-        }
-        buffer[rc] = '\0';
-        if (strcmp(buffer, "H") != 0) {
-            pthread_mutex_lock(&lock);
-            if (thread_display_finished) {
-                // Do not timeout, server closed and we want to keep game over screen
-                pthread_mutex_unlock(&lock);
-                pthread_exit(NULL);
-            }
-            pthread_mutex_unlock(&lock);
-            fprintf(stderr, "Invalid heartbeat received\n");
-            cleanup();
+int main(int argc, char* argv[]) {
+    // Select the renderer
+    const char* dump_path = NULL;
+    const char* replay_path = NULL;
+    int dump_interval = 0;
+    bool use_ipc = false;
+    const char* gamestate_endpoint = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--arena") == 0 && i + 1 < argc) {
+            arena = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ipc") == 0) {
+            use_ipc = true;
+        } else if (strcmp(argv[i], "--relay") == 0 && i + 1 < argc) {
+            gamestate_endpoint = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_endpoint = argv[++i];
+        } else if (strcmp(argv[i], "--ansi") == 0) {
+            set_display_backend(DISPLAY_BACKEND_ANSI);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            set_display_backend(DISPLAY_BACKEND_HEADLESS);
+            headless = true;
+        } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dump_path = argv[++i];
+        } else if (strcmp(argv[i], "--dump-interval") == 0 && i + 1 < argc) {
+            dump_interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--arena N] [--ipc] [--relay ENDPOINT] [--snapshot ENDPOINT] [--ansi | --headless] [--dump FILE] [--dump-interval MS] [--replay FILE]\n", argv[0]);
             exit(1);
         }
     }
+    // Endpoints not given are the ones of the server, on the selected transport
+    if (gamestate_endpoint == NULL) {
+        gamestate_endpoint = use_ipc ? IPC_ENDPOINT_PUB : CLIENT_CONNECT_SUB;
+    }
+    if (snapshot_endpoint == NULL) {
+        snapshot_endpoint = use_ipc ? IPC_ENDPOINT_SNAPSHOT : CLIENT_CONNECT_SNAPSHOT;
+    }
+    if (dump_path != NULL && !headless) {
+        fprintf(stderr, "--dump requires --headless\n");
+        exit(1);
+    }
 
-    // End thread
-    // Note: program should not reach this point
-    pthread_exit(NULL);
-}
-
-
-/**
- * @brief Main function for the outer space display application.
- *
- * This function initializes the ZeroMQ context and sockets, connects to the game server,
- * and creates threads to handle communication, display, user input, and heartbeats.
- *
- * @return int Exit status of the program.
- */
-int main() {
     // Initialize the mutex
     if (pthread_mutex_init(&lock, NULL) != 0) {
         perror("Mutex init failed");
@@ -221,48 +351,60 @@ int main() {
         exit(1);
     }
 
-    // Initialize ZeroMQ
-    context = zmq_ctx_new();
-    subscriber_gamestate = zmq_socket(context, ZMQ_SUB);
-    subscriber_heartbeat = zmq_socket(context, ZMQ_SUB);
+    // Open the dump file of the headless screen
+    if (dump_path != NULL) {
+        dump_file = fopen(dump_path, "w");
+        if (dump_file == NULL) {
+            perror("Failed to open dump file");
+            cleanup();
+            exit(1);
+        }
+        set_display_dump(dump_file, dump_interval);
+    }
 
-    // Connect to server's PUB socket
-    if (zmq_connect(subscriber_gamestate, CLIENT_CONNECT_SUB) != 0) {
-        perror("Failed to connect to game server");
+    // Replay recorded game states instead of connecting to the server
+    if (replay_path != NULL && load_replay(replay_path) != 0) {
         cleanup();
         exit(1);
     }
 
-    // Subscribe to all messages
-    zmq_setsockopt(subscriber_gamestate, ZMQ_SUBSCRIBE, "", 0);
+    // Initialize ZeroMQ
+    if (replay_data == NULL) {
+        context = zmq_ctx_new();
+        subscriber_gamestate = zmq_socket(context, ZMQ_SUB);
+        set_socket_heartbeat(subscriber_gamestate);
+        int timeout = SERVER_TIMEOUT;
+        zmq_setsockopt(subscriber_gamestate, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
 
-    // Connect to server's heartbeat PUB socket
-    if (zmq_connect(subscriber_heartbeat, CLIENT_CONNECT_HEARTBEAT) != 0) {
-        perror("Failed to connect to game server");
-        cleanup();
-        exit(1);
-    }
+        // Connect to server's PUB socket, or to a relay of it
+        if (zmq_connect(subscriber_gamestate, gamestate_endpoint) != 0) {
+            perror("Failed to connect to game server");
+            cleanup();
+            exit(1);
+        }
 
-    // Subscribe to heartbeat messages
-    zmq_setsockopt(subscriber_heartbeat, ZMQ_SUBSCRIBE, "", 0);
-    int timeout = HEARTBEAT_FREQUENCY*2*1000; // Accepting one missed heartbeat
-    zmq_setsockopt(subscriber_heartbeat, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+        // Subscribe to the snapshots and game over of the arena, ZeroMQ drops the other messages
+        char prefix[ENVELOPE_PREFIX_LEN + 1];
+        envelope_prefix(prefix, arena, MSG_TYPE_SNAPSHOT);
+        zmq_setsockopt(subscriber_gamestate, ZMQ_SUBSCRIBE, prefix, ENVELOPE_PREFIX_LEN);
+        envelope_prefix(prefix, arena, MSG_TYPE_GAME_OVER);
+        zmq_setsockopt(subscriber_gamestate, ZMQ_SUBSCRIBE, prefix, ENVELOPE_PREFIX_LEN);
+    }
 
-    // Initialize ncurses
-    initscr();
-    noecho();
-    curs_set(FALSE); // Hide the cursor
-    cbreak();
-    keypad(stdscr, TRUE);
-    start_color();
+    // Initialize the terminal for the selected renderer
+    display_start_terminal();
 
     // Create the threads
+    // Replaying does not use the server, the headless display does not read the terminal
     pthread_t thread_comm;
     pthread_t thread_display;
     pthread_t thread_input;
-    pthread_t thread_heartbeat;
     int ret;
-    ret = pthread_create(&thread_comm, NULL, thread_comm_routine, NULL);
+    if (replay_data == NULL) {
+        ret = pthread_create(&thread_comm, NULL, thread_comm_routine, NULL);
+    } else {
+        ret = pthread_create(&thread_comm, NULL, thread_replay_routine, NULL);
+    }
     if (ret != 0) {
         perror("Failed to create thread_comm");
         return 1;
@@ -272,22 +414,25 @@ int main() {
         perror("Failed to create thread_display");
         return 1;
     }
-    ret = pthread_create(&thread_input, NULL, thread_input_routine, NULL);
-    if (ret != 0) {
-        perror("Failed to create thread_input");
-        return 1;
+    if (!headless) {
+        ret = pthread_create(&thread_input, NULL, thread_input_routine, NULL);
+        if (ret != 0) {
+            perror("Failed to create thread_input");
+            return 1;
+        }
     }
-    ret = pthread_create(&thread_heartbeat, NULL, thread_heartbeat_routine, NULL);
-    if (ret != 0) {
-        perror("Failed to create thread_heartbeat");
-        return 1;
+
+    // The headless display ends the program after the game over screen
+    pthread_join(thread_display, NULL);
+    if (headless) {
+        cleanup();
+        exit(0);
     }
 
     // Note: program should not reach this point, as threads will manage program exit
     pthread_join(thread_comm, NULL);
-    pthread_join(thread_display, NULL);
     pthread_join(thread_input, NULL);
 
     cleanup();
     exit(0);
-}
\ No newline at end of file
+}
@@ -11,28 +11,46 @@ Group ID: 20
 
 Description:
 Code that handles high score updates display. Receives updates from the server.
+
+Usage: python3 space-high-scores.py [arena] [--ipc]
+Shows the scores of the given arena of the server (default 0).
+--ipc connects through the Unix domain socket of a server on the same host instead of TCP.
 """
 
 
+import sys
 import zmq
 from scores_pb2 import ScoreUpdate
 
-def receive_score_updates():
-    print("Starting the high scores subscriber, waiting for server to send updates...")
+# Envelope frame of the published messages, "<arena><type> <seq> <epoch>", must match config.h
+ARENA_TOPIC_FORMAT = "{:03d}"
+MSG_TYPE_GAME_OVER = "G"
+MSG_TYPE_SCORES = "S"
+
+# Score publisher of the server, must match config.h
+CLIENT_CONNECT_SCORES = "tcp://localhost:5557"
+IPC_ENDPOINT_SCORES = "ipc:///tmp/spcinvdrs-scores"
+
+def receive_score_updates(arena, endpoint):
+    print(f"Starting the high scores subscriber for arena {arena}, waiting for server to send updates...")
 
     context = zmq.Context()
     socket = context.socket(zmq.SUB)
-    socket.connect("tcp://localhost:5557")
-    socket.setsockopt_string(zmq.SUBSCRIBE, '')
+    socket.connect(endpoint)
+    # Only the score updates and game over of the arena
+    socket.setsockopt_string(zmq.SUBSCRIBE, ARENA_TOPIC_FORMAT.format(arena) + MSG_TYPE_SCORES)
+    socket.setsockopt_string(zmq.SUBSCRIBE, ARENA_TOPIC_FORMAT.format(arena) + MSG_TYPE_GAME_OVER)
 
     current_scores = {}
 
     while True:
-        message = socket.recv()
+        # Messages have the envelope frame, followed by the scores
+        envelope, message = socket.recv_multipart()
+        msg_type = envelope.decode()[len(ARENA_TOPIC_FORMAT.format(arena))]
         score_update = ScoreUpdate()
         score_update.ParseFromString(message)
 
-        if score_update.game_over:
+        if msg_type == MSG_TYPE_GAME_OVER or score_update.game_over:
             print("\nGame Over!")
             break
 
@@ -43,9 +61,11 @@ def receive_score_updates():
         current_scores = new_scores
 
         print("\033c", end="")
-        print("Current Scores:")
+        print(f"Current Scores (arena {arena}):")
         for pid, sc in sorted(current_scores.items()):
             print(f"Player {chr(pid)}: {sc}")
 
 if __name__ == "__main__":
-    receive_score_updates()
\ No newline at end of file
+    args = [a for a in sys.argv[1:] if a != "--ipc"]
+    endpoint = IPC_ENDPOINT_SCORES if "--ipc" in sys.argv[1:] else CLIENT_CONNECT_SCORES
+    receive_score_updates(int(args[0]) if args else 0, endpoint)
\ No newline at end of file
@@ -0,0 +1,291 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: spectator-relay.c
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Relay of the game state publisher for large audiences of displays.
+ * Subscribes once to all messages of the server (or of another relay) and publishes them to its own
+ * subscribers, so the server sends each message once however many displays are attached.
+ * The latest snapshot or game over of each arena is cached and sent as soon as a display subscribes.
+ * The messages that the publisher upstream dropped for the relay (at its high water mark) are counted
+ * from the gaps in the sequence numbers of each arena, the server cannot see them.
+ *
+ * Usage: ./spectator-relay [--ipc | --upstream ENDPOINT] [--bind ENDPOINT]
+ * --upstream is the publisher to relay, the game server (default CLIENT_CONNECT_SUB) or another relay
+ * --ipc relays the game server through its Unix domain socket (IPC_ENDPOINT_PUB), when on the same host
+ * --bind is where the displays connect (default RELAY_ENDPOINT_PUB)
+ * The relay stops on SIGINT or SIGTERM.
+ */
+
+#include <zmq.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/config.h"
+#include "../src/envelope.h"
+#include "../src/heartbeat.h"
+
+// ZeroMQ context and sockets
+void* context;
+void* upstream;  // XSUB connected to the server or to another relay
+void* downstream;  // XPUB where the displays subscribe
+
+// Latest keyframe of each arena, the envelope and message frames of its last snapshot or game over
+zmq_msg_t cache_envelope[MAX_ARENAS];
+zmq_msg_t cache_message[MAX_ARENAS];
+int cached[MAX_ARENAS];
+
+// Last message received from upstream for each arena, to find the gaps in the sequence numbers
+Envelope_t last_received[MAX_ARENAS];
+
+// Counters printed at exit
+unsigned long relayed = 0;
+unsigned long subscriptions = 0;
+unsigned long keyframes_sent = 0;
+unsigned long lost_upstream = 0;
+
+// Set by the signal handler to stop the relay
+volatile sig_atomic_t stopping = 0;
+
+
+/**
+ * @brief Signal handler for SIGINT and SIGTERM, stops the relay loop.
+ *
+ * @param sig The signal received.
+ */
+void handle_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+/**
+ * @brief Closes the sockets and the cached messages, and terminates the context.
+ */
+void cleanup() {
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        if (cached[i]) {
+            zmq_msg_close(&cache_envelope[i]);
+            zmq_msg_close(&cache_message[i]);
+        }
+    }
+    zmq_close(upstream);
+    zmq_close(downstream);
+    zmq_ctx_term(context);
+}
+
+/**
+ * @brief Counts the messages of an arena missing before a message received from upstream.
+ *
+ * The sequence numbers of the game state publisher increase by one for every message of
+ * an arena, and the relay is subscribed to all of them. Messages not newer than the last one
+ * are keyframes repeated by a relay upstream. A new epoch starts over (see envelope_is_newer).
+ *
+ * @param envelope The envelope of the message.
+ */
+void count_lost_messages(const Envelope_t* envelope) {
+    Envelope_t* last = &last_received[envelope->arena];
+    if (!envelope_is_newer(envelope, last)) {
+        return;
+    }
+    if (envelope->epoch == last->epoch && envelope->seq > last->seq + 1) {
+        lost_upstream += envelope->seq - last->seq - 1;
+    }
+    *last = *envelope;
+}
+
+/**
+ * @brief Relays one message from upstream to the displays, caching it if it is a keyframe.
+ *
+ * Messages have the envelope frame followed by the message. Snapshots and game over
+ * replace the cached keyframe of their arena, the frames are shared with the cache without copies.
+ */
+void relay_upstream_message() {
+    zmq_msg_t envelope;
+    zmq_msg_t message;
+    zmq_msg_init(&envelope);
+    zmq_msg_init(&message);
+    if (zmq_msg_recv(&envelope, upstream, 0) == -1) {
+        zmq_msg_close(&envelope);
+        zmq_msg_close(&message);
+        return;
+    }
+    if (!zmq_msg_more(&envelope) || zmq_msg_recv(&message, upstream, 0) == -1) {
+        // Not a message with an envelope, forward it as it is
+        zmq_msg_send(&envelope, downstream, 0);
+        zmq_msg_close(&envelope);
+        zmq_msg_close(&message);
+        return;
+    }
+
+    Envelope_t parsed;
+    int valid = envelope_parse(zmq_msg_data(&envelope), zmq_msg_size(&envelope), &parsed) == 0 && parsed.arena < MAX_ARENAS;
+    if (valid) {
+        count_lost_messages(&parsed);
+    }
+    if (valid && (parsed.type == MSG_TYPE_SNAPSHOT || parsed.type == MSG_TYPE_GAME_OVER)) {
+        int a = parsed.arena;
+        if (cached[a]) {
+            zmq_msg_close(&cache_envelope[a]);
+            zmq_msg_close(&cache_message[a]);
+        }
+        zmq_msg_init(&cache_envelope[a]);
+        zmq_msg_init(&cache_message[a]);
+        zmq_msg_copy(&cache_envelope[a], &envelope);
+        zmq_msg_copy(&cache_message[a], &message);
+        cached[a] = 1;
+    }
+
+    zmq_msg_send(&envelope, downstream, ZMQ_SNDMORE);
+    zmq_msg_send(&message, downstream, 0);
+    relayed++;
+}
+
+/**
+ * @brief Sends the cached keyframes that match a new subscription.
+ *
+ * XPUB only delivers the keyframes to the subscribers of the arena, the ones that were
+ * already subscribed receive a repeated snapshot, which displays draw as it is.
+ *
+ * @param prefix The subscription prefix.
+ * @param len The length of the prefix.
+ */
+void send_cached_keyframes(const char* prefix, size_t len) {
+    for (int a = 0; a < MAX_ARENAS; a++) {
+        if (!cached[a] || zmq_msg_size(&cache_envelope[a]) < len ||
+            memcmp(zmq_msg_data(&cache_envelope[a]), prefix, len) != 0) {
+            continue;
+        }
+        zmq_msg_t envelope;
+        zmq_msg_t message;
+        zmq_msg_init(&envelope);
+        zmq_msg_init(&message);
+        zmq_msg_copy(&envelope, &cache_envelope[a]);
+        zmq_msg_copy(&message, &cache_message[a]);
+        zmq_msg_send(&envelope, downstream, ZMQ_SNDMORE);
+        zmq_msg_send(&message, downstream, 0);
+        keyframes_sent++;
+    }
+}
+
+/**
+ * @brief Handles a subscription message from the displays.
+ *
+ * New subscriptions get the cached keyframes. The subscriptions are not forwarded upstream,
+ * the relay is subscribed to all messages so that the keyframes of every arena are cached
+ * before a display asks for them. XPUB filters the messages for each display.
+ */
+void relay_subscription() {
+    zmq_msg_t msg;
+    zmq_msg_init(&msg);
+    if (zmq_msg_recv(&msg, downstream, 0) == -1) {
+        zmq_msg_close(&msg);
+        return;
+    }
+
+    const char* data = zmq_msg_data(&msg);
+    size_t size = zmq_msg_size(&msg);
+    int subscribe = size > 0 && data[0] == 1;
+    if (subscribe) {
+        subscriptions++;
+        send_cached_keyframes(data + 1, size - 1);
+    }
+    zmq_msg_close(&msg);
+}
+
+/**
+ * @brief Main function of the spectator relay.
+ *
+ * Connects upstream, binds the XPUB socket for the displays and relays the messages
+ * in both directions until it receives SIGINT or SIGTERM.
+ *
+ * @param argc Number of arguments.
+ * @param argv Optional upstream (or --ipc) and bind endpoints.
+ * @return int Exit status of the program.
+ */
+int main(int argc, char* argv[]) {
+    const char* upstream_endpoint = CLIENT_CONNECT_SUB;
+    const char* bind_endpoint = RELAY_ENDPOINT_PUB;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--upstream") == 0 && i + 1 < argc) {
+            upstream_endpoint = argv[++i];
+        } else if (strcmp(argv[i], "--ipc") == 0) {
+            upstream_endpoint = IPC_ENDPOINT_PUB;
+        } else if (strcmp(argv[i], "--bind") == 0 && i + 1 < argc) {
+            bind_endpoint = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--ipc | --upstream ENDPOINT] [--bind ENDPOINT]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    // Stop the relay loop on SIGINT and SIGTERM, zmq_poll returns with EINTR
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // Initialize ZeroMQ
+    context = zmq_ctx_new();
+    upstream = zmq_socket(context, ZMQ_XSUB);
+    downstream = zmq_socket(context, ZMQ_XPUB);
+
+    // Pass every subscription, also repeated ones, so that each new display gets the keyframes
+    int verbose = 1;
+    zmq_setsockopt(downstream, ZMQ_XPUB_VERBOSE, &verbose, sizeof(verbose));
+
+    // Drop the connections of dead displays, and reconnect if the upstream is lost
+    set_socket_heartbeat(upstream);
+    set_socket_heartbeat(downstream);
+
+    // Do not wait for slow displays when stopping
+    int linger = 0;
+    zmq_setsockopt(upstream, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(downstream, ZMQ_LINGER, &linger, sizeof(linger));
+
+    if (zmq_connect(upstream, upstream_endpoint) != 0) {
+        perror("Failed to connect upstream");
+        cleanup();
+        exit(1);
+    }
+    // Subscribe to everything, an XSUB subscription is a message starting with 1
+    char subscribe_all = 1;
+    zmq_send(upstream, &subscribe_all, 1, 0);
+    if (zmq_bind(downstream, bind_endpoint) != 0) {
+        perror("Failed to bind relay publisher");
+        cleanup();
+        exit(1);
+    }
+
+    printf("Relaying %s on %s\n", upstream_endpoint, bind_endpoint);
+    fflush(stdout);
+
+    zmq_pollitem_t items[] = {
+        { upstream, 0, ZMQ_POLLIN, 0 },
+        { downstream, 0, ZMQ_POLLIN, 0 },
+    };
+    while (!stopping) {
+        if (zmq_poll(items, 2, -1) == -1) {
+            continue; // Interrupted by a signal
+        }
+        if (items[0].revents & ZMQ_POLLIN) {
+            relay_upstream_message();
+        }
+        if (items[1].revents & ZMQ_POLLIN) {
+            relay_subscription();
+        }
+    }
+
+    printf("Relayed %lu messages, %lu subscriptions, %lu cached keyframes sent, %lu messages lost upstream\n",
+           relayed, subscriptions, keyframes_sent, lost_upstream);
+    cleanup();
+    return 0;
+}
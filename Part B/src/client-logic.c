@@ -20,11 +20,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <errno.h>
 #include "config.h"
 #include "client-logic.h"
+#include "prediction.h"
+#include "latency.h"
 
 // ZeroMQ socket
 void* req;
+void* lobby_req = NULL; // Lobby used to connect, NULL to connect through req
 
 // Flag to indicate if ncurses is being used
 int show_ncurses;
@@ -33,12 +38,25 @@ int show_ncurses;
 char player_id = '\0';
 int player_score = 0;
 char session_token[33]; // To store the session token received from the server
-
-// Key input and condition variable for client inputs to process
-int input_ch;
-int input_ready = 0; // Flag indicating there is an input ready to be processed
-pthread_mutex_t client_lock; // Mutex lock for client input
-pthread_cond_t input_cond;
+int client_arena = -1; // Arena to join before connecting (-1 for any), arena joined after connecting
+int client_connected = 0; // 1 once connected, -1 if the connection failed
+time_t last_request_time = 0; // Time of the last request to the server, to send keepalives when idle
+const char* session_file = NULL; // File where the session is kept to resume it after a restart, NULL if not used
+double laser_ready_time = 0; // Time the laser cooldown ends, from the timers in the replies (see client_time)
+double stun_end_time = 0; // Time the stun ends, from the timers in the replies (see client_time)
+int use_prediction = 0; // Draw the moves before the server publishes them, see prediction.c
+int use_latency = 0; // Tag the commands to measure their latency, see latency.c
+pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER; // Mutex for client_arena and client_connected
+pthread_cond_t arena_cond = PTHREAD_COND_INITIALIZER; // Signals that the connection finished
+
+// Ring buffer of the keys to process, filled by the input thread while the client thread waits for replies
+int input_queue[INPUT_QUEUE_SIZE];
+double input_times[INPUT_QUEUE_SIZE]; // Time each key was pressed, only kept when measuring the latency
+int input_head = 0; // Index of the oldest key in the queue
+int input_count = 0; // Number of keys in the queue
+pthread_mutex_t client_lock; // Mutex lock for the input queue
+pthread_cond_t input_cond; // Signals that a key was queued
+pthread_cond_t space_cond; // Signals that keys were taken from the queue
 
 
 /**
@@ -81,18 +99,54 @@ void find_error(int code, char *msg) {
         case ERR_LASER_COOLDOWN: // Move right
             strcat(msg, ERR_LASER_COOLDOWN_MSG);
             break;
+        case ERR_THROTTLED:
+            strcat(msg, ERR_THROTTLED_MSG);
+            break;
+        case ERR_INVALID_ARENA:
+            strcat(msg, ERR_INVALID_ARENA_MSG);
+            break;
         default:
             strcat(msg, "Unknown error");
     }
 }
 
 
+/**
+ * @brief Returns a monotonic timestamp in seconds, the clock of the predicted timers.
+ *
+ * @return The current time in seconds.
+ */
+double client_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Updates the predicted laser cooldown and stun with the timers of a reply.
+ *
+ * The ticks are counted from when the server replied, so the prediction ends a little
+ * after the server timers and the commands sent after it are not rejected.
+ *
+ * @param cooldown_ticks Game ticks left of the laser cooldown.
+ * @param stun_ticks Game ticks left of the stun.
+ */
+void update_timers(int cooldown_ticks, int stun_ticks) {
+    double now = client_time();
+    laser_ready_time = now + cooldown_ticks * GAME_UPDATE_INTERVAL;
+    stun_end_time = now + stun_ticks * GAME_UPDATE_INTERVAL;
+}
+
 /**
  * @brief Sends a connect message to the server and processes the response.
  *
  * This function sends a connect message using ZeroMQ, waits for the server's response,
  * and processes it. 
  * It then sends a message to the ncurses thread with the appropriate text to display.
+ * If an arena was set with set_client_arena, the connect message asks for that arena,
+ * otherwise the server picks one. If a lobby was set with set_client_lobby, the connect
+ * message is sent to the lobby instead, which picks the arena.
+ * The arena joined is stored in client_arena.
  * 
  * @note This function is not thread-safe.
  * 
@@ -100,25 +154,32 @@ void find_error(int code, char *msg) {
  */
 int send_connect_message() {
     // Send connect message
-    char msg[2];
-    msg[0] = CMD_CONNECT;
-    msg[1] = '\n';
-    zmq_send(req, msg, strlen(msg), 0);
+    char msg[16];
+    void* socket = lobby_req != NULL ? lobby_req : req;
+    if (client_arena >= 0 && lobby_req == NULL) {
+        snprintf(msg, sizeof(msg), "%c %d", CMD_CONNECT, client_arena);
+    } else {
+        snprintf(msg, sizeof(msg), "%c", CMD_CONNECT);
+    }
+    zmq_send(socket, msg, strlen(msg), 0);
 
     // Receive response from server
     char buffer[BUFFER_SIZE];
     int response = ERR_UNKNOWN_CMD;
-    int recv_size = zmq_recv(req, buffer, sizeof(buffer) - 1, 0);
+    int arena = -1;
+    int recv_size = zmq_recv(socket, buffer, sizeof(buffer) - 1, 0);
     if (recv_size != -1) {
         buffer[recv_size] = '\0';
 
         // Process response
-        if (sscanf(buffer, "%d %c %32s", &response, &player_id, session_token) == 3) {
+        int num_parsed = sscanf(buffer, "%d %c %32s %d", &response, &player_id, session_token, &arena);
+        if (num_parsed >= 1) {
 
             // Check is status is error
-            if (response != RESP_OK) {
+            if (response != RESP_OK || num_parsed != 4) {
                 // Parse error
                 char error_msg[BUFFER_SIZE];
+                find_error(response, error_msg);
 
                 // Update screen
                 if (show_ncurses) {
@@ -145,6 +206,12 @@ int send_connect_message() {
                 refresh();
             }
 
+            // The display client reads it to follow the arena joined after a new connection
+            pthread_mutex_lock(&arena_lock);
+            client_arena = arena;
+            pthread_mutex_unlock(&arena_lock);
+        } else {
+            return -1;
         }
 
     } else {
@@ -155,43 +222,335 @@ int send_connect_message() {
 
 
 
+/**
+ * @brief Sends a resume message with the current session and processes the response.
+ *
+ * The server keeps the slot, score and position of the player until the session is reaped,
+ * so a client that lost its connection or was restarted continues with one round trip.
+ *
+ * Only a reply saying that the session is not known (invalid token, player or arena) rejects it.
+ * Other errors, such as ERR_THROTTLED, are transient and the resume is retried later.
+ *
+ * @note This function is not thread-safe.
+ *
+ * @return 0 if the session was resumed, 1 if the server rejected it, or -1 if it did not reply or should be retried.
+ */
+int send_resume_message() {
+    char buffer[BUFFER_SIZE];
+    snprintf(buffer, sizeof(buffer), "%c %d %c %s", CMD_RESUME, client_arena, player_id, session_token);
+    zmq_send(req, buffer, strlen(buffer), 0);
+    last_request_time = time(NULL);
+
+    int recv_size = zmq_recv(req, buffer, sizeof(buffer) - 1, 0);
+    if (recv_size == -1) {
+        return -1;
+    }
+    buffer[recv_size] = '\0';
+
+    int response;
+    char id;
+    char token[33];
+    int arena;
+    int score;
+    int cooldown_ticks = 0;
+    int stun_ticks = 0;
+    int num_parsed = sscanf(buffer, "%d %c %32s %d %d %d %d", &response, &id, token, &arena, &score, &cooldown_ticks, &stun_ticks);
+    if (num_parsed >= 1 && (response == ERR_INVALID_TOKEN || response == ERR_INVALID_PLAYERID || response == ERR_INVALID_ARENA)) {
+        return 1;
+    }
+    if (num_parsed < 5 || response != RESP_OK) {
+        return -1;
+    }
+    player_score = score;
+    update_timers(cooldown_ticks, stun_ticks);
+
+    // Update screen
+    if (show_ncurses) {
+        move(0, 0);
+        clrtoeol();
+        mvprintw(0, 0, "Astronaut %c | Score: %d | Use arrow keys to move, space to fire laser, 'q' to quit", player_id, player_score);
+        move(2, 0);
+        clrtoeol();
+        mvprintw(2, 0, " ");
+        refresh();
+    }
+    return 0;
+}
+
+/**
+ * @brief Resumes the session after the server stopped replying, retrying with exponential backoff.
+ *
+ * The waits start at RECONNECT_BACKOFF_MIN and double up to RECONNECT_BACKOFF_MAX. ZeroMQ reconnects
+ * the socket in the background, so each attempt is a single resume request. If the server no longer
+ * knows the session (it was reaped or the server restarted) a new connection is made instead.
+ * A throttled resume is retried like a missing reply, a new connection would take a second slot.
+ * The client gives up after SESSION_TIMEOUT seconds, when the slot is gone anyway.
+ *
+ * @note This function is not thread-safe.
+ *
+ * @return 0 if the client is connected again, -1 if it gave up.
+ */
+int resume_session() {
+    if (show_ncurses) {
+        move(2, 0);
+        clrtoeol();
+        mvprintw(2, 0, "Connection lost, reconnecting...");
+        refresh();
+    }
+
+    time_t start = time(NULL);
+    int backoff = RECONNECT_BACKOFF_MIN;
+    while (time(NULL) - start < SESSION_TIMEOUT) {
+        usleep(backoff * 1000);
+        int ret = send_resume_message();
+        if (ret == 0) {
+            if (use_prediction) {
+                prediction_start(player_id);
+            }
+            if (use_latency) {
+                latency_start(player_id);
+            }
+            return 0;
+        }
+        if (ret == 1) {
+            if (send_connect_message() != 0) {
+                return -1;
+            }
+            save_session();
+            if (use_prediction) {
+                prediction_start(player_id);
+            }
+            if (use_latency) {
+                latency_start(player_id);
+            }
+            return 0;
+        }
+        backoff = backoff * 2 > RECONNECT_BACKOFF_MAX ? RECONNECT_BACKOFF_MAX : backoff * 2;
+    }
+    return -1;
+}
+
+/**
+ * @brief Loads the session saved by a previous run of the client.
+ *
+ * @return 0 if a session was loaded, -1 if there is no session file or it is not valid.
+ */
+int load_session() {
+    if (session_file == NULL) {
+        return -1;
+    }
+    FILE* f = fopen(session_file, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    int arena;
+    char id;
+    char token[33];
+    int num_parsed = fscanf(f, "%d %c %32s", &arena, &id, token);
+    fclose(f);
+    if (num_parsed != 3 || strlen(token) != 32) {
+        return -1;
+    }
+    client_arena = arena;
+    player_id = id;
+    strcpy(session_token, token);
+    return 0;
+}
+
+/**
+ * @brief Saves the current session, so that a restarted client can resume it.
+ */
+void save_session() {
+    if (session_file == NULL) {
+        return;
+    }
+    FILE* f = fopen(session_file, "w");
+    if (f == NULL) {
+        return;
+    }
+    fprintf(f, "%d %c %s\n", client_arena, player_id, session_token);
+    fclose(f);
+}
+
+/**
+ * @brief Returns the move direction of a key.
+ *
+ * @param key The key.
+ * @return MOVE_UP, MOVE_DOWN, MOVE_LEFT or MOVE_RIGHT for the arrow keys, '\0' for the other keys.
+ */
+char key_direction(int key) {
+    switch (key) {
+        case KEY_UP:
+            return MOVE_UP;
+        case KEY_DOWN:
+            return MOVE_DOWN;
+        case KEY_LEFT:
+            return MOVE_LEFT;
+        case KEY_RIGHT:
+            return MOVE_RIGHT;
+        default:
+            return '\0';
+    }
+}
+
+/**
+ * @brief Takes the next key from the input queue, with the repetitions of an arrow key that follow it.
+ *
+ * A run of the same arrow key becomes a single move of up to MAX_MOVE_STEPS steps, so keys pressed
+ * while a request is in flight take one round trip instead of one each.
+ *
+ * @note Must be called with client_lock held and a non empty queue.
+ *
+ * @param key Where the key is stored.
+ * @return The number of times the key was taken, at least 1.
+ */
+int dequeue_input(int* key) {
+    *key = input_queue[input_head];
+    int count = 1;
+    if (key_direction(*key) != '\0') {
+        while (count < input_count && count < MAX_MOVE_STEPS &&
+               input_queue[(input_head + count) % INPUT_QUEUE_SIZE] == *key) {
+            count++;
+        }
+    }
+    input_head = (input_head + count) % INPUT_QUEUE_SIZE;
+    input_count -= count;
+    pthread_cond_signal(&space_cond);
+    return count;
+}
+
+/**
+ * @brief Checks if the command of a key can be sent in a batch request.
+ *
+ * @param key The key.
+ * @return 1 for the arrow keys and space (moves and zaps), 0 for the other keys.
+ */
+int is_batch_key(int key) {
+    return key_direction(key) != '\0' || key == ' ';
+}
+
+/**
+ * @brief Removes the keys whose command the server would reject because of the laser cooldown or a stun.
+ *
+ * Uses the timers of the last reply, so no round trip is spent on a command known to fail.
+ * The time left is shown instead. A zap kept in a batch starts the cooldown, so the zaps after it are removed too.
+ *
+ * @param keys The keys, compacted in place.
+ * @param steps The steps of each key, compacted with the keys.
+ * @param count The number of keys.
+ * @return The number of keys left.
+ */
+int filter_doomed_keys(int* keys, int* steps, int count) {
+    double now = client_time();
+    int stunned = now < stun_end_time;
+    int laser_ready = now >= laser_ready_time;
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (keys[i] == ' ') {
+            if (stunned || !laser_ready) {
+                continue;
+            }
+            laser_ready = 0;
+        } else if (stunned && key_direction(keys[i]) != '\0') {
+            continue;
+        }
+        keys[kept] = keys[i];
+        steps[kept] = steps[i];
+        kept++;
+    }
+
+    // Update screen
+    if (kept < count && show_ncurses) {
+        move(2, 0);
+        clrtoeol();
+        if (stunned) {
+            mvprintw(2, 0, "Stunned, %.1f s left", stun_end_time - now);
+        } else {
+            mvprintw(2, 0, "Laser cooldown, %.1f s left", laser_ready_time - now);
+        }
+        refresh();
+    }
+    return kept;
+}
+
+/**
+ * @brief Ends a command with its tag, when measuring the latency.
+ *
+ * @param buffer The command, of BUFFER_SIZE bytes, the tag is appended to it.
+ * @param len The length of the command.
+ * @param input_time Time the first key of the command was pressed.
+ * @param command_id Where the ID of the command is stored, 0 if it is not tagged.
+ * @return The length of the command with the tag.
+ */
+int tag_command(char* buffer, int len, double input_time, unsigned long* command_id) {
+    *command_id = 0;
+    if (!use_latency) {
+        return len;
+    }
+    *command_id = latency_command_sent(input_time);
+    return len + snprintf(buffer + len, BUFFER_SIZE - len, " %c%lu", COMMAND_TAG, *command_id);
+}
+
 /**
  * @brief Handles user key input and communicates with the server.
  *
- * Waits for text output to be displayed, processes user input, and sends commands to the server.
+ * Sends the command of the keys to the server and waits for the reply.
+ * More than one key is sent as a batch request, authenticated once by the server,
+ * the keys must then be moves or zaps (see is_batch_key).
  * Updates player's score based on server's response.
  * 
  * @note This function is not thread-safe.
  * 
+ * @param keys The keys pressed, in order.
+ * @param steps The number of times each key was pressed in a row, the steps of a move.
+ * @param count The number of keys, at most MAX_BATCH_COMMANDS.
+ * @param input_time Time the first key was pressed, from client_time (only used when measuring the latency).
  * @return 1 if client exits, 0 if client continues, or -1 if an error occurs.
  */
-int handle_key_input() {
+int handle_key_input(const int* keys, const int* steps, int count, double input_time) {
     // Process user input
     char buffer[BUFFER_SIZE];
-    switch (input_ch) {
-        case KEY_UP:
-            snprintf(buffer, sizeof(buffer), "%c %c %s %c", CMD_MOVE, player_id, session_token, MOVE_UP);
-            zmq_send(req, buffer, strlen(buffer), 0);
-            break;
-        case KEY_DOWN:
-            snprintf(buffer, sizeof(buffer), "%c %c %s %c", CMD_MOVE, player_id, session_token, MOVE_DOWN);
-            zmq_send(req, buffer, strlen(buffer), 0);
-            break;
-        case KEY_LEFT:
-            snprintf(buffer, sizeof(buffer), "%c %c %s %c", CMD_MOVE, player_id, session_token, MOVE_LEFT);
-            zmq_send(req, buffer, strlen(buffer), 0);
-            break;
-        case KEY_RIGHT:
-            snprintf(buffer, sizeof(buffer), "%c %c %s %c", CMD_MOVE, player_id, session_token, MOVE_RIGHT);
-            zmq_send(req, buffer, strlen(buffer), 0);
+    unsigned long command_id = 0;
+    int key = keys[0];
+    char direction = key_direction(key);
+    if (count > 1) {
+        int len = snprintf(buffer, sizeof(buffer), "%c %d %c %s ", CMD_BATCH, client_arena, player_id, session_token);
+        for (int i = 0; i < count; i++) {
+            const char* separator = i > 0 ? ";" : "";
+            direction = key_direction(keys[i]);
+            if (direction != '\0') {
+                len += snprintf(buffer + len, sizeof(buffer) - len, "%s%c %c %d", separator, CMD_MOVE, direction, steps[i]);
+                if (use_prediction) {
+                    prediction_move_sent(direction, steps[i]);
+                }
+            } else {
+                len += snprintf(buffer + len, sizeof(buffer) - len, "%s%c", separator, MSG_ZAP);
+            }
+        }
+        len = tag_command(buffer, len, input_time, &command_id);
+        zmq_send(req, buffer, len, 0);
+        key = 0; // Sent, skip the other keys below
+    } else if (direction != '\0') {
+        int len = snprintf(buffer, sizeof(buffer), "%c %d %c %s %c %d", CMD_MOVE, client_arena, player_id, session_token, direction, steps[0]);
+        len = tag_command(buffer, len, input_time, &command_id);
+        zmq_send(req, buffer, len, 0);
+        if (use_prediction) {
+            prediction_move_sent(direction, steps[0]);
+        }
+        key = 0; // Sent, skip the other keys below
+    }
+    switch (key) {
+        case 0:
             break;
-        case ' ':
-            snprintf(buffer, sizeof(buffer), "%c %c %s", MSG_ZAP, player_id, session_token);
-            zmq_send(req, buffer, strlen(buffer), 0);
+        case ' ': {
+            int len = snprintf(buffer, sizeof(buffer), "%c %d %c %s", MSG_ZAP, client_arena, player_id, session_token);
+            len = tag_command(buffer, len, input_time, &command_id);
+            zmq_send(req, buffer, len, 0);
             break;
+        }
         case 'q':
         case 'Q':
-            snprintf(buffer, sizeof(buffer), "%c %c %s", CMD_DISCONNECT, player_id, session_token);
+            snprintf(buffer, sizeof(buffer), "%c %d %c %s", CMD_DISCONNECT, client_arena, player_id, session_token);
             zmq_send(req, buffer, strlen(buffer), 0);
             return 1;
             break;
@@ -199,16 +558,57 @@ int handle_key_input() {
             // Ignore other keys
             return 0;
     }
+    last_request_time = time(NULL);
 
-    // Receive response from the server
+    // Receive response from the server, none within SERVER_TIMEOUT means the server is gone
     int recv_size = zmq_recv(req, buffer, sizeof(buffer) - 1, 0);
     if (recv_size != -1) {
         buffer[recv_size] = '\0';
         
         int response;
         int new_score;
-        if (sscanf(buffer, "%d %d", &response, &new_score) >= 1) {
-            player_score = new_score;
+        int cooldown_ticks;
+        int stun_ticks;
+        unsigned long state_seq;
+        int parsed_len = 0;
+        int num_parsed = sscanf(buffer, "%d %d %d %d %lu%n", &response, &new_score, &cooldown_ticks, &stun_ticks, &state_seq, &parsed_len);
+        if (command_id != 0) {
+            // The server only publishes the ID of an applied command, a batch is applied if one of its commands was
+            int applied = num_parsed >= 1 && response == RESP_OK;
+            if (count > 1 && applied) {
+                applied = 0;
+                int code;
+                int code_len;
+                for (int offset = parsed_len; num_parsed == 5 && sscanf(buffer + offset, " %d%n", &code, &code_len) == 1; offset += code_len) {
+                    applied |= code == RESP_OK;
+                }
+            }
+            latency_command_acked(command_id, applied);
+        }
+        if (use_prediction) {
+            // The game states after state_seq include the moves, a reply without it has no effect
+            if (num_parsed == 5) {
+                prediction_request_replied(state_seq);
+            } else {
+                prediction_reset();
+            }
+        }
+        if (num_parsed >= 1) {
+            // Some errors are answered with the code alone, the fields after it are only used when present
+            if (num_parsed >= 2) {
+                player_score = new_score;
+            }
+            if (num_parsed >= 4) {
+                update_timers(cooldown_ticks, stun_ticks);
+            }
+            // A batch is answered with the code of each command, the first that failed is shown
+            // The codes follow the sequence number, so a reply without it has none
+            int code;
+            int code_len;
+            while (count > 1 && num_parsed == 5 && response == RESP_OK && sscanf(buffer + parsed_len, " %d%n", &code, &code_len) == 1) {
+                response = code;
+                parsed_len += code_len;
+            }
             if (response != RESP_OK) {
                 // Parse error
                 char error_msg[BUFFER_SIZE-25];
@@ -243,17 +643,56 @@ int handle_key_input() {
 
 
     } else {
+        if (use_prediction) {
+            prediction_reset();
+        }
         return -1;
     } 
 
     return -1;
 }
 
+/**
+ * @brief Sends a keepalive so that the server keeps the session of an idle client.
+ *
+ * The server frees the slot of players without requests for SESSION_TIMEOUT seconds.
+ * The reply also tells the client that the server is alive, an error reply (e.g. the game
+ * is over) is ignored like the errors of the other commands.
+ *
+ * @note This function is not thread-safe.
+ *
+ * @return 0 if the server replied, -1 if it did not reply within SERVER_TIMEOUT.
+ */
+int send_keepalive() {
+    char buffer[BUFFER_SIZE];
+    snprintf(buffer, sizeof(buffer), "%c %d %c %s", CMD_KEEPALIVE, client_arena, player_id, session_token);
+    zmq_send(req, buffer, strlen(buffer), 0);
+    last_request_time = time(NULL);
+
+    int recv_size = zmq_recv(req, buffer, sizeof(buffer) - 1, 0);
+    if (recv_size == -1) {
+        return -1;
+    }
+    buffer[recv_size] = '\0';
+
+    int response;
+    int score;
+    int cooldown_ticks;
+    int stun_ticks;
+    if (sscanf(buffer, "%d %d %d %d", &response, &score, &cooldown_ticks, &stun_ticks) == 4) {
+        update_timers(cooldown_ticks, stun_ticks);
+    }
+    return 0;
+}
+
 /**
  * @brief Handles input key events.
  *
- * This function locks the client mutex, sets the input character and marks it as ready,
- * signals the condition variable to notify other threads, and then unlocks the mutex.
+ * This function locks the client mutex, adds the input character to the input queue,
+ * signals the condition variable to notify the client thread, and then unlocks the mutex.
+ * It does not wait for the request of the key, keys pressed while a request is in flight
+ * are sent once its reply arrives. No key is dropped: when the queue is full it waits
+ * for the client thread to take keys from it.
  *
  * It is used by main programs to send characters to the client logic
  * 
@@ -261,19 +700,107 @@ int handle_key_input() {
  */
 void input_key(int ch) {
     pthread_mutex_lock(&client_lock);
-    input_ch = ch;
-    input_ready = 1;
+    while (input_count == INPUT_QUEUE_SIZE) {
+        pthread_cond_wait(&space_cond, &client_lock);
+    }
+    input_queue[(input_head + input_count) % INPUT_QUEUE_SIZE] = ch;
+    if (use_latency) {
+        input_times[(input_head + input_count) % INPUT_QUEUE_SIZE] = client_time();
+    }
+    input_count++;
     pthread_cond_signal(&input_cond);
     pthread_mutex_unlock(&client_lock);
 }
 
+/**
+ * @brief Sets the arena the client asks to join.
+ *
+ * Must be called before client_main.
+ *
+ * @param arena The arena ID, or -1 to let the server pick one.
+ */
+void set_client_arena(int arena) {
+    client_arena = arena;
+}
+
+/**
+ * @brief Sets the file where the session is saved.
+ *
+ * A session found in the file is resumed instead of connecting as a new player,
+ * the file is removed when the player quits. Must be called before client_main.
+ *
+ * @param path The path of the file.
+ */
+void set_client_session_file(const char* path) {
+    session_file = path;
+}
+
+/**
+ * @brief Enables the prediction of the moves of the astronaut.
+ *
+ * The moves are drawn on the display as soon as they are sent, and reconciled with the
+ * game states given to prediction_reconcile. Must be called before client_main.
+ *
+ * @param enabled 1 to predict the moves, 0 to only draw the game states.
+ */
+void set_client_prediction(int enabled) {
+    use_prediction = enabled;
+}
+
+/**
+ * @brief Enables the measurement of the latency of the commands, see latency.h.
+ *
+ * The moves and zaps are sent with a tag, and their replies recorded. The game states
+ * are given to latency_state_received and their frames to latency_state_drawn by the
+ * display client. Must be called before client_main.
+ *
+ * @param enabled 1 to measure the latency, 0 otherwise.
+ */
+void set_client_latency(int enabled) {
+    use_latency = enabled;
+}
+
+/**
+ * @brief Sets the lobby used to connect to the server.
+ *
+ * The lobby picks the arena, set_client_arena is ignored. The other commands are still
+ * sent to the requester given to client_main. Must be called before client_main.
+ *
+ * @param lobby A REQ socket connected to the lobby of the server.
+ */
+void set_client_lobby(void* lobby) {
+    lobby_req = lobby;
+}
+
+/**
+ * @brief Returns the arena the client joined.
+ *
+ * Blocks until client_main finished connecting to the server. The arena can change later,
+ * when the session is lost and the client connects again as a new player.
+ *
+ * @return The arena ID, or -1 if the connection failed.
+ */
+int get_client_arena() {
+    pthread_mutex_lock(&arena_lock);
+    while (client_connected == 0) {
+        pthread_cond_wait(&arena_cond, &arena_lock);
+    }
+    int arena = client_connected == 1 ? client_arena : -1;
+    pthread_mutex_unlock(&arena_lock);
+    return arena;
+}
+
 /**
  * @brief Main function for the client logic.
  *
  * This function initializes the necessary synchronization primitives, sends a connect message to the server,
- * and enters the main client loop to handle key inputs. It uses a mutex and condition variable to synchronize
- * input handling. The function will exit if there is a failure in initialization, connection, or if the key
- * input handling indicates to stop.
+ * and enters the main client loop to handle key inputs. It uses a mutex and condition variables to synchronize
+ * the input queue, which is only locked to take keys, not during requests. The function will exit if there is
+ * a failure in initialization, connection, or if the key input handling indicates to stop.
+ *
+ * The server is not watched by a separate heartbeat: the requests wait at most SERVER_TIMEOUT for the reply,
+ * and an idle client sends a keepalive every SESSION_KEEPALIVE_INTERVAL seconds, which also keeps its session.
+ * When a request gets no reply the session is resumed with resume_session, keeping the slot of the player.
  *
  * @param requester A pointer to the requester object.
  * @param ncurses An integer flag indicating whether ncurses mode is enabled.
@@ -291,10 +818,48 @@ void client_main(void* requester, int ncurses) {
         perror("Client input Condition variable init failed");
         return;
     }
+    if (pthread_cond_init(&space_cond, NULL) != 0) {
+        perror("Client queue Condition variable init failed");
+        return;
+    }
+
+
+    // Give up on requests the server does not reply to
+    // The requester can send a new request after that, and ignores a late reply to the old one
+    int timeout = SERVER_TIMEOUT;
+    int enabled = 1;
+    zmq_setsockopt(req, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    zmq_setsockopt(req, ZMQ_REQ_RELAXED, &enabled, sizeof(enabled));
+    zmq_setsockopt(req, ZMQ_REQ_CORRELATE, &enabled, sizeof(enabled));
+    if (lobby_req != NULL) {
+        zmq_setsockopt(lobby_req, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    }
 
+    // Resume the session of a previous run, or send connect message and receive player ID
+    int ret = -1;
+    if (load_session() == 0) {
+        ret = send_resume_message() == 0 ? 0 : -1;
+    }
+    if (ret == -1) {
+        ret = send_connect_message();
+    }
+    if (ret == 0) {
+        save_session();
+        if (use_prediction) {
+            prediction_start(player_id);
+        }
+        if (use_latency) {
+            latency_start(player_id);
+        }
+    }
+    last_request_time = time(NULL);
+
+    // Wake up threads waiting for the arena
+    pthread_mutex_lock(&arena_lock);
+    client_connected = ret == -1 ? -1 : 1;
+    pthread_cond_broadcast(&arena_cond);
+    pthread_mutex_unlock(&arena_lock);
 
-    // Send connect message and receive player ID
-    int ret = send_connect_message();
     if (ret == -1) {
         perror("Failed to connect to server");
         return;
@@ -303,14 +868,47 @@ void client_main(void* requester, int ncurses) {
     // Main client loop
     while(1) {
         pthread_mutex_lock(&client_lock);
-        while (!input_ready) {
-            pthread_cond_wait(&input_cond, &client_lock);
+        // Wait for a key, until it is time to send a keepalive
+        struct timespec keepalive_time = { last_request_time + SESSION_KEEPALIVE_INTERVAL, 0 };
+        int wait_ret = 0;
+        while (input_count == 0 && wait_ret != ETIMEDOUT) {
+            wait_ret = pthread_cond_timedwait(&input_cond, &client_lock, &keepalive_time);
+        }
+        int keys[MAX_BATCH_COMMANDS];
+        int steps[MAX_BATCH_COMMANDS];
+        int count = 0;
+        double input_time = 0;
+        if (input_count > 0) {
+            input_time = input_times[input_head];
+            steps[0] = dequeue_input(&keys[0]);
+            count = 1;
+            // The moves and zaps queued behind a move or zap go in the same request
+            while (count < MAX_BATCH_COMMANDS && input_count > 0 &&
+                   is_batch_key(keys[0]) && is_batch_key(input_queue[input_head])) {
+                steps[count] = dequeue_input(&keys[count]);
+                count++;
+            }
         }
-        input_ready = 0;
-
-
-        ret = handle_key_input();
         pthread_mutex_unlock(&client_lock);
+        int dequeued = count;
+        count = filter_doomed_keys(keys, steps, count);
+
+        // The request is made without the lock, the keys pressed meanwhile are queued for the next one
+        if (count > 0) {
+            ret = handle_key_input(keys, steps, count, input_time);
+        } else if (dequeued > 0) {
+            ret = 0; // Every key would have been rejected, nothing to send
+        } else {
+            ret = send_keepalive();
+        }
+        if (ret == -1) {
+            // No reply from the server, resume the session once it is back
+            ret = resume_session();
+        }
+        if (ret == 1 && session_file != NULL) {
+            // The player quit, the session is no longer valid
+            remove(session_file);
+        }
         if (ret == 1 || ret == -1) {
             return; // Void return, no error code
         }
@@ -319,6 +917,7 @@ void client_main(void* requester, int ncurses) {
     // Cleanup
     pthread_mutex_destroy(&client_lock);
     pthread_cond_destroy(&input_cond);
+    pthread_cond_destroy(&space_cond);
 
     return;
 }
\ No newline at end of file
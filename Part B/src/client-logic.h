@@ -32,6 +32,21 @@
  */
 void find_error(int code, char *msg);
 
+/**
+ * @brief Returns a monotonic timestamp in seconds, the clock of the predicted timers.
+ *
+ * @return The current time in seconds.
+ */
+double client_time();
+
+/**
+ * @brief Updates the predicted laser cooldown and stun with the timers of a reply.
+ *
+ * @param cooldown_ticks Game ticks left of the laser cooldown.
+ * @param stun_ticks Game ticks left of the stun.
+ */
+void update_timers(int cooldown_ticks, int stun_ticks);
+
 /**
  * @brief Sends a connect message to the server and processes the response.
  *
@@ -45,23 +60,119 @@ void find_error(int code, char *msg);
  */
 int send_connect_message();
 
+/**
+ * @brief Sends a resume message with the current session and processes the response.
+ *
+ * @note This function is not thread-safe.
+ *
+ * @return 0 if the session was resumed, 1 if the server rejected it, or -1 if it did not reply or should be retried.
+ */
+int send_resume_message();
+
+/**
+ * @brief Resumes the session after the server stopped replying, retrying with exponential backoff.
+ *
+ * Falls back to a new connection if the server no longer knows the session.
+ *
+ * @note This function is not thread-safe.
+ *
+ * @return 0 if the client is connected again, -1 if it gave up.
+ */
+int resume_session();
+
+/**
+ * @brief Loads the session saved by a previous run of the client.
+ *
+ * @return 0 if a session was loaded, -1 if there is no session file or it is not valid.
+ */
+int load_session();
+
+/**
+ * @brief Saves the current session, so that a restarted client can resume it.
+ */
+void save_session();
+
+/**
+ * @brief Returns the move direction of a key.
+ *
+ * @param key The key.
+ * @return MOVE_UP, MOVE_DOWN, MOVE_LEFT or MOVE_RIGHT for the arrow keys, '\0' for the other keys.
+ */
+char key_direction(int key);
+
+/**
+ * @brief Takes the next key from the input queue, with the repetitions of an arrow key that follow it.
+ *
+ * @note Must be called with client_lock held and a non empty queue.
+ *
+ * @param key Where the key is stored.
+ * @return The number of times the key was taken, at least 1.
+ */
+int dequeue_input(int* key);
+
+/**
+ * @brief Checks if the command of a key can be sent in a batch request.
+ *
+ * @param key The key.
+ * @return 1 for the arrow keys and space (moves and zaps), 0 for the other keys.
+ */
+int is_batch_key(int key);
+
+/**
+ * @brief Removes the keys whose command the server would reject because of the laser cooldown or a stun.
+ *
+ * The time left is shown instead of sending them.
+ *
+ * @param keys The keys, compacted in place.
+ * @param steps The steps of each key, compacted with the keys.
+ * @param count The number of keys.
+ * @return The number of keys left.
+ */
+int filter_doomed_keys(int* keys, int* steps, int count);
+
+/**
+ * @brief Ends a command with its tag, when measuring the latency.
+ *
+ * @param buffer The command, of BUFFER_SIZE bytes, the tag is appended to it.
+ * @param len The length of the command.
+ * @param input_time Time the first key of the command was pressed.
+ * @param command_id Where the ID of the command is stored, 0 if it is not tagged.
+ * @return The length of the command with the tag.
+ */
+int tag_command(char* buffer, int len, double input_time, unsigned long* command_id);
+
 /**
  * @brief Handles user key input and communicates with the server.
  *
- * Waits for text output to be displayed, processes user input, and sends commands to the server.
+ * Sends the command of the keys to the server and waits for the reply,
+ * more than one key (only moves and zaps) is sent as a batch request.
  * Updates player's score based on server's response.
  * 
  * @note This function is not thread-safe.
  * 
+ * @param keys The keys pressed, in order.
+ * @param steps The number of times each key was pressed in a row, the steps of a move.
+ * @param count The number of keys, at most MAX_BATCH_COMMANDS.
+ * @param input_time Time the first key was pressed, from client_time (only used when measuring the latency).
  * @return 1 if client exits, 0 if client continues, or -1 if an error occurs.
  */
-int handle_key_input();
+int handle_key_input(const int* keys, const int* steps, int count, double input_time);
+
+/**
+ * @brief Sends a keepalive so that the server keeps the session of an idle client.
+ *
+ * @note This function is not thread-safe.
+ *
+ * @return 0 if the server replied, -1 if it did not reply within SERVER_TIMEOUT.
+ */
+int send_keepalive();
 
 /**
  * @brief Handles input key events.
  *
- * This function locks the client mutex, sets the input character and marks it as ready,
- * signals the condition variable to notify other threads, and then unlocks the mutex.
+ * This function locks the client mutex, adds the input character to the input queue,
+ * signals the condition variable to notify the client thread, and then unlocks the mutex.
+ * It only waits when INPUT_QUEUE_SIZE keys are already queued, keys are never dropped.
  *
  * It is used by main programs to send characters to the client logic
  * 
@@ -69,13 +180,69 @@ int handle_key_input();
  */
 void input_key(int ch);
 
+/**
+ * @brief Sets the arena the client asks to join.
+ *
+ * Must be called before client_main.
+ *
+ * @param arena The arena ID, or -1 to let the server pick one.
+ */
+void set_client_arena(int arena);
+
+/**
+ * @brief Sets the file where the session is saved, to resume it after a restart.
+ *
+ * Must be called before client_main.
+ *
+ * @param path The path of the file.
+ */
+void set_client_session_file(const char* path);
+
+/**
+ * @brief Enables the prediction of the moves of the astronaut, see prediction.h.
+ *
+ * Must be called before client_main.
+ *
+ * @param enabled 1 to predict the moves, 0 to only draw the game states.
+ */
+void set_client_prediction(int enabled);
+
+/**
+ * @brief Enables the measurement of the latency of the commands, see latency.h.
+ *
+ * Must be called before client_main.
+ *
+ * @param enabled 1 to measure the latency, 0 otherwise.
+ */
+void set_client_latency(int enabled);
+
+/**
+ * @brief Sets the lobby used to connect to the server.
+ *
+ * The lobby picks the arena, set_client_arena is ignored. Must be called before client_main.
+ *
+ * @param lobby A REQ socket connected to the lobby of the server.
+ */
+void set_client_lobby(void* lobby);
+
+/**
+ * @brief Returns the arena the client joined.
+ *
+ * Blocks until client_main finished connecting to the server. The arena can change later,
+ * when the session is lost and the client connects again as a new player.
+ *
+ * @return The arena ID, or -1 if the connection failed.
+ */
+int get_client_arena();
+
 /**
  * @brief Main function for the client logic.
  *
  * This function initializes the necessary synchronization primitives, sends a connect message to the server,
  * and enters the main client loop to handle key inputs. It uses a mutex and condition variable to synchronize
  * input handling. The function will exit if there is a failure in initialization, connection, or if the key
- * input handling indicates to stop.
+ * input handling indicates to stop. Without input for SESSION_KEEPALIVE_INTERVAL seconds it sends a keepalive.
+ * If the server does not reply within SERVER_TIMEOUT it resumes the session, and exits if that fails.
  *
  * @param requester A pointer to the requester object.
  * @param ncurses An integer flag indicating whether ncurses mode is enabled.
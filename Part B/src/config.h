@@ -23,16 +23,78 @@
 #define GAME_UPDATE_INTERVAL 0.05  // Time between game state updates (seconds)
 #define ALIEN_RECOVERY_TIME 10 // Time for alien to respawn (seconds)
 #define KILL_POINTS 1       // points for killing an alien
+#define MAX_MOVE_STEPS 8     // Most steps of a single move command, repeated keys are sent as one move
+#define MAX_BATCH_COMMANDS 16 // Most moves and zaps in a single batch request
 
 // Network Configuration
 #define SERVER_ENDPOINT_REQ "tcp://*:5555"    // For REQ/REP with astronauts
 #define SERVER_ENDPOINT_PUB "tcp://*:5556"    // For PUB/SUB with display
 #define SERVER_ENDPOINT_SCORES "tcp://*:5557" // For PUB/SUB with scores
-#define SERVER_ENDPOINT_HEARTBEAT "tcp://*:5558" // For PUB/SUB with heartbeat
+#define SERVER_ENDPOINT_LOBBY "tcp://*:5559" // For REQ/REP with astronauts looking for an arena
+#define RELAY_ENDPOINT_PUB "tcp://*:5560" // For PUB/SUB between a spectator relay and its displays
+#define SERVER_ENDPOINT_SNAPSHOT "tcp://*:5561" // For REQ/REP with displays asking for the current state of an arena
+#define SERVER_ENDPOINT_METRICS "tcp://127.0.0.1:5562" // For REQ/REP with monitoring asking for the metrics of the server, local only
+// Unix domain socket endpoints, bound by the server next to the TCP ones for clients on the same host
+// The same endpoint is used to bind and to connect, clients select them with --ipc
+#define IPC_ENDPOINT_REQ "ipc:///tmp/spcinvdrs-req"    // For REQ/REP with astronauts
+#define IPC_ENDPOINT_PUB "ipc:///tmp/spcinvdrs-pub"    // For PUB/SUB with display
+#define IPC_ENDPOINT_SCORES "ipc:///tmp/spcinvdrs-scores" // For PUB/SUB with scores
+#define IPC_ENDPOINT_LOBBY "ipc:///tmp/spcinvdrs-lobby" // For REQ/REP with astronauts looking for an arena
+#define IPC_ENDPOINT_SNAPSHOT "ipc:///tmp/spcinvdrs-snapshot" // For REQ/REP with displays asking for the current state of an arena
+#define IPC_ENDPOINT_METRICS "ipc:///tmp/spcinvdrs-metrics" // For REQ/REP with monitoring asking for the metrics of the server
 #define CLIENT_CONNECT_REQ "tcp://localhost:5555"  // For astronauts to connect
 #define CLIENT_CONNECT_SUB "tcp://localhost:5556"  // For display to connect
-#define CLIENT_CONNECT_HEARTBEAT "tcp://localhost:5558"  // For client heartbeats
-#define HEARTBEAT_FREQUENCY 1 // seconds between heartbeats
+#define CLIENT_CONNECT_LOBBY "tcp://localhost:5559"  // For astronauts to get an arena from the lobby
+#define CLIENT_CONNECT_RELAY "tcp://localhost:5560"  // For displays to connect to a spectator relay
+#define CLIENT_CONNECT_SNAPSHOT "tcp://localhost:5561"  // For displays to get the current state when they start
+#define SNAPSHOT_TIMEOUT 1000 // Time a display waits for the snapshot before using only the published messages (milliseconds)
+#define LISTENER_POLL_INTERVAL 100 // Time the listener waits for a request before checking for game over (milliseconds)
+#define CLIENT_QUEUE_SIZE 4 // Requests of one astronaut session waiting for the listener in each priority lane, more are throttled
+#define MAX_CLIENT_QUEUES 64 // Sessions or connections with requests waiting for the listener, the requests of more are served as they arrive
+#define HIGH_PRIORITY_STREAK 8 // High priority requests served in a row while bulk requests wait
+#define COLLAPSE_BACKLOG 16 // Requests waiting for the listener above which the queued moves of a session are collapsed
+#define METRICS_RATE_WINDOW 5 // Seconds over which the rates of the metrics service are computed from the counters
+#define PUBLISH_INPROC_ENDPOINT "inproc://publish" // Worker threads send their updates to the publisher thread
+#define SERVER_INPROC_PUB "inproc://gamestate" // For PUB/SUB with the display embedded in the server
+#define SERVER_INPROC_SNAPSHOT "inproc://snapshot" // For REQ/REP with the display embedded in the server
+
+// Liveness, ZMTP heartbeats on the data sockets (see heartbeat.c) and sessions tracked by the server
+#define HEARTBEAT_INTERVAL 1000 // Time between heartbeats on idle connections (milliseconds)
+#define HEARTBEAT_TIMEOUT 3000 // Time without traffic before a connection is closed (milliseconds)
+#define SERVER_TIMEOUT 3000 // Time a client waits for a reply or a game state before giving up on the server (milliseconds)
+#define SESSION_KEEPALIVE_INTERVAL 2 // Seconds without input after which an astronaut sends a keepalive
+#define SESSION_TIMEOUT 10 // Seconds without requests after which the server frees the slot of an astronaut
+#define RECONNECT_BACKOFF_MIN 100 // Wait before the first attempt to resume a lost session (milliseconds), doubled after each failure
+#define RECONNECT_BACKOFF_MAX 2000 // Longest wait between attempts to resume a lost session (milliseconds)
+
+// Rate limits of the commands of a session (token buckets), a move takes one token per step
+// Buckets start full, a session idle for a while can send the burst at once
+#define RATE_LIMIT_MOVE 40 // Move steps per second
+#define RATE_BURST_MOVE 40 // Move steps that can be sent at once
+#define RATE_LIMIT_ZAP 5 // Zaps per second, most are rejected by the laser cooldown anyway
+#define RATE_BURST_ZAP 10
+#define RATE_LIMIT_OTHER 5 // Keepalives and resumes per second
+#define RATE_BURST_OTHER 10
+
+// Arenas (independent games hosted by one server)
+#define MAX_ARENAS 256 // Maximum number of arenas in one server
+#define DEFAULT_ARENAS 1 // Arenas hosted when the number is not given to the server
+#define ARENA_TOPIC_FORMAT "%03d" // Topic of the published messages of an arena, fixed width so that prefixes do not match other arenas
+#define ARENA_TOPIC_LEN 3
+
+// Timeline of the server threads (see trace.h)
+#define DEFAULT_TRACE_FILE "spcinvdrs-trace.json" // Written by a capture started with SIGHUP when --trace is not given
+
+// Envelope frame sent before every published message, "<arena><type> <seq> <epoch>" (see envelope.h)
+// Subscribing to the arena and type prefix receives one type of message of one arena
+#define ENVELOPE_PREFIX_LEN (ARENA_TOPIC_LEN + 1)
+#define ENVELOPE_MAX_LEN 48
+#define MSG_TYPE_SNAPSHOT 'K' // Full game state of an arena (keyframe), on the game state publisher
+#define MSG_TYPE_DELTA 'D' // Changes since the previous message of the arena, reserved for incremental updates
+#define MSG_TYPE_GAME_OVER 'G' // Game over state, on both publishers
+#define MSG_TYPE_EVENT 'E' // Events that are not part of the game state, reserved
+#define MSG_TYPE_SCORES 'S' // Protobuf score update, on the scores publisher
+#define SESSION_TOKEN_ARENA_LEN 2 // Hexadecimal digits of the arena at the start of the session tokens, enough for MAX_ARENAS
 
 // Game Constants
 #define GRID_WIDTH 20
@@ -40,6 +102,7 @@
 #define MAX_PLAYERS 8
 #define MAX_ALIENS 4 // 1/3 of grid area?
 #define BUFFER_SIZE 2048
+#define INPUT_QUEUE_SIZE 64 // Keys an astronaut client keeps while the previous request is in flight
 #define LASER_DURATION 0.5
 
 // UI Positions
@@ -65,6 +128,10 @@
 #define CMD_DISCONNECT 'D'
 #define CMD_MOVE 'M'
 #define MSG_ZAP 'Z'
+#define CMD_KEEPALIVE 'K'
+#define CMD_RESUME 'R'
+#define CMD_BATCH 'B'
+#define COMMAND_TAG '#' // Ends a command with its ID, "<command> #<command_id>", sent by clients measuring their latency
 
 // Command Movement Directions
 #define MOVE_UP 'U'
@@ -102,5 +169,9 @@
 #define ERR_INVALID_DIR_MSG "Invalid dirrection"
 #define ERR_LASER_COOLDOWN -9
 #define ERR_LASER_COOLDOWN_MSG "Laser cooldown"
+#define ERR_INVALID_ARENA -10
+#define ERR_INVALID_ARENA_MSG "Invalid arena"
+#define ERR_THROTTLED -11
+#define ERR_THROTTLED_MSG "Too many requests"
 
 #endif
\ No newline at end of file
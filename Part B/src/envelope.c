@@ -0,0 +1,166 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: envelope.c
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Envelope frame of the published messages: arena, message type, sequence number and server epoch.
+ * Also requests snapshots, which are sent with the same envelope.
+ */
+
+#include <stdio.h>
+#include <zmq.h>
+#include "config.h"
+#include "envelope.h"
+
+
+/**
+ * @brief Writes the envelope frame of a message.
+ *
+ * @param buffer Where the frame is written, at least ENVELOPE_MAX_LEN bytes.
+ * @param envelope The envelope to write.
+ * @return The length of the frame, without the null terminator.
+ */
+int envelope_format(char* buffer, const Envelope_t* envelope) {
+    return snprintf(buffer, ENVELOPE_MAX_LEN, ARENA_TOPIC_FORMAT "%c %lu %lu",
+                    envelope->arena % MAX_ARENAS, envelope->type, envelope->seq, envelope->epoch);
+}
+
+/**
+ * @brief Writes the prefix that subscribes to one type of message of an arena.
+ *
+ * Subscribing to the ARENA_TOPIC_LEN first bytes of it receives all types of the arena.
+ *
+ * @param buffer Where the prefix is written, at least ENVELOPE_PREFIX_LEN + 1 bytes.
+ * @param arena The arena.
+ * @param type The message type.
+ * @return The length of the prefix, ENVELOPE_PREFIX_LEN.
+ */
+int envelope_prefix(char* buffer, int arena, char type) {
+    return snprintf(buffer, ENVELOPE_PREFIX_LEN + 1, ARENA_TOPIC_FORMAT "%c", arena % MAX_ARENAS, type);
+}
+
+/**
+ * @brief Parses a received envelope frame.
+ *
+ * @param frame The frame, does not need to be null terminated.
+ * @param len The length of the frame in bytes.
+ * @param envelope Where the parsed envelope is stored.
+ * @return 0 on success, -1 if the frame is not a valid envelope.
+ */
+int envelope_parse(const char* frame, size_t len, Envelope_t* envelope) {
+    if (len < ENVELOPE_PREFIX_LEN + 2 || len >= ENVELOPE_MAX_LEN || frame[ENVELOPE_PREFIX_LEN] != ' ') {
+        return -1;
+    }
+
+    int arena = 0;
+    for (int i = 0; i < ARENA_TOPIC_LEN; i++) {
+        if (frame[i] < '0' || frame[i] > '9') {
+            return -1;
+        }
+        arena = arena * 10 + (frame[i] - '0');
+    }
+
+    // Sequence number and epoch, separated by one space
+    unsigned long numbers[2] = {0, 0};
+    int field = 0;
+    size_t digits = 0;
+    for (size_t i = ENVELOPE_PREFIX_LEN + 1; i < len; i++) {
+        if (frame[i] == ' ' && field == 0 && digits > 0) {
+            field = 1;
+            digits = 0;
+            continue;
+        }
+        if (frame[i] < '0' || frame[i] > '9') {
+            return -1;
+        }
+        numbers[field] = numbers[field] * 10 + (unsigned long)(frame[i] - '0');
+        digits++;
+    }
+    if (field != 1 || digits == 0) {
+        return -1;
+    }
+
+    envelope->arena = arena;
+    envelope->type = frame[ARENA_TOPIC_LEN];
+    envelope->seq = numbers[0];
+    envelope->epoch = numbers[1];
+    return 0;
+}
+
+/**
+ * @brief Tells if a received message is newer than the last one applied.
+ *
+ * Messages not newer than the last one are the ones already included in a snapshot, or repeated
+ * by the relay. A message of another epoch comes from a restarted server, whose sequence numbers
+ * start again at 1, so the subscriber starts over from it instead of waiting for the old sequence
+ * number. The subscribed messages are full game states, so nothing is missing after it.
+ *
+ * @param envelope The envelope of the received message.
+ * @param last The envelope of the last message applied, zeroed if none was applied.
+ * @return 1 if the message is newer, 0 if it should be dropped.
+ */
+int envelope_is_newer(const Envelope_t* envelope, const Envelope_t* last) {
+    return envelope->epoch != last->epoch || envelope->seq > last->seq;
+}
+
+/**
+ * @brief Requests the current state of an arena from the snapshot service of the server.
+ *
+ * The reply has the envelope and the message, with the sequence number of the last published
+ * message of the arena. The caller then only applies the published messages with a higher
+ * sequence number. A new socket is used for each request, a REQ socket cannot be reused
+ * after a request without reply.
+ *
+ * @param context The ZeroMQ context used to create the request socket.
+ * @param endpoint The endpoint of the snapshot service.
+ * @param arena The arena.
+ * @param envelope Where the envelope of the snapshot is stored.
+ * @param buffer Where the message is stored, not null terminated.
+ * @param size The size of the buffer.
+ * @return The length of the message, or -1 if there was no valid reply within SNAPSHOT_TIMEOUT.
+ */
+int envelope_request_snapshot(void* context, const char* endpoint, int arena, Envelope_t* envelope, char* buffer, size_t size) {
+    void* socket = zmq_socket(context, ZMQ_REQ);
+    if (socket == NULL) {
+        return -1;
+    }
+    int timeout = SNAPSHOT_TIMEOUT;
+    int linger = 0;
+    zmq_setsockopt(socket, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+    if (zmq_connect(socket, endpoint) != 0) {
+        zmq_close(socket);
+        return -1;
+    }
+
+    char request[16];
+    int len = snprintf(request, sizeof(request), "%d", arena);
+    zmq_send(socket, request, len, 0);
+
+    // An error reply has a single frame
+    char frame[ENVELOPE_MAX_LEN];
+    int frame_len = zmq_recv(socket, frame, sizeof(frame), 0);
+    int more = 0;
+    size_t more_size = sizeof(more);
+    if (frame_len != -1) {
+        zmq_getsockopt(socket, ZMQ_RCVMORE, &more, &more_size);
+    }
+    if (frame_len == -1 || !more || envelope_parse(frame, frame_len, envelope) != 0) {
+        zmq_close(socket);
+        return -1;
+    }
+
+    int message_len = zmq_recv(socket, buffer, size, 0);
+    zmq_close(socket);
+    if (message_len > (int)size) {
+        message_len = size; // Message was truncated
+    }
+    return message_len;
+}
@@ -0,0 +1,99 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: envelope.h
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Header file for envelope.c
+ */
+
+#ifndef ENVELOPE_H
+#define ENVELOPE_H
+
+#include <stddef.h>
+
+/**
+ * @struct Envelope_t
+ * @brief The envelope frame sent before every published message.
+ *
+ * The frame is the text "<arena><type> <seq> <epoch>", with the arena in ARENA_TOPIC_FORMAT.
+ * The arena and type come first so that subscribers can filter with prefix subscriptions.
+ *
+ * @var Envelope_t::arena
+ * Arena the message belongs to.
+ *
+ * @var Envelope_t::type
+ * Message type (MSG_TYPE_SNAPSHOT, MSG_TYPE_DELTA, MSG_TYPE_GAME_OVER, MSG_TYPE_EVENT or MSG_TYPE_SCORES).
+ *
+ * @var Envelope_t::seq
+ * Sequence number of the message in its arena and publisher, starts at 1.
+ *
+ * @var Envelope_t::epoch
+ * Start time of the server in microseconds. The sequence numbers start again at 1 when
+ * the server restarts, the epoch tells the messages of the new server from the old ones.
+ */
+typedef struct {
+    int arena;
+    char type;
+    unsigned long seq;
+    unsigned long epoch;
+} Envelope_t;
+
+/**
+ * @brief Writes the envelope frame of a message.
+ *
+ * @param buffer Where the frame is written, at least ENVELOPE_MAX_LEN bytes.
+ * @param envelope The envelope to write.
+ * @return The length of the frame, without the null terminator.
+ */
+int envelope_format(char* buffer, const Envelope_t* envelope);
+
+/**
+ * @brief Writes the prefix that subscribes to one type of message of an arena.
+ *
+ * @param buffer Where the prefix is written, at least ENVELOPE_PREFIX_LEN + 1 bytes.
+ * @param arena The arena.
+ * @param type The message type.
+ * @return The length of the prefix, ENVELOPE_PREFIX_LEN.
+ */
+int envelope_prefix(char* buffer, int arena, char type);
+
+/**
+ * @brief Parses a received envelope frame.
+ *
+ * @param frame The frame, does not need to be null terminated.
+ * @param len The length of the frame in bytes.
+ * @param envelope Where the parsed envelope is stored.
+ * @return 0 on success, -1 if the frame is not a valid envelope.
+ */
+int envelope_parse(const char* frame, size_t len, Envelope_t* envelope);
+
+/**
+ * @brief Tells if a received message is newer than the last one applied.
+ *
+ * @param envelope The envelope of the received message.
+ * @param last The envelope of the last message applied, zeroed if none was applied.
+ * @return 1 if the message is newer, 0 if it should be dropped.
+ */
+int envelope_is_newer(const Envelope_t* envelope, const Envelope_t* last);
+
+/**
+ * @brief Requests the current state of an arena from the snapshot service of the server.
+ *
+ * @param context The ZeroMQ context used to create the request socket.
+ * @param endpoint The endpoint of the snapshot service.
+ * @param arena The arena.
+ * @param envelope Where the envelope of the snapshot is stored.
+ * @param buffer Where the message is stored, not null terminated.
+ * @param size The size of the buffer.
+ * @return The length of the message, or -1 if there was no valid reply within SNAPSHOT_TIMEOUT.
+ */
+int envelope_request_snapshot(void* context, const char* endpoint, int arena, Envelope_t* envelope, char* buffer, size_t size);
+
+#endif
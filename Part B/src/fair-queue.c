@@ -0,0 +1,410 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: fair-queue.c
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Requests of the astronauts received on a ROUTER socket, queued per client and served in turn.
+ * A REP socket serves the requests in the order they arrive, so a client sending requests
+ * faster than they are served delays the requests of all the other clients. With a queue per
+ * client and one request served per client in turn, the others wait for at most one request
+ * of each client, and the requests over the CLIENT_QUEUE_SIZE of a client are rejected.
+ * A client is the session of an astronaut, whatever the connections its requests come from.
+ * Zaps, connects, resumes and disconnects go to a high priority lane served before the moves,
+ * and when the backlog is long the moves queued by a client are collapsed into a single move.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <zmq.h>
+#include "config.h"
+#include "fair-queue.h"
+#include "stage-metrics.h"
+
+
+/**
+ * @brief Moves the frames of a request to another one, the source is left empty.
+ *
+ * @param dst Where the request is moved, its frames must not be initialized.
+ * @param src The request.
+ */
+void request_move(Request_t* dst, Request_t* src) {
+    for (int i = 0; i < src->num_frames; i++) {
+        zmq_msg_init(&dst->frames[i]);
+        zmq_msg_move(&dst->frames[i], &src->frames[i]);
+        zmq_msg_close(&src->frames[i]);
+    }
+    dst->num_frames = src->num_frames;
+    dst->queued_time = src->queued_time;
+    dst->collapsed = src->collapsed;
+    src->num_frames = 0;
+}
+
+/**
+ * @brief Receives a request from a ROUTER socket, with its envelope.
+ *
+ * The frames are the routing id of the client, the request id if the client uses
+ * ZMQ_REQ_CORRELATE, the empty delimiter of the REQ socket and the payload.
+ * Requests with another layout are dropped without reply.
+ *
+ * @param socket The ROUTER socket.
+ * @param request Where the request is stored, closed with request_close or request_reply.
+ * @param flags 0 to wait for a request, ZMQ_DONTWAIT otherwise.
+ * @return 0 on success, -1 if there was no request or it was not a valid request.
+ */
+int request_recv(void* socket, Request_t* request, int flags) {
+    request->num_frames = 0;
+    int valid = 1;
+    int more = 1;
+    while (more) {
+        // Frames over MAX_REQUEST_FRAMES are received in the last one and dropped
+        int i = request->num_frames < MAX_REQUEST_FRAMES ? request->num_frames : MAX_REQUEST_FRAMES - 1;
+        if (i < request->num_frames) {
+            zmq_msg_close(&request->frames[i]);
+            valid = 0;
+        }
+        zmq_msg_init(&request->frames[i]);
+        // The frames after the first one arrive with it, the flags only apply to the first one
+        if (zmq_msg_recv(&request->frames[i], socket, request->num_frames == 0 ? flags : 0) == -1) {
+            zmq_msg_close(&request->frames[i]);
+            request_close(request);
+            return -1;
+        }
+        more = zmq_msg_more(&request->frames[i]);
+        request->num_frames = i + 1;
+    }
+
+    // The payload follows the empty delimiter that ends the envelope
+    if (!valid || request->num_frames < 3 || zmq_msg_size(&request->frames[request->num_frames - 2]) != 0) {
+        request_close(request);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Sends the reply to a request and closes the request.
+ *
+ * The envelope of the request is sent back before the reply, so that the ROUTER socket
+ * routes it to the client and the REQ socket of the client matches it to the request.
+ *
+ * @param socket The ROUTER socket the request was received on.
+ * @param request The request.
+ * @param response The reply.
+ * @param len The length of the reply in bytes.
+ * @return 0 on success, -1 if the reply could not be sent.
+ */
+int request_reply(void* socket, Request_t* request, const char* response, size_t len) {
+    int ret = 0;
+    for (int i = 0; i < request->num_frames - 1 && ret == 0; i++) {
+        if (zmq_msg_send(&request->frames[i], socket, ZMQ_SNDMORE) == -1) {
+            ret = -1;
+        }
+    }
+    if (ret == 0 && zmq_send(socket, response, len, 0) == -1) {
+        ret = -1;
+    }
+    request_close(request);
+    return ret;
+}
+
+/**
+ * @brief Closes a request without replying to it.
+ *
+ * @param request The request.
+ */
+void request_close(Request_t* request) {
+    for (int i = 0; i < request->num_frames; i++) {
+        zmq_msg_close(&request->frames[i]);
+    }
+    request->num_frames = 0;
+}
+
+/**
+ * @brief Returns the payload of a request, not null terminated.
+ *
+ * @param request The request.
+ * @param len Where the length of the payload in bytes is stored.
+ * @return The payload.
+ */
+const char* request_payload(Request_t* request, size_t* len) {
+    zmq_msg_t* payload = &request->frames[request->num_frames - 1];
+    *len = zmq_msg_size(payload);
+    return zmq_msg_data(payload);
+}
+
+/**
+ * @brief Returns the priority lane of a request from its command.
+ *
+ * Zaps, connects, resumes and disconnects are latency critical and rare, the rate of
+ * zaps is also bounded by the laser cooldown. Moves, batches and keepalives are bulk.
+ *
+ * @param payload The payload of the request, not null terminated.
+ * @param len The length of the payload in bytes.
+ * @return PRIORITY_HIGH or PRIORITY_BULK.
+ */
+int request_priority(const char* payload, size_t len) {
+    if (len > 0 && (payload[0] == MSG_ZAP || payload[0] == CMD_CONNECT || payload[0] == CMD_RESUME || payload[0] == CMD_DISCONNECT)) {
+        return PRIORITY_HIGH;
+    }
+    return PRIORITY_BULK;
+}
+
+/**
+ * @brief Writes the key of the client queue of a request.
+ *
+ * The requests of a session, "<cmd> <arena> <id> <token> ...", share the queue of the session.
+ * A REQ socket has one request in flight, so the queue of a connection never has two moves
+ * to collapse. The moves of a session pile up when the astronaut sends them on several
+ * connections, or resends them after a timeout. The token is part of the key, so that
+ * requests naming the player of another session do not fill its queue.
+ * Connects have no session yet, they are queued by the routing id of their connection.
+ * The first byte tells the two kinds of keys apart.
+ *
+ * @param request The request.
+ * @param key Where the key is written, at least MAX_CLIENT_KEY_LEN bytes.
+ * @return The length of the key, or 0 if the request has no valid key.
+ */
+size_t request_client_key(Request_t* request, unsigned char* key) {
+    size_t len;
+    const char* payload = request_payload(request, &len);
+    if (len > 0 && payload[0] != CMD_CONNECT) {
+        // The session is at the start of the command, within the length of a move
+        char text[MAX_MOVE_LEN];
+        size_t text_len = len < sizeof(text) ? len : sizeof(text) - 1;
+        memcpy(text, payload, text_len);
+        text[text_len] = '\0';
+
+        int arena;
+        char id;
+        char token[33];
+        if (sscanf(text, "%*c %d %c %32s", &arena, &id, token) == 3) {
+            key[0] = 'S';
+            return 1 + snprintf((char*)key + 1, MAX_CLIENT_KEY_LEN - 1, "%d %c %s", arena, id, token);
+        }
+    }
+
+    size_t routing_id_len = zmq_msg_size(&request->frames[0]);
+    if (routing_id_len > MAX_ROUTING_ID_LEN) {
+        return 0;
+    }
+    key[0] = 'R';
+    memcpy(key + 1, zmq_msg_data(&request->frames[0]), routing_id_len);
+    return 1 + routing_id_len;
+}
+
+/**
+ * @brief Parses a MOVE request, to collapse it with another move.
+ *
+ * Only the layout is checked, the session is checked when the move is processed.
+ *
+ * @param payload The payload of the request, not null terminated.
+ * @param len The length of the payload in bytes.
+ * @param prefix_len Where the length of "M <arena> <id> <token> <direction>" is stored.
+ * @return The steps of the move, or 0 if the request is not a move that can be collapsed.
+ */
+int parse_move(const char* payload, size_t len, int* prefix_len) {
+    char text[MAX_MOVE_LEN];
+    if (len == 0 || len >= sizeof(text) || payload[0] != CMD_MOVE) {
+        return 0;
+    }
+    memcpy(text, payload, len);
+    text[len] = '\0';
+
+    char direction;
+    int end = 0;
+    if (sscanf(text, "%*c %*d %*c %*32s %c%n", &direction, &end) != 1 || end == 0) {
+        return 0;
+    }
+    int steps = 1;
+    int steps_len = 0;
+    const char* rest = text + end;
+    if (sscanf(rest, " %d%n", &steps, &steps_len) == 1) {
+        rest += steps_len;
+    }
+    while (isspace((unsigned char)*rest)) rest++;
+    if (*rest != '\0' || steps < 1 || steps > MAX_MOVE_STEPS) {
+        return 0;
+    }
+
+    *prefix_len = end;
+    return steps;
+}
+
+/**
+ * @brief Adds the move of a request to the last request queued by its client, if both are the same move.
+ *
+ * The moves are the same if they have the same session and direction, and their steps together
+ * are at most MAX_MOVE_STEPS. The request stays in the queue, marked as collapsed, so that it
+ * is replied with the request that has its move.
+ *
+ * @param client The queue of the client in the bulk lane.
+ * @param request The request.
+ * @return 1 if the move was added, 0 otherwise.
+ */
+int collapse_move(ClientQueue_t* client, Request_t* request) {
+    if (client->count == 0) {
+        return 0;
+    }
+
+    // The request with the move is the last one that is not collapsed
+    int i = (client->head + client->count - 1) % CLIENT_QUEUE_SIZE;
+    while (client->requests[i].collapsed) {
+        i = (i + CLIENT_QUEUE_SIZE - 1) % CLIENT_QUEUE_SIZE;
+    }
+    Request_t* target = &client->requests[i];
+
+    size_t target_len;
+    size_t len;
+    const char* target_payload = request_payload(target, &target_len);
+    const char* payload = request_payload(request, &len);
+    int target_prefix_len;
+    int prefix_len;
+    int target_steps = parse_move(target_payload, target_len, &target_prefix_len);
+    int steps = parse_move(payload, len, &prefix_len);
+    if (target_steps == 0 || steps == 0 || target_prefix_len != prefix_len ||
+        memcmp(target_payload, payload, prefix_len) != 0 || target_steps + steps > MAX_MOVE_STEPS) {
+        return 0;
+    }
+
+    char merged[MAX_MOVE_LEN + 8];
+    int merged_len = snprintf(merged, sizeof(merged), "%.*s %d", prefix_len, payload, target_steps + steps);
+    zmq_msg_t* frame = &target->frames[target->num_frames - 1];
+    zmq_msg_close(frame);
+    zmq_msg_init_size(frame, merged_len);
+    memcpy(zmq_msg_data(frame), merged, merged_len);
+    request->collapsed = 1;
+    return 1;
+}
+
+/**
+ * @brief Adds a request to the queue of its client in its priority lane.
+ *
+ * The client is identified by its key (see request_client_key). A client without
+ * requests waiting in the lane has no queue in it, it gets a free one.
+ * When more than COLLAPSE_BACKLOG requests are waiting, a move is collapsed with
+ * the move queued before it by the same client, if possible.
+ *
+ * @param queue The fair queue.
+ * @param request The request, moved to the queue on success.
+ * @return 0 on success, FAIR_QUEUE_CLIENT_FULL if the client already has CLIENT_QUEUE_SIZE requests
+ * waiting in the lane, or FAIR_QUEUE_FULL if MAX_CLIENT_QUEUES other clients have requests waiting in it.
+ */
+int fair_queue_push(FairQueue_t* queue, Request_t* request) {
+    size_t len;
+    const char* payload = request_payload(request, &len);
+    Lane_t* lane = &queue->lanes[request_priority(payload, len)];
+    unsigned char key[MAX_CLIENT_KEY_LEN];
+    size_t key_len = request_client_key(request, key);
+
+    ClientQueue_t* client = NULL;
+    ClientQueue_t* free_client = NULL;
+    for (int i = 0; i < MAX_CLIENT_QUEUES && client == NULL; i++) {
+        ClientQueue_t* other = &lane->clients[i];
+        if (other->count == 0) {
+            if (free_client == NULL) {
+                free_client = other;
+            }
+        } else if (other->key_len == key_len && memcmp(other->key, key, key_len) == 0) {
+            client = other;
+        }
+    }
+
+    if (client == NULL) {
+        if (free_client == NULL || key_len == 0) {
+            return FAIR_QUEUE_FULL;
+        }
+        client = free_client;
+        memcpy(client->key, key, key_len);
+        client->key_len = key_len;
+        client->head = 0;
+    } else if (client->count == CLIENT_QUEUE_SIZE) {
+        return FAIR_QUEUE_CLIENT_FULL;
+    }
+
+    request->collapsed = 0;
+    if (lane == &queue->lanes[PRIORITY_BULK] && queue->queued >= COLLAPSE_BACKLOG && collapse_move(client, request)) {
+        lane->collapsed++;
+    }
+    request->queued_time = stage_time();
+    request_move(&client->requests[(client->head + client->count) % CLIENT_QUEUE_SIZE], request);
+    client->count++;
+    lane->queued++;
+    queue->queued++;
+    return 0;
+}
+
+/**
+ * @brief Takes the oldest request of the next client in turn, high priority lane first.
+ *
+ * In each lane the clients are served in the order of their queues, one request each,
+ * starting after the client served last. A client with many requests waiting is served
+ * once for every request of each other client with requests waiting. The bulk lane is
+ * served after HIGH_PRIORITY_STREAK high priority requests in a row, so that a flood of
+ * zaps does not stop the moves.
+ *
+ * @param queue The fair queue.
+ * @param requests Where the request and the requests collapsed with it are moved, CLIENT_QUEUE_SIZE requests.
+ * The first one is processed, all of them are replied with its reply.
+ * @return The number of requests moved, 0 if no request is queued.
+ */
+int fair_queue_pop(FairQueue_t* queue, Request_t* requests) {
+    int priority = PRIORITY_HIGH;
+    if (queue->lanes[PRIORITY_HIGH].queued == 0 ||
+        (queue->high_streak >= HIGH_PRIORITY_STREAK && queue->lanes[PRIORITY_BULK].queued > 0)) {
+        priority = PRIORITY_BULK;
+    }
+    Lane_t* lane = &queue->lanes[priority];
+    if (lane->queued == 0) {
+        return 0;
+    }
+    queue->high_streak = priority == PRIORITY_HIGH ? queue->high_streak + 1 : 0;
+
+    unsigned long long now = stage_time();
+    for (int n = 0; n < MAX_CLIENT_QUEUES; n++) {
+        int i = (lane->next + n) % MAX_CLIENT_QUEUES;
+        ClientQueue_t* client = &lane->clients[i];
+        if (client->count > 0) {
+            int count = 0;
+            do {
+                Request_t* request = &client->requests[client->head];
+                histogram_record(&lane->wait, now - request->queued_time);
+                request_move(&requests[count++], request);
+                client->head = (client->head + 1) % CLIENT_QUEUE_SIZE;
+                client->count--;
+                lane->queued--;
+                queue->queued--;
+            } while (client->count > 0 && client->requests[client->head].collapsed);
+            lane->next = (i + 1) % MAX_CLIENT_QUEUES;
+            return count;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Closes all the queued requests without replying to them.
+ *
+ * @param queue The fair queue.
+ */
+void fair_queue_clear(FairQueue_t* queue) {
+    for (int lane = 0; lane < PRIORITY_LANES; lane++) {
+        for (int i = 0; i < MAX_CLIENT_QUEUES; i++) {
+            ClientQueue_t* client = &queue->lanes[lane].clients[i];
+            while (client->count > 0) {
+                request_close(&client->requests[client->head]);
+                client->head = (client->head + 1) % CLIENT_QUEUE_SIZE;
+                client->count--;
+            }
+        }
+        queue->lanes[lane].queued = 0;
+    }
+    queue->queued = 0;
+}
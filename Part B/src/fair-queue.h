@@ -0,0 +1,230 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: fair-queue.h
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Header file for fair-queue.c
+ */
+
+#ifndef FAIR_QUEUE_H
+#define FAIR_QUEUE_H
+
+#include <stddef.h>
+#include <zmq.h>
+#include "config.h"
+#include "histogram.h"
+
+// Frames of a request on the ROUTER socket: routing id, request id of REQ_CORRELATE, empty delimiter and payload
+#define MAX_REQUEST_FRAMES 4
+#define MAX_ROUTING_ID_LEN 255 // Longest routing id of ZeroMQ
+#define MAX_CLIENT_KEY_LEN (MAX_ROUTING_ID_LEN + 1) // Key of the queue of a client, a tag and the session or routing id
+#define MAX_MOVE_LEN 64 // Longest MOVE request that can be collapsed, "M <arena> <id> <token> <direction> <steps>"
+
+// Priority lanes of the requests, the high priority lane is served first
+#define PRIORITY_HIGH 0 // Zaps, connects, resumes and disconnects
+#define PRIORITY_BULK 1 // Moves, batches and keepalives
+#define PRIORITY_LANES 2
+
+/**
+ * @struct Request_t
+ * @brief A request received on a ROUTER socket, with the envelope needed to reply to it.
+ *
+ * @var Request_t::frames
+ * The envelope frames, the empty delimiter and the payload, which is the last frame.
+ *
+ * @var Request_t::num_frames
+ * Number of frames of the request.
+ *
+ * @var Request_t::queued_time
+ * Monotonic timestamp of when the request was queued, in nanoseconds (see stage_time).
+ *
+ * @var Request_t::collapsed
+ * Set when the move of the request was added to the request queued before it.
+ * The request is replied with the reply of that request.
+ */
+typedef struct {
+    zmq_msg_t frames[MAX_REQUEST_FRAMES];
+    int num_frames;
+    unsigned long long queued_time;
+    int collapsed;
+} Request_t;
+
+/**
+ * @struct ClientQueue_t
+ * @brief The requests of one client in one priority lane waiting for the listener, oldest first.
+ *
+ * @var ClientQueue_t::key
+ * Key of the client, from the session of its requests or the routing id of its connection (see request_client_key).
+ *
+ * @var ClientQueue_t::requests
+ * Ring buffer of the requests.
+ */
+typedef struct {
+    unsigned char key[MAX_CLIENT_KEY_LEN];
+    size_t key_len;
+    Request_t requests[CLIENT_QUEUE_SIZE];
+    int head;
+    int count; // The queue is free when 0
+} ClientQueue_t;
+
+/**
+ * @struct Lane_t
+ * @brief The queues of the clients with requests waiting in one priority lane, served in turn.
+ *
+ * @var Lane_t::next
+ * Queue checked first by the next fair_queue_pop, the one after the last served.
+ *
+ * @var Lane_t::queued
+ * Number of requests in all the queues of the lane.
+ *
+ * @var Lane_t::collapsed
+ * Number of requests of the lane collapsed with the request before them.
+ *
+ * @var Lane_t::wait
+ * Histogram of the time the requests taken from the lane waited in it, in nanoseconds.
+ */
+typedef struct {
+    ClientQueue_t clients[MAX_CLIENT_QUEUES];
+    int next;
+    int queued;
+    unsigned long collapsed;
+    Histogram_t wait;
+} Lane_t;
+
+/**
+ * @struct FairQueue_t
+ * @brief Requests waiting for the listener, in priority lanes and per client.
+ *
+ * @var FairQueue_t::lanes
+ * The lanes, one per priority.
+ *
+ * @var FairQueue_t::queued
+ * Number of requests in all the lanes.
+ *
+ * @var FairQueue_t::high_streak
+ * High priority requests served since the last bulk one.
+ */
+typedef struct {
+    Lane_t lanes[PRIORITY_LANES];
+    int queued;
+    int high_streak;
+} FairQueue_t;
+
+#define FAIR_QUEUE_CLIENT_FULL -1 // The queue of the client is full, the request is rejected
+#define FAIR_QUEUE_FULL -2 // No free queue for a new client, the request is served now
+
+/**
+ * @brief Moves the frames of a request to another one, the source is left empty.
+ *
+ * @param dst Where the request is moved, its frames must not be initialized.
+ * @param src The request.
+ */
+void request_move(Request_t* dst, Request_t* src);
+
+/**
+ * @brief Receives a request from a ROUTER socket, with its envelope.
+ *
+ * @param socket The ROUTER socket.
+ * @param request Where the request is stored, closed with request_close or request_reply.
+ * @param flags 0 to wait for a request, ZMQ_DONTWAIT otherwise.
+ * @return 0 on success, -1 if there was no request or it was not a valid request.
+ */
+int request_recv(void* socket, Request_t* request, int flags);
+
+/**
+ * @brief Sends the reply to a request and closes the request.
+ *
+ * @param socket The ROUTER socket the request was received on.
+ * @param request The request.
+ * @param response The reply.
+ * @param len The length of the reply in bytes.
+ * @return 0 on success, -1 if the reply could not be sent.
+ */
+int request_reply(void* socket, Request_t* request, const char* response, size_t len);
+
+/**
+ * @brief Closes a request without replying to it.
+ *
+ * @param request The request.
+ */
+void request_close(Request_t* request);
+
+/**
+ * @brief Returns the payload of a request, not null terminated.
+ *
+ * @param request The request.
+ * @param len Where the length of the payload in bytes is stored.
+ * @return The payload.
+ */
+const char* request_payload(Request_t* request, size_t* len);
+
+/**
+ * @brief Returns the priority lane of a request from its command.
+ *
+ * @param payload The payload of the request, not null terminated.
+ * @param len The length of the payload in bytes.
+ * @return PRIORITY_HIGH or PRIORITY_BULK.
+ */
+int request_priority(const char* payload, size_t len);
+
+/**
+ * @brief Writes the key of the client queue of a request.
+ *
+ * @param request The request.
+ * @param key Where the key is written, at least MAX_CLIENT_KEY_LEN bytes.
+ * @return The length of the key, or 0 if the request has no valid key.
+ */
+size_t request_client_key(Request_t* request, unsigned char* key);
+
+/**
+ * @brief Parses a MOVE request, to collapse it with another move.
+ *
+ * @param payload The payload of the request, not null terminated.
+ * @param len The length of the payload in bytes.
+ * @param prefix_len Where the length of "M <arena> <id> <token> <direction>" is stored.
+ * @return The steps of the move, or 0 if the request is not a move that can be collapsed.
+ */
+int parse_move(const char* payload, size_t len, int* prefix_len);
+
+/**
+ * @brief Adds the move of a request to the last request queued by its client, if both are the same move.
+ *
+ * @param client The queue of the client in the bulk lane.
+ * @param request The request.
+ * @return 1 if the move was added, 0 otherwise.
+ */
+int collapse_move(ClientQueue_t* client, Request_t* request);
+
+/**
+ * @brief Adds a request to the queue of its client in its priority lane.
+ *
+ * @param queue The fair queue.
+ * @param request The request, moved to the queue on success.
+ * @return 0 on success, FAIR_QUEUE_CLIENT_FULL or FAIR_QUEUE_FULL.
+ */
+int fair_queue_push(FairQueue_t* queue, Request_t* request);
+
+/**
+ * @brief Takes the oldest request of the next client in turn, high priority lane first.
+ *
+ * @param queue The fair queue.
+ * @param requests Where the request and the requests collapsed with it are moved, CLIENT_QUEUE_SIZE requests.
+ * @return The number of requests moved, 0 if no request is queued.
+ */
+int fair_queue_pop(FairQueue_t* queue, Request_t* requests);
+
+/**
+ * @brief Closes all the queued requests without replying to them.
+ *
+ * @param queue The fair queue.
+ */
+void fair_queue_clear(FairQueue_t* queue);
+
+#endif
@@ -11,6 +11,7 @@
  *
  * Description:
  * Handles the game logic for the server. Updates aliens, receives and process client messages and publishes updates to displays
+ * The server hosts several independent arenas, updated by a pool of worker threads
  */
 
 #include "game-logic.h"
@@ -18,47 +19,52 @@
 #include <math.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <time.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <zmq.h>
 #include "scores.pb-c.h"
+#include "envelope.h"
+#include "fair-queue.h"
+#include "stage-metrics.h"
+#include "server-metrics.h"
+#include "trace.h"
 #include "math.h"
 
 // ZeroMQ sockets
-void* resp;  // For REQ/REP with astronauts
+void* ctx;  // Used to create the sockets of the internal threads
+void* resp;  // ROUTER socket for the REQ sockets of the astronauts
 void* pub;  // For PUB/SUB with display
 void* score_pub;  // For PUB/SUB with scores
+void* publish_pull;  // Receives the updates of the other threads in the publisher thread
+void* lobby;  // For REQ/REP with astronauts looking for an arena, NULL if disabled
+void* snapshot;  // For REQ/REP with displays asking for the current state of an arena, NULL if disabled
+void* metrics;  // For REQ/REP with monitoring asking for the metrics of the server, NULL if disabled
 
-// Game state representation
-Player_t players[MAX_PLAYERS];
-Alien_t aliens[MAX_ALIENS];
+// Arenas hosted by the server
+// Space for MAX_ARENAS is allocated, the lobby adds arenas by incrementing arena_count
+// after the new arena is initialized, so the other threads never see a partial arena
+Arena_t* arenas = NULL;
+atomic_int arena_count = DEFAULT_ARENAS;
 
-// Indicates whether the game is over or not
-int game_over_server = 0;
-
-// Flag to request the publisher thread to send new game data
-int request_publish = 0;
-// Condition variable to signal the publisher thread
-pthread_cond_t publish_cond;
-
-// Stores the timestamp of the last game state update
-double last_update_time = 0;
-
-// Stores the timestamp of the last alien kill
-double last_kill_time = 0;
+// Number of worker threads, 0 for one per online core
+int worker_count = 0;
 
-ScoreUpdate score_update = SCORE_UPDATE__INIT;
-
-// Mutex for internal game data
-pthread_mutex_t server_lock; // Mutex used to synchronize access to the game state structures
+// Indicates whether the server is over
+int game_over_server = 0;
 
+// Start time of the server in microseconds, sent in the envelopes (see envelope.h)
+unsigned long server_epoch = 0;
 
-// String to store the game state
-// It is parsed in the same way as the one passed in ZeroMQ publisher
-// Main aplication uses get_server_game_state to get the game state
-char game_state_string[BUFFER_SIZE];
+// Worker threads, each with its own deque of jobs
+Worker_t* workers = NULL;
+int n_workers = 0;
 
-// Mutex for game state string
-pthread_mutex_t game_state_lock; // Mutex used to synchronize access to the game state string
+// Number of jobs in all deques, idle workers sleep while it is 0
+atomic_int pending_jobs = 0;
+int jobs_stopping = 0; // Set to make the workers exit
+pthread_mutex_t job_lock; // Mutex used to put idle workers to sleep
+pthread_cond_t job_cond; // Signals the idle workers that a job was queued
 
 
 /**
@@ -91,20 +97,39 @@ int has_duration_passed(double start_time, double duration) {
     return (current_time - start_time) >= duration ? 1 : 0;
 }
 
+/**
+ * @brief Returns the game ticks left until the specified duration has passed since the given time.
+ *
+ * Rounded up, so that a client waiting for that many ticks of GAME_UPDATE_INTERVAL
+ * does not send a command that is still rejected.
+ *
+ * @param start_time The start time in seconds since the epoch.
+ * @param duration The duration in seconds.
+ * @return The ticks left, 0 if the duration has passed.
+ */
+int remaining_ticks(double start_time, double duration) {
+    double remaining = start_time + duration - get_time_in_seconds();
+    if (remaining <= 0) {
+        return 0;
+    }
+    return (int)ceil(remaining / GAME_UPDATE_INTERVAL);
+}
+
 /**
  * @brief Finds a player by their ID.
  *
  * This function searches through the list of players and returns a pointer
  * to the player with the specified ID.
  *
+ * @param arena The arena of the player.
  * @param id The ID of the player to find.
  * @return A pointer to the player with the specified ID, or NULL if no player
  *         with the given ID is found.
  */
-Player_t* find_by_id(const char id) {
+Player_t* find_by_id(Arena_t* arena, const char id) {
     for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].id == id) {
-            return &players[i];
+        if (arena->players[i].id == id) {
+            return &arena->players[i];
         } 
     }
     return NULL;
@@ -118,13 +143,14 @@ Player_t* find_by_id(const char id) {
  * session token with the provided session token. If a match is found, a pointer
  * to the corresponding player is returned.
  *
+ * @param arena The arena of the player.
  * @param session_token The session token to search for.
  * @return A pointer to the player with the matching session token, or NULL if no match is found.
  */
-Player_t* find_by_session_token(const char* session_token) {
+Player_t* find_by_session_token(Arena_t* arena, const char* session_token) {
     for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (strcmp(players[i].session_token, session_token) == 0) {
-            return &players[i];
+        if (strcmp(arena->players[i].session_token, session_token) == 0) {
+            return &arena->players[i];
         }
     }
     return NULL;
@@ -137,13 +163,14 @@ Player_t* find_by_session_token(const char* session_token) {
  * This function searches through the list of players and returns a pointer
  * to the player whose zone matches the specified zone.
  *
+ * @param arena The arena of the player.
  * @param zone The zone to search for.
  * @return A pointer to the player in the specified zone, or NULL if no player is found.
  */
-Player_t* find_by_zone(const char zone) {
+Player_t* find_by_zone(Arena_t* arena, const char zone) {
     for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].zone == zone) {
-            return &players[i];
+        if (arena->players[i].zone == zone) {
+            return &arena->players[i];
         }
     }
     return NULL;
@@ -155,22 +182,47 @@ Player_t* find_by_zone(const char zone) {
  * This function generates a random session token consisting of 
  * hexadecimal characters (0-9, a-f). The generated token will be 
  * 32 characters long, followed by a null terminator.
+ * The first SESSION_TOKEN_ARENA_LEN characters encode the arena of the player,
+ * so that the token alone identifies the arena (see session_token_arena).
  *
  * @param token A pointer to a character array where the generated 
  * token will be stored. The array must be at least 33 characters long.
+ * @param arena The arena of the player.
  *
  * @note This function is not thread-safe. Ensure proper synchronization when calling it.
  */
-void generate_session_token(char* token) {
+void generate_session_token(char* token, int arena) {
     const char charset[] = "abcdef0123456789";
     size_t length = 33;
-    for (size_t i = 0; i < length - 1; i++) {
+    snprintf(token, SESSION_TOKEN_ARENA_LEN + 1, "%0*x", SESSION_TOKEN_ARENA_LEN, (unsigned)arena);
+    for (size_t i = SESSION_TOKEN_ARENA_LEN; i < length - 1; i++) {
         size_t index = rand() % (sizeof(charset) - 1);
         token[i] = charset[index];
     }
     token[length - 1] = '\0';
 }
 
+/**
+ * @brief Returns the arena encoded in a session token.
+ *
+ * @param token The session token, as generated by generate_session_token.
+ * @return The arena ID, or -1 if the token does not start with an arena.
+ */
+int session_token_arena(const char* token) {
+    int arena = 0;
+    for (int i = 0; i < SESSION_TOKEN_ARENA_LEN; i++) {
+        char c = token[i];
+        if (c >= '0' && c <= '9') {
+            arena = arena * 16 + (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            arena = arena * 16 + (c - 'a' + 10);
+        } else {
+            return -1;
+        }
+    }
+    return arena;
+}
+
 
 /**
  * @brief Assigns a unique player ID from a predefined set of IDs.
@@ -180,16 +232,17 @@ void generate_session_token(char* token) {
  * If no IDs are available, it returns '\0'.
  * Otherwise, it selects a random available ID and returns it.
  *
+ * @param arena The arena the player joins.
  * @return A unique player ID if available, otherwise '\0'.
  */
-char assign_player_id() {
+char assign_player_id(Arena_t* arena) {
     char ids[] = {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H'};
     int available_ids[MAX_PLAYERS];
     int count = 0;
 
     // Collect all available IDs
     for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (find_by_id(ids[i]) == NULL) {
+        if (find_by_id(arena, ids[i]) == NULL) {
             available_ids[count++] = ids[i];
         }
     }
@@ -213,14 +266,15 @@ char assign_player_id() {
  * one that is not currently occupied, as determined by the `find_by_zone`
  * function.
  *
+ * @param arena The arena the player joins.
  * @return An integer representing the randomly selected unoccupied zone.
  */
-int get_random_zone() {
+int get_random_zone(Arena_t* arena) {
     int zones[] = {ZONE_A, ZONE_B, ZONE_C, ZONE_D, ZONE_E, ZONE_F, ZONE_G, ZONE_H};
     int random_zone;
     while (true) {
         random_zone = zones[rand() % 8]; // There are 8 zones
-        if (find_by_zone(random_zone) == NULL) {
+        if (find_by_zone(arena, random_zone) == NULL) {
             return random_zone;
         }
     }
@@ -240,12 +294,20 @@ int get_random_zone() {
 void clear_player(Player_t *player) {
     if (player == NULL) return;
 
+    if (player->id != '\0') {
+        metrics_sessions(-1);
+    }
     player->id = '\0';
     player->score = 0;
     player->last_fire_time = 0.0;
     player->last_stun_time = 0.0;
+    player->last_seen = 0.0;
     player->session_token[0] = '\0';
     player->laser.active = 0; 
+    memset(player->buckets, 0, sizeof(player->buckets));
+    player->requests = 0;
+    player->throttled = 0;
+    player->last_command = 0;
 }
 
 
@@ -255,11 +317,12 @@ void clear_player(Player_t *player) {
  * This function iterates through the array of aliens and checks if any of them are still active.
  * If at least one alien is active, the function returns 0. If all aliens are inactive, it returns 1.
  *
+ * @param arena The arena to check.
  * @return int 1 if all aliens are inactive, 0 if at least one alien is still active.
  */
-int all_aliens_destroyed() {
+int all_aliens_destroyed(Arena_t* arena) {
     for (int i = 0; i < MAX_ALIENS; i++) {
-        if (aliens[i].active) {
+        if (arena->aliens[i].active) {
             return 0; // There is at least one alien still active
         }
     }
@@ -267,30 +330,208 @@ int all_aliens_destroyed() {
 }
 
 /**
- * @brief Initializes the game state by setting up players and aliens.
+ * @brief Initializes the game state of an arena by setting up players and aliens.
+ *
+ * This function initializes the arena lock, clears the player data and
+ * places aliens at random positions within the inner grid.
+ * The random number generator is seeded once by server_logic, so that
+ * each arena gets different positions for its aliens.
  *
- * This function initializes the game state by clearing player data and
- * placing aliens at random positions within the inner grid. It uses the
- * current time as the seed for the random number generator to ensure
- * different positions for aliens in each game session.
+ * @param arena The arena to initialize.
+ * @param id The index of the arena in the server.
+ * @return 0 on success, -1 if the arena lock could not be initialized.
  */
-void initialize_game_state() {
-    // Initialize players
-    srand(time(NULL));
+int initialize_arena(Arena_t* arena, int id) {
+    memset(arena, 0, sizeof(*arena));
+    arena->id = id;
+    if (pthread_mutex_init(&arena->lock, NULL) != 0) {
+        return -1;
+    }
 
+    // Initialize players
     for (int i = 0; i < MAX_PLAYERS; i++) {
-        clear_player(&players[i]);
+        clear_player(&arena->players[i]);
     }
 
     // Initialize aliens at random positions within the inner grid
-    srand(time(NULL));
     for (int i = 0; i < MAX_ALIENS; i++) {
-        aliens[i].x = 5 + rand() % (GRID_WIDTH - 10);
-        aliens[i].y = 5 + rand() % (GRID_HEIGHT - 10);
-        aliens[i].active = 1;
+        arena->aliens[i].x = 5 + rand() % (GRID_WIDTH - 10);
+        arena->aliens[i].y = 5 + rand() % (GRID_HEIGHT - 10);
+        arena->aliens[i].active = 1;
     }
-    last_kill_time = get_time_in_seconds();
+    metrics_aliens(MAX_ALIENS);
+    arena->last_kill_time = get_time_in_seconds();
+    arena->last_alien_move_time = arena->last_kill_time;
 
+    return 0;
+}
+
+/**
+ * @brief Takes the lock of an arena, recording the time waited for it.
+ *
+ * The lock is tried first, so that the acquisitions that waited for another thread are counted.
+ *
+ * @param arena The arena.
+ */
+void lock_arena(Arena_t* arena) {
+    TRACE_BEGIN("lock_wait");
+    unsigned long long start = stage_time();
+    int contended = pthread_mutex_trylock(&arena->lock) != 0;
+    if (contended) {
+        pthread_mutex_lock(&arena->lock);
+    }
+    arena->lock_time = stage_time();
+    TRACE_END("lock_wait");
+    TRACE_BEGIN("lock_hold");
+    stage_record(STAGE_LOCK_WAIT, arena->lock_time - start);
+    metrics_lock(contended, arena->lock_time - start);
+}
+
+/**
+ * @brief Releases the lock of an arena, recording the time it was held.
+ *
+ * @param arena The arena, locked with lock_arena.
+ */
+void unlock_arena(Arena_t* arena) {
+    unsigned long long held = stage_time() - arena->lock_time;
+    TRACE_END("lock_hold");
+    pthread_mutex_unlock(&arena->lock);
+    stage_record(STAGE_LOCK_HOLD, held);
+}
+
+/**
+ * @brief Finds an arena by its ID.
+ *
+ * @param id The ID of the arena.
+ * @return A pointer to the arena, or NULL if there is no arena with that ID.
+ */
+Arena_t* find_arena(int id) {
+    if (id < 0 || id >= arena_count) {
+        return NULL;
+    }
+    return &arenas[id];
+}
+
+/**
+ * @brief Finds the first running arena with space for another player.
+ *
+ * The arena is not locked after it is returned. The listener and the lobby threads both join
+ * players, so the arena may be full by the time the connect message is processed. Callers
+ * retry with the next arena when the connect is answered ERR_FULL.
+ *
+ * @return A pointer to the arena, or NULL if all arenas are full or over.
+ */
+Arena_t* find_free_arena() {
+    for (int i = 0; i < arena_count; i++) {
+        Arena_t* arena = &arenas[i];
+        lock_arena(arena);
+        int has_space = !arena->game_over && find_by_id(arena, '\0') != NULL;
+        unlock_arena(arena);
+        if (has_space) {
+            return arena;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Counts the players connected to an arena.
+ *
+ * @param arena The arena to check.
+ * @return The number of players in the arena.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
+ */
+int count_players(Arena_t* arena) {
+    int count = 0;
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        if (arena->players[i].id != '\0') {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Creates a new arena.
+ *
+ * Only the lobby thread creates arenas, so arena_count is not changed by other threads.
+ * The arena is created under job_lock, the lock the shutdown of the server is decided under,
+ * so no arena is created once the server is over.
+ *
+ * @param home_worker The worker whose deque receives the jobs of the arena.
+ * @return A pointer to the new arena, or NULL if there are already MAX_ARENAS arenas or the server is over.
+ */
+Arena_t* create_arena(int home_worker) {
+    pthread_mutex_lock(&job_lock);
+    int id = arena_count;
+    if (game_over_server || id >= MAX_ARENAS) {
+        pthread_mutex_unlock(&job_lock);
+        return NULL;
+    }
+    Arena_t* arena = &arenas[id];
+    if (initialize_arena(arena, id) != 0) {
+        pthread_mutex_unlock(&job_lock);
+        return NULL;
+    }
+    arena->home_worker = home_worker;
+
+    // Visible to the other threads once it is fully initialized
+    arena_count = id + 1;
+    pthread_mutex_unlock(&job_lock);
+    return arena;
+}
+
+/**
+ * @brief Chooses the arena of a player connecting through the lobby.
+ *
+ * Players are packed into the running arena with the most players that still has space,
+ * so that matches fill up instead of spreading a few players over many arenas.
+ * Between arenas with the same players, the one hosted by the least loaded worker is chosen.
+ * When all arenas are full a new one is created on the least loaded worker.
+ * The load of a worker is the players of its running arenas, plus one per arena because
+ * arenas cost about the same per tick whatever their players.
+ *
+ * @return A pointer to the arena, or NULL if all arenas are full and no more can be created.
+ */
+Arena_t* find_lobby_arena() {
+    int load[n_workers];
+    memset(load, 0, sizeof(load));
+    int players[MAX_ARENAS];
+    int count = arena_count;
+    for (int i = 0; i < count; i++) {
+        Arena_t* arena = &arenas[i];
+        lock_arena(arena);
+        players[i] = arena->game_over ? -1 : count_players(arena);
+        unlock_arena(arena);
+        if (players[i] >= 0) {
+            load[arena->home_worker] += 1 + players[i];
+        }
+    }
+
+    Arena_t* best = NULL;
+    int best_players = -1;
+    for (int i = 0; i < count; i++) {
+        if (players[i] < 0 || players[i] >= MAX_PLAYERS) {
+            continue;
+        }
+        if (players[i] > best_players ||
+            (players[i] == best_players && load[arenas[i].home_worker] < load[best->home_worker])) {
+            best = &arenas[i];
+            best_players = players[i];
+        }
+    }
+    if (best != NULL) {
+        return best;
+    }
+
+    int home_worker = 0;
+    for (int i = 1; i < n_workers; i++) {
+        if (load[i] < load[home_worker]) {
+            home_worker = i;
+        }
+    }
+    return create_arena(home_worker);
 }
 
 /**
@@ -352,6 +593,32 @@ int is_valid_move(Player_t* player, const char direction) {
     return 0;
 }
 
+/**
+ * @brief Finds the zone of a player from its position.
+ *
+ * The zones are disjoint rows and columns of the grid, so the position of a player is only
+ * in its own zone. Used by clients, which do not receive the zones, to predict their moves.
+ *
+ * @param x The x-coordinate of the player.
+ * @param y The y-coordinate of the player.
+ * @return The zone, or 0 if the position is not in any zone.
+ */
+int zone_from_position(int x, int y) {
+    if (y >= BORDER_OFFSET && y <= GRID_HEIGHT - BORDER_OFFSET - 1) {
+        if (x == 0) return ZONE_A;
+        if (x == 1) return ZONE_H;
+        if (x == GRID_WIDTH - 2) return ZONE_D;
+        if (x == GRID_WIDTH - 1) return ZONE_F;
+    }
+    if (x >= BORDER_OFFSET && x <= GRID_WIDTH - BORDER_OFFSET - 1) {
+        if (y == 0) return ZONE_E;
+        if (y == 1) return ZONE_G;
+        if (y == GRID_HEIGHT - 2) return ZONE_B;
+        if (y == GRID_HEIGHT - 1) return ZONE_C;
+    }
+    return 0;
+}
+
 /**
  * @brief Initializes the player's position based on their starting zone.
  *
@@ -409,45 +676,243 @@ void initialize_player_position(Player_t* player) {
 
 
 /**
- * @brief Processes a message received from a client and generates an appropriate response.
+ * @brief Writes the reply to a command of a player: the result, the score, the timers of the player
+ * and the sequence number of the last game state published for the arena.
+ *
+ * The timers are the ticks left of the laser cooldown and of the stun, so that the client
+ * does not send the zaps and moves that would be rejected until they expire.
+ * The game states published with a higher sequence number include the effect of the command,
+ * so that a client predicting its moves knows when the game state caught up with them.
+ *
+ * @param response Where the reply is written, BUFFER_SIZE bytes.
+ * @param code The result of the command, RESP_OK or an error code.
+ * @param arena The arena of the player.
+ * @param player The player.
+ * @return The length of the reply.
+ */
+int format_player_reply(char* response, int code, Arena_t* arena, Player_t* player) {
+    return snprintf(response, BUFFER_SIZE, "%d %d %d %d %lu", code, player->score,
+                    remaining_ticks(player->last_fire_time, LASER_COOLDOWN),
+                    remaining_ticks(player->last_stun_time, STUN_DURATION), arena->state_seq);
+}
+
+/**
+ * @brief Takes tokens from a token bucket of a player, for a command of the player.
+ *
+ * The bucket is refilled first with the tokens earned since the last refill, at the rate
+ * of its class and up to its burst. A command without enough tokens is throttled, it takes
+ * none and is counted in the player and the arena.
+ *
+ * @param arena The arena of the player.
+ * @param player The player.
+ * @param rate_class The class of the command, RATE_CLASS_MOVE, RATE_CLASS_ZAP or RATE_CLASS_OTHER.
+ * @param cost The tokens of the command.
+ * @return 1 if the command can be applied, 0 if it is throttled.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
+ */
+int take_tokens(Arena_t* arena, Player_t* player, int rate_class, double cost) {
+    static const double rates[RATE_CLASSES] = { RATE_LIMIT_MOVE, RATE_LIMIT_ZAP, RATE_LIMIT_OTHER };
+    static const double bursts[RATE_CLASSES] = { RATE_BURST_MOVE, RATE_BURST_ZAP, RATE_BURST_OTHER };
+
+    TokenBucket_t* bucket = &player->buckets[rate_class];
+    double current_time = get_time_in_seconds();
+    bucket->tokens += (current_time - bucket->last_refill) * rates[rate_class];
+    if (bucket->tokens > bursts[rate_class]) {
+        bucket->tokens = bursts[rate_class];
+    }
+    bucket->last_refill = current_time;
+
+    if (bucket->tokens < cost) {
+        player->throttled++;
+        arena->throttled++;
+        return 0;
+    }
+    bucket->tokens -= cost;
+    return 1;
+}
+
+/**
+ * @brief Moves a player, the arguments of a MOVE command.
+ *
+ * The steps that would leave the zone of the player are dropped, the move fails only if no step was valid.
+ * Each step requested takes a token of the move bucket of the player, even if it is dropped.
+ *
+ * @param arena The arena of the player.
+ * @param player The player, already authenticated.
+ * @param args The arguments of the command, "<direction> [steps]".
+ * @return RESP_OK if the player moved, or the error code.
+ */
+int move_player(Arena_t* arena, Player_t* player, const char* args) {
+    char direction;
+    int steps = 1;
+    int num_args = sscanf(args, " %c %d", &direction, &steps);
+    if (num_args < 1 || steps < 1 || steps > MAX_MOVE_STEPS) {
+        //ERROR Invalid MOVE command format
+        return ERR_INVALID_MOVE;
+    }
+
+    if (!take_tokens(arena, player, RATE_CLASS_MOVE, steps)) {
+        //ERROR Too many moves
+        return ERR_THROTTLED;
+    }
+
+    if (!has_duration_passed(player->last_stun_time, STUN_DURATION)) {
+        //ERROR Player stunned
+        return ERR_STUNNED;
+    }
+
+    // Validate direction
+    if (direction != MOVE_UP && direction != MOVE_DOWN && direction != MOVE_LEFT && direction != MOVE_RIGHT) {
+        //ERROR Invalid direction
+        return ERR_INVALID_DIR;
+    }
+
+    int moved = 0;
+    while (moved < steps && is_valid_move(player, direction)) {
+        if (direction ==MOVE_LEFT) player->x--;
+        else if (direction == MOVE_RIGHT) player->x++;
+        else if (direction == MOVE_UP) player->y--;
+        else if (direction == MOVE_DOWN) player->y++;
+        moved++;
+    }
+    if (moved == 0) {
+        //ERROR Invalid move direction
+        return ERR_INVALID_MOVE;
+    }
+    return RESP_OK;
+}
+
+/**
+ * @brief Fires the laser of a player, a ZAP command.
+ *
+ * The game state is updated right away, so that the score of the reply includes the aliens hit.
+ *
+ * @param arena The arena of the player.
+ * @param player The player, already authenticated.
+ * @return RESP_OK if the laser was fired, or the error code.
+ */
+int zap_player(Arena_t* arena, Player_t* player) {
+    if (!take_tokens(arena, player, RATE_CLASS_ZAP, 1)) {
+        //ERROR Too many zaps
+        return ERR_THROTTLED;
+    }
+
+    double current_time = get_time_in_seconds();
+    if (!has_duration_passed(player->last_fire_time, LASER_COOLDOWN)) {
+        //ERROR Laser cooldown
+        return ERR_LASER_COOLDOWN;
+    }
+    if (!has_duration_passed(player->last_stun_time, STUN_DURATION)) {
+        //ERROR Player stunned
+        return ERR_STUNNED;
+    }
+
+    player->last_fire_time = current_time;
+
+    // Determine laser direction based on player's id
+    if (player->zone == ZONE_A || player->zone == ZONE_H) {
+        player->laser.x = player->x + 1; // Start right of player
+        player->laser.y = player->y;
+        //printf("Player %c fired a laser from %d, %d\n", player_id, player->laser.x, player->laser.y);
+    } else if (player->zone == ZONE_D || player->zone == ZONE_F) {
+        player->laser.x = player->x - 1;  // Start left of player
+        player->laser.y = player->y;
+    } 
+    else if (player->zone == ZONE_B || player->zone == ZONE_C) {
+        player->laser.y = player->y - 1;
+        player->laser.x = player->x;
+    } else if (player->zone == ZONE_E || player->zone == ZONE_G) {
+        player->laser.y = player->y + 1;
+        player->laser.x = player->x;
+    }
+    
+    // Initialize laser position
+    player->laser.active = 1;
+    player->laser.creation_time = current_time;
+    
+    // Note: we update the game state here but in this tick it will also update later
+    // This is done so the client as an updated score as the response
+    update_game_state(arena);
+    return RESP_OK;
+}
+
+/**
+ * @brief Records the ID of a command applied to a player, published in the next game states.
+ *
+ * @param player The player.
+ * @param command_id The ID of the tag of the command, 0 if it had none.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
+ */
+void record_command(Player_t* player, unsigned long command_id) {
+    if (command_id > player->last_command) {
+        player->last_command = command_id;
+    }
+}
+
+/**
+ * @brief Processes a message received from a client for an arena and generates an appropriate response.
  *
  * This function handles various commands sent by clients, including connecting to the game,
  * moving a player, firing a laser, and disconnecting from the game. It validates the message,
  * checks the session token, and performs the requested action if all validations pass.
+ * The message was already routed to the arena by process_client_message.
  *
+ * @param arena The arena the message is for.
  * @param message The message received from the client.
  * @param response The response to be sent back to the client.
  *
  * The message format varies based on the command:
- * - CONNECT: "C"
- * - MOVE: "M <player_id> <session_token> <direction>"
- * - ZAP: "Z <player_id> <session_token>"
- * - DISCONNECT: "D <player_id> <session_token>"
+ * - CONNECT: "C [arena]"
+ * - MOVE: "M <arena> <player_id> <session_token> <direction> [steps]", clients send repeated keys as one move of
+ *   up to MAX_MOVE_STEPS steps, which stops at the edge of the zone
+ * - ZAP: "Z <arena> <player_id> <session_token>"
+ * - DISCONNECT: "D <arena> <player_id> <session_token>"
+ * - KEEPALIVE: "K <arena> <player_id> <session_token>", sent by idle clients so that their session is kept
+ * - RESUME: "R <arena> <player_id> <session_token>", sent by reconnecting clients to keep their slot, score and position
+ * - BATCH: "B <arena> <player_id> <session_token> <command>[;<command>...]", up to MAX_BATCH_COMMANDS moves ("M <direction> [steps]")
+ *   and zaps ("Z") authenticated once and applied in order, the later commands are applied even if an earlier one failed
+ *
+ * The commands of a player may end with a tag, " #<command_id>" (see COMMAND_TAG), sent by clients measuring
+ * their latency. The largest ID of a move, zap or batch applied (RESP_OK, or for a batch at least one command
+ * with RESP_OK) is published in the line of the player in the game states.
+ *
+ * Every valid command updates the last time the player was seen, see reap_stale_sessions.
  *
  * The response format also varies based on the result of the command:
- * - Success: "<response_code> [client_score]"
+ * - Connect: "<response_code> <player_id> <session_token> <arena>"
+ * - Resume: the connect reply followed by "<client_score> <laser_cooldown_ticks> <stun_ticks>"
+ * - Move, zap and keepalive: "<response_code> <client_score> <laser_cooldown_ticks> <stun_ticks> <state_seq>",
+ *   state_seq is the sequence number of the last game state published before the command
+ * - Batch: "<response_code> <client_score> <laser_cooldown_ticks> <stun_ticks> <state_seq> <command_code>...",
+ *   with the code of each command of the batch
+ * - Disconnect: "<response_code>"
  * - Error: "<error_code>"
  *
  * Error codes come from config.h constants
  *
- * @note This function is not thread-safe.
+ * @note This function is not thread-safe and should be called with the arena lock held.
  * 
  * @return int Returns 0 if game state was not updated, 1 if it was updated.
  */
-int process_client_message(char* message, char* response) {
+int process_arena_message(Arena_t* arena, char* message, char* response) {
+    Player_t* players = arena->players;
     if (message[0] == CMD_CONNECT) {
-        char new_id = assign_player_id();
+        char new_id = assign_player_id(arena);
         if (new_id != '\0') {
             // Find available player id and initialize a new player
             for (int i = 0; i < MAX_PLAYERS; i++) {
                 if (players[i].id == '\0') {
                     clear_player(&players[i]); // Probably redundant
                     players[i].id = new_id;
-                    generate_session_token(players[i].session_token);
-                    players[i].zone = get_random_zone();
+                    generate_session_token(players[i].session_token, arena->id);
+                    players[i].zone = get_random_zone(arena);
                     initialize_player_position(&players[i]);
+                    players[i].last_seen = get_time_in_seconds();
+                    metrics_sessions(1);
 
-                    sprintf(response, "%d %c %s", RESP_OK, new_id, players[i].session_token);
+                    sprintf(response, "%d %c %s %d", RESP_OK, new_id, players[i].session_token, arena->id);
                     return 0;
                 }
             }
@@ -457,11 +922,20 @@ int process_client_message(char* message, char* response) {
         return 0;
     }
 
+    // Remove the tag of the command, the arguments end before it
+    unsigned long command_id = 0;
+    char* tag = strrchr(message, COMMAND_TAG);
+    if (tag != NULL) {
+        command_id = strtoul(tag + 1, NULL, 10);
+        *tag = '\0';
+    }
+
     // Validate session token and player ID
     char cmd;
     char player_id;
     char session_token[33];
-    int num_parsed = sscanf(message, "%c %c %32s", &cmd, &player_id, session_token);
+    int args_offset = 0;
+    int num_parsed = sscanf(message, "%c %*d %c %32s%n", &cmd, &player_id, session_token, &args_offset);
 
     if (num_parsed < 3) {
         //ERROR Missing session token
@@ -469,8 +943,8 @@ int process_client_message(char* message, char* response) {
         return 0;
     }
 
-    // Validate the command string (allowed commands: CONNECT, MOVE, ZAP, DISCONNECT)
-    if (cmd != CMD_MOVE && cmd != MSG_ZAP && cmd != CMD_DISCONNECT) {
+    // Validate the command string (allowed commands: CONNECT, MOVE, ZAP, DISCONNECT, KEEPALIVE, RESUME, BATCH)
+    if (cmd != CMD_MOVE && cmd != MSG_ZAP && cmd != CMD_DISCONNECT && cmd != CMD_KEEPALIVE && cmd != CMD_RESUME && cmd != CMD_BATCH) {
         //ERROR Unknown command
         sprintf(response, "%d", ERR_UNKNOWN_CMD);
         return 0;
@@ -500,105 +974,181 @@ int process_client_message(char* message, char* response) {
     }
 
     // Find the player based on the provided player ID and session token
-    Player_t* player = find_by_id(player_id);
+    Player_t* player = find_by_id(arena, player_id);
     if (!player) {
         //ERROR Invalid player ID
         sprintf(response, "%d", ERR_INVALID_PLAYERID);
         return 0;
     } 
-    if (strcmp(player->session_token, session_token) != 0) {
+    if (strcmp(player->session_token, session_token) != 0 || session_token_arena(session_token) != arena->id) {
         //ERROR Invalid session token
         sprintf(response, "%d", ERR_INVALID_TOKEN);
         return 0;
     }
 
+    // The session is alive
+    player->last_seen = get_time_in_seconds();
+    player->requests++;
 
     // Command handling with checks
+    const char* args = message + args_offset;
     if (cmd == CMD_MOVE) {
-        char direction;
-        if (sscanf(message, "%*c %*c %*s %c", &direction) != 1) {
-            //ERROR Invalid MOVE command format
-            sprintf(response, "%d %d", ERR_INVALID_MOVE, player->score);
-            return 0;
+        int code = move_player(arena, player, args);
+        if (code == RESP_OK) {
+            record_command(player, command_id);
         }
-
-        if (!has_duration_passed(player->last_stun_time, STUN_DURATION)) {
-            //ERROR Player stunned
-            sprintf(response, "%d %d", ERR_STUNNED, player->score);
-            return 0;
-        }
-
-        // Validate direction
-        if (direction != MOVE_UP && direction != MOVE_DOWN && direction != MOVE_LEFT && direction != MOVE_RIGHT) {
-            //ERROR Invalid direction
-            sprintf(response, "%d %d", ERR_INVALID_DIR, player->score);
-            return 0;
+        format_player_reply(response, code, arena, player);
+        return 0;
+    } else if (cmd == MSG_ZAP)  {
+        int code = zap_player(arena, player);
+        if (code == RESP_OK) {
+            record_command(player, command_id);
         }
-
-        if (is_valid_move(player, direction)) {
-            if (direction ==MOVE_LEFT) player->x--;
-            else if (direction == MOVE_RIGHT) player->x++;
-            else if (direction == MOVE_UP) player->y--;
-            else if (direction == MOVE_DOWN) player->y++;
-            snprintf(response, BUFFER_SIZE, "%d %d", RESP_OK, player->score);
-        } else {
-            //ERROR Invalid move direction
-            sprintf(response, "%d %d", ERR_INVALID_MOVE, player->score);
-            return 0;
+        // Reply to client with score
+        format_player_reply(response, code, arena, player);
+        return code == RESP_OK;
+    } else if (cmd == CMD_BATCH) {
+        // A batch with no commands or too many is rejected before any is applied
+        // The commands are counted like they are applied below, empty ones are skipped
+        int num_commands = 0;
+        for (const char* c = args; c != NULL; c = strchr(c, ';')) {
+            while (*c == ' ' || *c == ';') c++;
+            if (*c == '\0') break;
+            num_commands++;
         }
-    } else if (cmd == MSG_ZAP)  {
-        double current_time = get_time_in_seconds();
-        if (!has_duration_passed(player->last_fire_time, LASER_COOLDOWN)) {
-            //ERROR Laser cooldown
-            sprintf(response, "%d %d", ERR_LASER_COOLDOWN, player->score);
+        if (num_commands == 0) {
+            //ERROR Nothing to apply
+            format_player_reply(response, ERR_UNKNOWN_CMD, arena, player);
             return 0;
         }
-        if (!has_duration_passed(player->last_stun_time, STUN_DURATION)) {
-            //ERROR Player stunned
-            sprintf(response, "%d %d", ERR_STUNNED, player->score);
+        if (num_commands > MAX_BATCH_COMMANDS) {
+            //ERROR Too many commands in the batch
+            format_player_reply(response, ERR_TOLONG, arena, player);
             return 0;
         }
 
-        player->last_fire_time = current_time;
-
-        // Determine laser direction based on player's id
-        if (player->zone == ZONE_A || player->zone == ZONE_H) {
-            player->laser.x = player->x + 1; // Start right of player
-            player->laser.y = player->y;
-            //printf("Player %c fired a laser from %d, %d\n", player_id, player->laser.x, player->laser.y);
-        } else if (player->zone == ZONE_D || player->zone == ZONE_F) {
-            player->laser.x = player->x - 1;  // Start left of player
-            player->laser.y = player->y;
-        } 
-        else if (player->zone == ZONE_B || player->zone == ZONE_C) {
-            player->laser.y = player->y - 1;
-            player->laser.x = player->x;
-        } else if (player->zone == ZONE_E || player->zone == ZONE_G) {
-            player->laser.y = player->y + 1;
-            player->laser.x = player->x;
+        // Apply the commands in order, the codes are written once the final score is known
+        int codes[MAX_BATCH_COMMANDS];
+        int updated = 0;
+        num_commands = 0;
+        while (*args != '\0') {
+            while (*args == ' ' || *args == ';') args++;
+            if (*args == '\0') break;
+            if (*args == CMD_MOVE) {
+                codes[num_commands] = move_player(arena, player, args + 1);
+            } else if (*args == MSG_ZAP) {
+                codes[num_commands] = zap_player(arena, player);
+                updated |= codes[num_commands] == RESP_OK;
+            } else {
+                codes[num_commands] = ERR_UNKNOWN_CMD;
+            }
+            num_commands++;
+            args = strchr(args, ';');
+            if (args == NULL) break;
         }
-        
-        // Initialize laser position
-        player->laser.active = 1;
-        player->laser.creation_time = current_time;
-        
-        // Reply to client with score
-        // Note: we update the game state here but in this tick it will also update later
-        // This is done so the client as an updated score as the response
-        update_game_state();
-        snprintf(response, BUFFER_SIZE, "%d %d", RESP_OK, player->score);
-        return 1;
+        int len = format_player_reply(response, RESP_OK, arena, player);
+        for (int i = 0; i < num_commands; i++) {
+            len += sprintf(response + len, " %d", codes[i]);
+            if (codes[i] == RESP_OK) {
+                record_command(player, command_id);
+            }
+        }
+        return updated;
     } else if (cmd == CMD_DISCONNECT)  {
         clear_player(player);
-        sprintf(response, "%c", RESP_OK);
+        sprintf(response, "%d", RESP_OK);
+    } else if (!take_tokens(arena, player, RATE_CLASS_OTHER, 1)) {
+        //ERROR Too many keepalives or resumes
+        format_player_reply(response, ERR_THROTTLED, arena, player);
+    } else if (cmd == CMD_KEEPALIVE) {
+        format_player_reply(response, RESP_OK, arena, player);
+    } else if (cmd == CMD_RESUME) {
+        // The slot is kept until the session is reaped, so the player continues where it was
+        sprintf(response, "%d %c %s %d %d %d %d", RESP_OK, player->id, player->session_token, arena->id, player->score,
+                remaining_ticks(player->last_fire_time, LASER_COOLDOWN), remaining_ticks(player->last_stun_time, STUN_DURATION));
     } else {
         //ERROR Unknown command
-        sprintf(response, "%c", ERR_UNKNOWN_CMD);
+        sprintf(response, "%d", ERR_UNKNOWN_CMD);
         return 0;
     }
     return 0;
 }
 
+/**
+ * @brief Routes a message from a client to its arena, processes it and generates a response.
+ *
+ * Connect messages may name the arena to join, otherwise the first arena with space is used,
+ * or the next one if the lobby filled it before the player joined.
+ * All other messages carry the arena ID after the command character.
+ * The message is processed with the arena lock held and, if the game state was updated,
+ * the new state is published before the lock is released.
+ *
+ * @param message The message received from the client.
+ * @param response The response to be sent back to the client.
+ * @param socket The PUSH socket of the calling thread, connected to the publisher thread.
+ * @return int Returns 0 if game state was not updated, 1 if it was updated.
+ */
+int process_client_message(char* message, char* response, void* socket) {
+    Arena_t* arena;
+    int arena_id;
+    if (message[0] == CMD_CONNECT) {
+        if (sscanf(message + 1, "%d", &arena_id) == 1) {
+            arena = find_arena(arena_id);
+        } else {
+            // The lobby may fill the chosen arena first, then choose again
+            //ERROR Maximum number of players reached in all arenas, unless a free arena is found
+            sprintf(response, "%d", ERR_FULL);
+            int ret = 0;
+            for (int attempt = 0; attempt < MAX_PLAYERS; attempt++) {
+                arena = find_free_arena();
+                if (arena == NULL) {
+                    break;
+                }
+                lock_arena(arena);
+                if (!arena->game_over) {
+                    ret = process_arena_message(arena, message, response);
+                    if (ret) {
+                        publish_arena_state(arena, socket);
+                    }
+                }
+                unlock_arena(arena);
+                if (atoi(response) == RESP_OK) {
+                    break;
+                }
+            }
+            return ret;
+        }
+    } else {
+        char cmd;
+        if (sscanf(message, "%c %d", &cmd, &arena_id) != 2) {
+            //ERROR Missing arena
+            sprintf(response, "%d", ERR_INVALID_ARENA);
+            return 0;
+        }
+        arena = find_arena(arena_id);
+    }
+    if (arena == NULL) {
+        //ERROR Arena does not exist
+        sprintf(response, "%d", ERR_INVALID_ARENA);
+        return 0;
+    }
+
+    lock_arena(arena);
+    if (arena->game_over) {
+        //ERROR Arena game is over
+        unlock_arena(arena);
+        sprintf(response, "%d", ERR_INVALID_ARENA);
+        return 0;
+    }
+    int ret = process_arena_message(arena, message, response);
+    if (ret) {
+        publish_arena_state(arena, socket);
+    }
+    unlock_arena(arena);
+
+    return ret;
+}
+
 
 
 /**
@@ -618,9 +1168,13 @@ int process_client_message(char* message, char* response) {
  * When a collision with another player is detected, the other player's last stun time
  * is updated to the current time.
  * 
+ * @param arena The arena to check.
+ *
  * @note This function is not thread-safe.
  */
-void check_laser_collisions() {
+void check_laser_collisions(Arena_t* arena) {
+    Player_t* players = arena->players;
+    Alien_t* aliens = arena->aliens;
     for (int i = 0; i < MAX_PLAYERS; i++) {
         if (players[i].laser.active) {
             Laser_t* laser = &players[i].laser;
@@ -632,8 +1186,9 @@ void check_laser_collisions() {
                     if (aliens[j].active && aliens[j].y == laser->y) {
                         // Destroy allien and update player score
                         aliens[j].active = 0;
+                        metrics_aliens(-1);
                         players[i].score += KILL_POINTS;
-                        last_kill_time = get_time_in_seconds();
+                        arena->last_kill_time = get_time_in_seconds();
                     }
                 }
                 // Check colision with player
@@ -651,8 +1206,9 @@ void check_laser_collisions() {
                     if (aliens[j].active && aliens[j].x == laser->x) {
                         // Destroy allien and update player score
                         aliens[j].active = 0;
+                        metrics_aliens(-1);
                         players[i].score += KILL_POINTS;
-                        last_kill_time = get_time_in_seconds();
+                        arena->last_kill_time = get_time_in_seconds();
                     }
                 }
                 // Check colision with player
@@ -680,9 +1236,14 @@ void check_laser_collisions() {
  * The function uses the current time to determine if the aliens should be moved and updates
  * the last move time accordingly.
  * 
+ * @param arena The arena to update.
+ *
  * @note This function is not thread-safe.
  */
-void update_alien_positions() {
+void update_alien_positions(Arena_t* arena) {
+    TRACE_BEGIN("update_aliens");
+    unsigned long long start = stage_time();
+    Alien_t* aliens = arena->aliens;
     for (int i = 0; i < MAX_ALIENS; i++) {
         if (aliens[i].active) {
             int direction = rand() % 4;
@@ -715,6 +1276,8 @@ void update_alien_positions() {
             }
         }
     }
+    stage_record_since(STAGE_UPDATE_ALIENS, start);
+    TRACE_END("update_aliens");
 }
 
 /**
@@ -723,11 +1286,18 @@ void update_alien_positions() {
  *        - Deactivates lasers that have been active for longer than LASER_DURATION seconds.
  *        - Checks if all aliens are destroyed and sets the game over flag if true.
  * 
+ * @param arena The arena to update.
+ *
  * @note This function is not thread-safe.
  */
-void update_game_state() {
+void update_game_state(Arena_t* arena) {
+    TRACE_BEGIN("update_game");
+    unsigned long long start = stage_time();
+    Player_t* players = arena->players;
+    Alien_t* aliens = arena->aliens;
+
     // Check if 10 seconds passed without kills
-    if (has_duration_passed(last_kill_time, ALIEN_RECOVERY_TIME)) {
+    if (has_duration_passed(arena->last_kill_time, ALIEN_RECOVERY_TIME)) {
         int current_aliens = 0;
         // Count current aliens
         for (int i = 0; i < MAX_ALIENS; i++) {
@@ -749,12 +1319,13 @@ void update_game_state() {
                 added++;
             }
         }
+        metrics_aliens(added);
         // Reset kill timer
-        last_kill_time = get_time_in_seconds();
+        arena->last_kill_time = get_time_in_seconds();
     }
     
     // Check laser collisions and update scores
-    check_laser_collisions();
+    check_laser_collisions(arena);
     
     // Deactivate lasers after LASER_DURATION seconds 
     for (int i = 0; i < MAX_PLAYERS; ++i) {
@@ -764,20 +1335,81 @@ void update_game_state() {
     }
 
     // Check if all aliens are destroyed
-    if (all_aliens_destroyed()) {
-        game_over_server = 1; // Set a game over flag
+    if (all_aliens_destroyed(arena)) {
+        arena->game_over = 1; // Set a game over flag
     }
+    stage_record_since(STAGE_UPDATE_GAME, start);
+    TRACE_END("update_game");
 }
 
 /**
- * @brief Sends the current game state to all subscribers.
+ * @brief Removes the players of an arena that sent no request for SESSION_TIMEOUT seconds.
+ *
+ * Clients send a keepalive when idle, so a player not seen for that long has a dead client
+ * that did not disconnect. Its slot and zone are freed for new players.
+ *
+ * @param arena The arena to check.
+ * @param now The current time, seconds since epoch.
+ * @return The number of players removed.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
+ */
+int reap_stale_sessions(Arena_t* arena, double now) {
+    int reaped = 0;
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        Player_t* player = &arena->players[i];
+        if (player->id != '\0' && now - player->last_seen > SESSION_TIMEOUT) {
+            clear_player(player);
+            reaped++;
+        }
+    }
+    arena->sessions_reaped += reaped;
+    return reaped;
+}
+
+/**
+ * @brief Sends a message of an arena to the publisher thread, with its envelope.
+ *
+ * The message is sent as three frames: the publisher socket to use, the envelope
+ * and the message itself. The publisher thread forwards the last two frames.
+ * The envelope starts with the arena and message type, so subscribers can subscribe
+ * to a single arena or a single type of message, followed by the sequence number
+ * of the message in the arena and publisher.
+ *
+ * @param socket The PUSH socket of the calling thread.
+ * @param channel PUBLISH_GAME_STATE or PUBLISH_SCORES, selects the publisher socket.
+ * @param arena The arena the message belongs to.
+ * @param type The message type, one of the MSG_TYPE_* constants.
+ * @param data The message.
+ * @param len The length of the message in bytes.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
+ */
+void publish_message(void* socket, char channel, Arena_t* arena, char type, const void* data, size_t len) {
+    Envelope_t envelope;
+    envelope.arena = arena->id;
+    envelope.type = type;
+    envelope.seq = channel == PUBLISH_SCORES ? ++arena->score_seq : ++arena->state_seq;
+    envelope.epoch = server_epoch;
+
+    char frame[ENVELOPE_MAX_LEN];
+    int frame_len = envelope_format(frame, &envelope);
+    TRACE_BEGIN("zmq_send");
+    zmq_send(socket, &channel, 1, ZMQ_SNDMORE);
+    zmq_send(socket, frame, frame_len, ZMQ_SNDMORE);
+    zmq_send(socket, data, len, 0);
+    TRACE_END("zmq_send");
+}
+
+/**
+ * @brief Builds the current game state message of an arena.
  *
  * This function constructs a message containing the state of all active players,
  * their positions, scores, and laser statuses, as well as the positions of all
- * active aliens. The message is then sent to display subscribers.
+ * active aliens.
  *
  * The message format includes:
- * - Player information: CMD_PLAYER, player ID, x position, y position
+ * - Player information: CMD_PLAYER, player ID, x position, y position, laser cooldown and stun ticks left
  * - Score information: CMD_SCORE, player ID, score
  * - Laser information (if active): CMD_LASER, x position, y position, zone
  * - Alien information: CMD_ALIEN, x position, y position
@@ -785,25 +1417,34 @@ void update_game_state() {
  * The function iterates through all players and aliens, adding their information
  * to the message if they are active.
  *
- * @note The function assumes that the players and aliens arrays, as well as the
- *       publisher socket, are properly initialized and accessible.
- * 
- * @note This function is thread-safe.
+ * @param arena The arena.
+ * @param message Where the message is written, BUFFER_SIZE bytes.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
  */
-void send_game_state() {
-    char message[BUFFER_SIZE] = "";
+void build_game_state(Arena_t* arena, char* message) {
+    Player_t* players = arena->players;
+    Alien_t* aliens = arena->aliens;
     char temp[100];
+    message[0] = '\0';
 
     // Add all active players to message
     // Add all active players and their positions
     for (int i = 0; i < MAX_PLAYERS; i++) {
         if (players[i].id != '\0') {
             // Add player information
-            snprintf(temp, sizeof(temp), "%c %c %d %d\n",
+            int len = snprintf(temp, sizeof(temp), "%c %c %d %d %d %d",
                     CMD_PLAYER,
                     players[i].id, 
                     players[i].x, 
-                    players[i].y);
+                    players[i].y,
+                    remaining_ticks(players[i].last_fire_time, LASER_COOLDOWN),
+                    remaining_ticks(players[i].last_stun_time, STUN_DURATION));
+            if (players[i].last_command != 0) {
+                // Only the clients that tag their commands get the last one applied
+                len += snprintf(temp + len, sizeof(temp) - len, " %lu", players[i].last_command);
+            }
+            snprintf(temp + len, sizeof(temp) - len, "\n");
             strcat(message, temp);
             
             // Add score information
@@ -836,43 +1477,63 @@ void send_game_state() {
             strcat(message, temp);
         }
     }
+}
 
-    // Send the message
-    zmq_send(pub, message, strlen(message), 0);
+/**
+ * @brief Sends the current game state of an arena to all subscribers.
+ *
+ * The message built by build_game_state is sent to display subscribers as a MSG_TYPE_SNAPSHOT of the arena.
+ *
+ * @param arena The arena to send.
+ * @param socket The PUSH socket of the calling thread.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
+ */
+void send_game_state(Arena_t* arena, void* socket) {
+    TRACE_BEGIN("send_state");
+    unsigned long long start = stage_time();
+    char message[BUFFER_SIZE];
+    build_game_state(arena, message);
 
-    // Update the game state string
-    pthread_mutex_lock(&game_state_lock);
-    strcpy(game_state_string, message);
-    pthread_mutex_unlock(&game_state_lock);
+    // Send the message
+    publish_message(socket, PUBLISH_GAME_STATE, arena, MSG_TYPE_SNAPSHOT, message, strlen(message));
+    stage_record_since(STAGE_SEND_STATE, start);
+    TRACE_END("send_state");
 }
 
 
 
 /**
- * @brief Sends score updates for all players using ZeroMQ.
+ * @brief Sends score updates for all players of an arena using ZeroMQ.
  *
  * This function prepares a protobuf structure containing player scores,
- * serializes it, and sends the serialized data over a ZeroMQ socket.
+ * serializes it, and sends the serialized data as a MSG_TYPE_SCORES message of the arena.
  * 
- * @note This function is not thread-safe.
+ * @param arena The arena to send.
+ * @param socket The PUSH socket of the calling thread.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
  */
-void send_score_updates() {
+void send_score_updates(Arena_t* arena, void* socket) {
+    TRACE_BEGIN("send_scores");
+    unsigned long long start = stage_time();
+
     // Prepare protobuf structure
+    ScoreUpdate score_update = SCORE_UPDATE__INIT;
     PlayerScore player_scores[MAX_PLAYERS];
     PlayerScore *player_scores_ptrs[MAX_PLAYERS];
     int count = 0;
 
     // Initialize protobuf structures
-    score_update__init(&score_update);
     for (int i = 0; i < MAX_PLAYERS; i++) {
         player_score__init(&player_scores[i]);
     }
 
     // Fill in player scores
     for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].id != '\0') {
-            player_scores[count].player_id = (int) players[i].id;
-            player_scores[count].score = players[i].score;
+        if (arena->players[i].id != '\0') {
+            player_scores[count].player_id = (int) arena->players[i].id;
+            player_scores[count].score = arena->players[i].score;
             player_scores_ptrs[count] = &player_scores[count];
             count++;
         }
@@ -888,92 +1549,268 @@ void send_score_updates() {
     score_update__pack(&score_update, buffer);
 
     // Send serialized data over ZeroMQ
-    zmq_send(score_pub, buffer, buffer_size, 0);
+    publish_message(socket, PUBLISH_SCORES, arena, MSG_TYPE_SCORES, buffer, buffer_size);
 
     // Cleanup
     free(buffer);
+    stage_record_since(STAGE_SEND_SCORES, start);
+    TRACE_END("send_scores");
 }
 
 
 /**
- * @brief Sends the game over state to all subscribers.
+ * @brief Builds the game over message of an arena.
  *
- * This function constructs a message indicating the game is over and includes
- * the final scores of all players. It sends this message to display subscribers
- * and also sends a protobuf message indicating the game over state.
+ * The message indicates the game is over and includes the final scores of all players.
  *
- * @note This function is not thread-safe.
+ * @param arena The arena.
+ * @param message Where the message is written, BUFFER_SIZE bytes.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
  */
-void send_game_over_state() {
-    char message[BUFFER_SIZE] = "";
+void build_game_over_state(Arena_t* arena, char* message) {
     char temp[100];
+    message[0] = '\0';
 
     // Include game over command
     temp[0] = CMD_GAME_OVER;
     temp[1] = '\n';
+    temp[2] = '\0';
     strcat(message, temp);
 
-    // Send final scores of all players
+    // Add final scores of all players
     for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].id != '\0') {
+        if (arena->players[i].id != '\0') {
             snprintf(temp, sizeof(temp), "%c %c %d\n",
                     CMD_SCORE,
-                    players[i].id,
-                    players[i].score);
+                    arena->players[i].id,
+                    arena->players[i].score);
             strcat(message, temp);
         }
     }
+}
+
+/**
+ * @brief Sends the game over state of an arena to all subscribers.
+ *
+ * This function sends the message built by build_game_over_state to display subscribers
+ * and also sends a protobuf message indicating the game over state.
+ *
+ * @param arena The arena to send.
+ * @param socket The PUSH socket of the calling thread.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
+ */
+void send_game_over_state(Arena_t* arena, void* socket) {
+    char message[BUFFER_SIZE];
+    build_game_over_state(arena, message);
 
     // Send the message
-    zmq_send(pub, message, strlen(message), 0);
+    publish_message(socket, PUBLISH_GAME_STATE, arena, MSG_TYPE_GAME_OVER, message, strlen(message));
     // Send protobuf game over message
     ScoreUpdate score_update = SCORE_UPDATE__INIT;
     score_update.game_over = 1;
     size_t buffer_size = score_update__get_packed_size(&score_update);
     uint8_t *buffer = malloc(buffer_size);
     score_update__pack(&score_update, buffer);
-    zmq_send(score_pub, buffer, buffer_size, 0);
+    publish_message(socket, PUBLISH_SCORES, arena, MSG_TYPE_GAME_OVER, buffer, buffer_size);
     free(buffer);    
+}
 
-    // Update the game state string
-    pthread_mutex_lock(&game_state_lock);
-    strcpy(game_state_string, message);
-    pthread_mutex_unlock(&game_state_lock);
+/**
+ * @brief Publishes the game state and scores of an arena, and its game over state if the game ended.
+ *
+ * The game over state is only sent once, after it the arena is no longer updated.
+ *
+ * @param arena The arena to publish.
+ * @param socket The PUSH socket of the calling thread.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
+ */
+void publish_arena_state(Arena_t* arena, void* socket) {
+    if (arena->game_over_sent) {
+        return;
+    }
+    send_game_state(arena, socket);
+    send_score_updates(arena, socket);
+    if (arena->game_over) {
+        send_game_over_state(arena, socket);
+        arena->game_over_sent = 1;
+    }
 }
 
 /**
- * @brief Thread routine for alien movement and game state updates.
+ * @brief Creates a PUSH socket connected to the publisher thread.
  *
- * This function is executed by a thread responsible for updating the positions
- * of aliens in the game and requesting client updates. It runs in a loop until
- * the game is over, periodically updating alien positions and signaling the
- * need for a client update. The thread sleeps for a defined interval between
- * updates.
+ * Each thread that publishes updates has its own socket, ZeroMQ sockets are not thread-safe.
+ *
+ * @return The socket, or NULL on failure.
+ */
+void* create_publish_socket() {
+    void* socket = zmq_socket(ctx, ZMQ_PUSH);
+    if (socket == NULL) {
+        return NULL;
+    }
+    if (zmq_connect(socket, PUBLISH_INPROC_ENDPOINT) != 0) {
+        zmq_close(socket);
+        return NULL;
+    }
+    return socket;
+}
+
+/**
+ * @brief Adds a job to the tail of the deque of a worker.
+ *
+ * @param worker The worker that receives the job.
+ * @param arena The arena of the job.
+ * @param type JOB_UPDATE or JOB_ALIENS.
+ * @param deadline Time by which the job should be finished, in seconds since epoch.
+ *
+ * @note This function is not thread-safe and should be called with the deque lock held.
+ */
+void push_job(Worker_t* worker, Arena_t* arena, int type, double deadline) {
+    int index = (worker->head + worker->count) % (int)(sizeof(worker->jobs) / sizeof(worker->jobs[0]));
+    worker->jobs[index].arena = arena;
+    worker->jobs[index].type = type;
+    worker->jobs[index].deadline = deadline;
+    worker->count++;
+}
+
+/**
+ * @brief Takes the job with the earliest deadline from the deque of a worker.
+ *
+ * Used both by the owner of the deque and by workers stealing from it.
+ *
+ * @param worker The worker whose deque is checked.
+ * @param job Where the job is copied.
+ * @return 1 if a job was taken, 0 if the deque is empty.
+ */
+int take_job(Worker_t* worker, Job_t* job) {
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count == 0) {
+        pthread_mutex_unlock(&worker->lock);
+        return 0;
+    }
+    *job = worker->jobs[worker->head];
+    worker->head = (worker->head + 1) % (int)(sizeof(worker->jobs) / sizeof(worker->jobs[0]));
+    worker->count--;
+    pthread_mutex_unlock(&worker->lock);
+
+    atomic_fetch_sub(&pending_jobs, 1);
+    return 1;
+}
+
+/**
+ * @brief Finds the next job for a worker.
+ *
+ * Takes the next job of its own deque. When the deque is empty, steals the next job of
+ * another worker, starting with the following one so that the thieves spread over the deques.
+ *
+ * @param self The worker looking for a job.
+ * @param job Where the job is copied.
+ * @return 1 if a job was found, 0 if all deques are empty.
+ */
+int find_job(Worker_t* self, Job_t* job) {
+    if (take_job(self, job)) {
+        return 1;
+    }
+    for (int i = 1; i < n_workers; i++) {
+        Worker_t* victim = &workers[(self->id + i) % n_workers];
+        if (take_job(victim, job)) {
+            self->steals++; // Only the owner writes it, read after the workers are joined
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Thread routine that queues the update and alien movement jobs of every arena at a fixed rate.
+ *
+ * Every GAME_UPDATE_INTERVAL it queues an update job for each running arena, and an alien
+ * movement job for the arenas whose aliens moved more than ALIEN_MOVE_INTERVAL ago.
+ * The jobs go to the deque of the home worker of the arena, with the next tick as deadline.
+ * A job is not queued again while the previous job of the same type is still queued or running,
+ * so a slow arena does not fill the deques. Those ticks are counted as skipped.
+ * Without a lobby, the server is over when all arenas are over. With a lobby, new arenas can
+ * still be created for the next players, so the server runs until end_server_logic is called.
  *
  * @param arg Unused parameter.
  * @return None.
  */
-void* thread_alien_routine(void* arg) {
+void* thread_tick_routine(void* arg) {
     // Avoid unused parameter warning
     (void)arg;
+    trace_thread_name("tick");
 
-    while (!game_over_server) {
-        pthread_mutex_lock(&server_lock);
-        // Update aliens positions
-        update_alien_positions();
+    struct timespec next_tick;
+    clock_gettime(CLOCK_MONOTONIC, &next_tick);
+    unsigned long long last_tick = 0;
 
-        // Request a client update
-        request_publish = 1;
-        pthread_cond_signal(&publish_cond);
+    while (!game_over_server) {
+        TRACE_BEGIN("tick");
+        // Jitter of the tick, how far the time since the previous one is from GAME_UPDATE_INTERVAL
+        unsigned long long tick = stage_time();
+        if (last_tick != 0) {
+            long long interval = (long long)(tick - last_tick) - (long long)(GAME_UPDATE_INTERVAL * 1e9);
+            stage_record(STAGE_TICK_JITTER, interval < 0 ? -interval : interval);
+        }
+        last_tick = tick;
+        metrics_tick();
+
+        double now = get_time_in_seconds();
+        double deadline = now + GAME_UPDATE_INTERVAL;
+        int running = 0;
+        int queued = 0;
+
+        for (int i = 0; i < arena_count; i++) {
+            Arena_t* arena = &arenas[i];
+            // Not under the arena lock, a job queued as the game ends does nothing (see thread_worker_routine)
+            if (atomic_load(&arena->game_over_sent)) {
+                continue;
+            }
+            running++;
+
+            Worker_t* worker = &workers[arena->home_worker];
+            pthread_mutex_lock(&worker->lock);
+            if (!arena->update_queued) {
+                arena->update_queued = 1;
+                push_job(worker, arena, JOB_UPDATE, deadline);
+                queued++;
+            } else {
+                arena->skipped_ticks++;
+                metrics_skipped_tick();
+            }
+            if (!arena->aliens_queued && now - arena->last_alien_move_time >= ALIEN_MOVE_INTERVAL) {
+                arena->aliens_queued = 1;
+                arena->last_alien_move_time = now;
+                push_job(worker, arena, JOB_ALIENS, deadline);
+                queued++;
+            }
+            pthread_mutex_unlock(&worker->lock);
+        }
 
-        pthread_mutex_unlock(&server_lock);
+        // Wake up the idle workers
+        // The count is updated before taking the lock, so a worker going to sleep sees it
+        atomic_fetch_add(&pending_jobs, queued);
+        pthread_mutex_lock(&job_lock);
+        if (running == 0 && lobby == NULL) {
+            // All games are over and none can be created
+            // Under job_lock like create_arena, so the lobby does not create one as the server ends
+            game_over_server = 1;
+        }
+        pthread_cond_broadcast(&job_cond);
+        pthread_mutex_unlock(&job_lock);
+        TRACE_END("tick");
 
         // Sleep until next update
-        // Note: It was thought to use has_duration_passed 
-        //     because this thread might take a max of ALIEN_MOVE_INTERVAL to check game_over_server and exit
-        //     it was decided to ignore this thread in pthread_join part
-        sleep(ALIEN_MOVE_INTERVAL); // Sleep for 1 second
-
+        // The deadline is absolute, so the time spent queueing jobs does not delay the ticks
+        next_tick.tv_nsec += (long)(GAME_UPDATE_INTERVAL * 1e9);
+        while (next_tick.tv_nsec >= 1000000000L) {
+            next_tick.tv_nsec -= 1000000000L;
+            next_tick.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_tick, NULL);
     }
 
     // End of thread
@@ -981,46 +1818,145 @@ void* thread_alien_routine(void* arg) {
 }
 
 /**
- * @brief Thread routine to periodically update the game state.
+ * @brief Thread routine of the worker pool, runs the jobs of its deque and steals from the others when idle.
  *
- * This function runs in a loop until the game is over. It locks the server mutex,
- * updates the game state, signals the condition variable to notify clients, and
- * then sleeps for a specified interval before repeating the process.
+ * Each job locks its arena, runs update_game_state or update_alien_positions and
+ * publishes the new state of the arena. Different arenas are updated in parallel
+ * by different workers. Jobs that finish after their deadline are counted in the arena.
+ * The thread sleeps while all deques are empty and exits when jobs_stopping is set.
  *
- * @param arg Unused parameter.
+ * @param arg Pointer to the Worker_t of the thread.
  * @return None.
  */
-void* thread_updater_routine(void* arg) {
-    // Avoid unused parameter warning
-    (void)arg;
-
-    while (!game_over_server) {
-        pthread_mutex_lock(&server_lock);
-        last_update_time = get_time_in_seconds();
-
-        // Update game state
-        update_game_state();
-
-        // Request a client update
-        request_publish = 1;
-        pthread_cond_signal(&publish_cond);
-        pthread_mutex_unlock(&server_lock);
+void* thread_worker_routine(void* arg) {
+    Worker_t* self = (Worker_t*)arg;
+    trace_thread_name("worker");
+
+    void* socket = create_publish_socket();
+    if (socket == NULL) {
+        perror("Failed to create worker publish socket");
+        pthread_exit(NULL);
+    }
+    // Do not wait for updates that were not forwarded when the server ends
+    int linger = 0;
+    zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+
+    while (1) {
+        // Wait for a job
+        Job_t job;
+        if (!find_job(self, &job)) {
+            pthread_mutex_lock(&job_lock);
+            while (atomic_load(&pending_jobs) == 0 && !jobs_stopping) {
+                pthread_cond_wait(&job_cond, &job_lock);
+            }
+            int stopping = jobs_stopping;
+            pthread_mutex_unlock(&job_lock);
+            if (stopping) {
+                break;
+            }
+            continue;
+        }
 
-        // Sleep until next update
-        usleep(GAME_UPDATE_INTERVAL*1000);
+        // Run the job
+        Arena_t* arena = job.arena;
+        const char* job_name = job.type == JOB_UPDATE ? "job_update" : "job_aliens";
+        TRACE_BEGIN(job_name);
+        lock_arena(arena);
+        if (!arena->game_over_sent) {
+            if (job.type == JOB_UPDATE) {
+                arena->last_update_time = get_time_in_seconds();
+                reap_stale_sessions(arena, arena->last_update_time);
+                update_game_state(arena);
+            } else {
+                update_alien_positions(arena);
+            }
+            publish_arena_state(arena, socket);
+
+            double lateness = get_time_in_seconds() - job.deadline;
+            arena->jobs_run++;
+            if (lateness > 0) {
+                arena->missed_deadlines++;
+                metrics_missed_deadline();
+                if (lateness > arena->max_lateness) {
+                    arena->max_lateness = lateness;
+                }
+            }
+        }
+        unlock_arena(arena);
+        TRACE_END(job_name);
+        self->jobs_run++;
+
+        // Allow the tick thread to queue the next job of this type
+        Worker_t* home = &workers[arena->home_worker];
+        pthread_mutex_lock(&home->lock);
+        if (job.type == JOB_UPDATE) {
+            arena->update_queued = 0;
+        } else {
+            arena->aliens_queued = 0;
+        }
+        pthread_mutex_unlock(&home->lock);
     }
 
+    zmq_close(socket);
+
     // End of thread
     pthread_exit(NULL);
 }
 
+// Requests of the astronauts waiting for the listener thread, one queue per connection
+FairQueue_t listener_queue;
+
+/**
+ * @brief Processes a request of an astronaut and sends the reply.
+ *
+ * The requests collapsed with it by the listener queue are sent the same reply,
+ * their moves are part of the move of the request.
+ *
+ * @param requests The request, followed by the requests collapsed with it, closed once replied.
+ * @param count The number of requests.
+ * @param socket The PUSH socket of the listener thread, connected to the publisher thread.
+ */
+void serve_request(Request_t* requests, int count, void* socket) {
+    char response[BUFFER_SIZE];
+    size_t len;
+    const char* payload = request_payload(&requests[0], &len);
+    if (len >= BUFFER_SIZE) {
+        // Message too long, possible overflow attempt
+        snprintf(response, sizeof(response), "%d", ERR_TOLONG);
+        metrics_command(payload[0], ERR_TOLONG);
+    } else {
+        char buffer[BUFFER_SIZE];
+        memcpy(buffer, payload, len);
+        buffer[len] = '\0';
+
+        // Process the message in its arena, updates are published by process_client_message
+        int stage = command_stage(buffer[0]);
+        TRACE_BEGIN(stage_name(stage));
+        unsigned long long start = stage_time();
+        process_client_message(buffer, response, socket);
+        stage_record_since(stage, start);
+        TRACE_END(stage_name(stage));
+        metrics_command(buffer[0], atoi(response));
+    }
+    TRACE_BEGIN("zmq_send");
+    for (int i = 0; i < count; i++) {
+        request_reply(resp, &requests[i], response, strlen(response));
+    }
+    TRACE_END("zmq_send");
+}
+
 /**
  * @brief Thread routine for listening to client messages and processing them.
  *
  * This function runs in a loop until the game is over, receiving messages from clients,
- * processing them, and sending appropriate responses. It ensures thread safety by using
- * mutex locks and condition variables to update the game state and signal when a client
- * update is needed.
+ * routing them to their arena, processing them, and sending appropriate responses.
+ * Updates caused by the messages are published through its own PUSH socket.
+ *
+ * The requests waiting on the socket are moved to the queue of their session and the
+ * sessions are served in turn, one request each, so that a client flooding the server
+ * only delays its own requests. Requests over the CLIENT_QUEUE_SIZE of a session are
+ * rejected with ERR_THROTTLED without being processed. Zaps, connects, resumes and
+ * disconnects are served before the moves waiting (see fair_queue_pop).
  *
  * @param arg Unused parameter.
  * @return None (this function calls pthread_exit() to terminate the thread).
@@ -1028,76 +1964,276 @@ void* thread_updater_routine(void* arg) {
 void* thread_listener_routine(void* arg) {
     // Avoid unused parameter warning
     (void)arg;
+    trace_thread_name("listener");
+
+    void* socket = create_publish_socket();
+    if (socket == NULL) {
+        perror("Failed to create listener publish socket");
+        pthread_exit(NULL);
+    }
+    int linger = 0;
+    zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
 
     while (!game_over_server) {
-        // Define safer buffer sizes
-        char buffer[BUFFER_SIZE] = {0};
-
-        // Receive messages with a maximum limit
-        int recv_size = zmq_recv(resp, buffer, sizeof(buffer) - 1, 0);
-        if (recv_size > 0 && recv_size < BUFFER_SIZE) {
-            buffer[recv_size] = '\0';
-            char response[BUFFER_SIZE];
-
-            pthread_mutex_lock(&server_lock);
-            // Process the message and update game state
-            int ret = process_client_message(buffer, response);
-
-            if (ret) {
-                // Request a client update
-                request_publish = 1;
-                pthread_cond_signal(&publish_cond);
+        // Wait for requests only when none is queued, at most LISTENER_POLL_INTERVAL (receive timeout of the socket)
+        int flags = listener_queue.queued > 0 ? ZMQ_DONTWAIT : 0;
+        Request_t request;
+        for (int i = 0; i < MAX_CLIENT_QUEUES && request_recv(resp, &request, flags) == 0; i++) {
+            flags = ZMQ_DONTWAIT;
+            int ret = fair_queue_push(&listener_queue, &request);
+            if (ret == FAIR_QUEUE_CLIENT_FULL) {
+                //ERROR Too many requests waiting from the same session
+                size_t len;
+                metrics_command(request_payload(&request, &len)[0], ERR_THROTTLED);
+                char response[8];
+                snprintf(response, sizeof(response), "%d", ERR_THROTTLED);
+                request_reply(resp, &request, response, strlen(response));
+            } else if (ret == FAIR_QUEUE_FULL) {
+                // Too many sessions waiting, served in the order they arrive
+                serve_request(&request, 1, socket);
             }
+        }
 
-            pthread_mutex_unlock(&server_lock);
+        // Serve the next session in turn
+        Request_t requests[CLIENT_QUEUE_SIZE];
+        int count = fair_queue_pop(&listener_queue, requests);
+        if (count > 0) {
+            serve_request(requests, count, socket);
+        }
+    }
+
+    fair_queue_clear(&listener_queue);
+    zmq_close(socket);
+
+    // End of thread
+    pthread_exit(NULL);
+}
 
-            // Send response to client
-            zmq_send(resp, response, strlen(response), 0);
+/**
+ * @brief Thread routine of the lobby, assigns the connecting players to arenas.
+ *
+ * The lobby only accepts connect messages ("C"). Each player joins the arena chosen by
+ * find_lobby_arena, creating arenas as needed, and gets the same reply as a connect
+ * message sent to the game endpoint. The player then sends its commands to the game endpoint.
+ * Replies ERR_FULL only when MAX_ARENAS arenas exist and all are full.
+ *
+ * @param arg Unused parameter.
+ * @return None.
+ */
+void* thread_lobby_routine(void* arg) {
+    // Avoid unused parameter warning
+    (void)arg;
+    trace_thread_name("lobby");
 
-        } else if (recv_size >= BUFFER_SIZE) {
-            // Message too long, possible overflow attempt
-            //char response[] = "ERROR Message too long";
-            char response = ERR_TOLONG;
-            zmq_send(resp, &response, sizeof(response), 0);
+    void* socket = create_publish_socket();
+    if (socket == NULL) {
+        perror("Failed to create lobby publish socket");
+        pthread_exit(NULL);
+    }
+    int linger = 0;
+    zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+
+    while (!game_over_server) {
+        char buffer[BUFFER_SIZE];
+        int recv_size = zmq_recv(lobby, buffer, sizeof(buffer) - 1, 0);
+        if (recv_size == -1) {
+            continue; // Timeout, check for game over
+        }
+        buffer[recv_size < BUFFER_SIZE ? recv_size : BUFFER_SIZE - 1] = '\0';
+
+        char response[BUFFER_SIZE];
+        if (recv_size >= BUFFER_SIZE) {
+            snprintf(response, sizeof(response), "%d", ERR_TOLONG);
+        } else if (recv_size != 1 || buffer[0] != CMD_CONNECT) {
+            snprintf(response, sizeof(response), "%d", ERR_UNKNOWN_CMD);
+        } else {
+            // The listener may fill the chosen arena first, then choose again
+            snprintf(response, sizeof(response), "%d", ERR_FULL);
+            for (int attempt = 0; attempt < MAX_PLAYERS; attempt++) {
+                Arena_t* arena = find_lobby_arena();
+                if (arena == NULL) {
+                    break;
+                }
+                lock_arena(arena);
+                if (!arena->game_over) {
+                    if (process_arena_message(arena, buffer, response)) {
+                        publish_arena_state(arena, socket);
+                    }
+                }
+                unlock_arena(arena);
+                if (atoi(response) == RESP_OK) {
+                    break;
+                }
+            }
         }
+        metrics_command(CMD_CONNECT, atoi(response));
+        TRACE_BEGIN("zmq_send");
+        zmq_send(lobby, response, strlen(response), 0);
+        TRACE_END("zmq_send");
     }
 
+    zmq_close(socket);
+
     // End of thread
     pthread_exit(NULL);
 }
 
 /**
- * @brief Thread routine for publishing game state and score updates.
+ * @brief Thread routine of the snapshot service, sends the current state of an arena to late joiners.
  *
- * This function runs in a loop until the game is over. It waits for a signal
- * to publish the game state and score updates to all subscribers. The function
- * uses a mutex to ensure thread safety and a condition variable to wait for
- * the publish signal.
+ * The request is the arena ID. The reply has two frames, like the published messages: the
+ * envelope and the message. The message is the current game state (MSG_TYPE_SNAPSHOT), or
+ * the game over state if the arena ended. The envelope has the sequence number of the last
+ * message published for the arena, which has the same content, so the display only needs
+ * the published messages with a higher sequence number.
+ * An invalid arena is answered with a single ERR_INVALID_ARENA frame.
  *
  * @param arg Unused parameter.
- * @return void* Always returns NULL.
+ * @return None.
  */
-void* thread_publisher_routine(void* arg) {
+void* thread_snapshot_routine(void* arg) {
     // Avoid unused parameter warning
     (void)arg;
+    trace_thread_name("snapshot");
 
-    while(!game_over_server) {
+    while (!game_over_server) {
+        char request[16];
+        int recv_size = zmq_recv(snapshot, request, sizeof(request) - 1, 0);
+        if (recv_size == -1) {
+            continue; // Timeout, check for game over
+        }
+        request[recv_size < (int)sizeof(request) ? recv_size : (int)sizeof(request) - 1] = '\0';
 
-        pthread_mutex_lock(&server_lock);
+        int arena_id;
+        Arena_t* arena = NULL;
+        if (sscanf(request, "%d", &arena_id) == 1) {
+            arena = find_arena(arena_id);
+        }
+        if (arena == NULL) {
+            char response[8];
+            snprintf(response, sizeof(response), "%d", ERR_INVALID_ARENA);
+            zmq_send(snapshot, response, strlen(response), 0);
+            continue;
+        }
 
-        // Wait for a signal to publish
-        while (!request_publish) {
-            pthread_cond_wait(&publish_cond, &server_lock);
+        // Copy the state under the arena lock, send it after releasing it
+        char message[BUFFER_SIZE];
+        Envelope_t envelope;
+        envelope.arena = arena->id;
+        lock_arena(arena);
+        if (arena->game_over_sent) {
+            build_game_over_state(arena, message);
+            envelope.type = MSG_TYPE_GAME_OVER;
+        } else {
+            build_game_state(arena, message);
+            envelope.type = MSG_TYPE_SNAPSHOT;
         }
+        envelope.seq = arena->state_seq;
+        envelope.epoch = server_epoch;
+        unlock_arena(arena);
+
+        char frame[ENVELOPE_MAX_LEN];
+        int frame_len = envelope_format(frame, &envelope);
+        TRACE_BEGIN("zmq_send");
+        zmq_send(snapshot, frame, frame_len, ZMQ_SNDMORE);
+        zmq_send(snapshot, message, strlen(message), 0);
+        TRACE_END("zmq_send");
+    }
+
+    // End of thread
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief Thread routine of the metrics service, sends the counters of the server to monitoring.
+ *
+ * Any request is answered with the metrics in the Prometheus text format (see server-metrics.c).
+ * The counters are read without locks, the game is not slowed down by the requests.
+ *
+ * @param arg Unused parameter.
+ * @return None.
+ */
+void* thread_metrics_routine(void* arg) {
+    // Avoid unused parameter warning
+    (void)arg;
+
+    char* response = malloc(METRICS_BUFFER_SIZE);
+    if (response == NULL) {
+        perror("Failed to allocate the metrics buffer");
+        pthread_exit(NULL);
+    }
 
-        // Send game state to all subscribers
-        // Note: the functions below block until zmq_send is finished, possible speedup can be made
-        send_game_state();
-        send_score_updates();
-        request_publish = 0;
+    while (!game_over_server) {
+        char request[16];
+        if (zmq_recv(metrics, request, sizeof(request), 0) == -1) {
+            continue; // Timeout, check for game over
+        }
+        int len = format_metrics(response, METRICS_BUFFER_SIZE);
+        zmq_send(metrics, response, len, 0);
+    }
+    free(response);
 
-        pthread_mutex_unlock(&server_lock);
+    // End of thread
+    pthread_exit(NULL);
+}
 
+/**
+ * @brief Thread routine that owns the publisher sockets and forwards the updates of the other threads.
+ *
+ * The workers and the listener send their messages to this thread through inproc PUSH sockets,
+ * ZeroMQ sockets cannot be shared between threads. Each message has three frames: the publisher
+ * socket to use, the envelope and the message. The envelope and message are forwarded without copies.
+ * A message with a single empty frame stops the thread, after forwarding the messages already queued.
+ *
+ * @param arg Unused parameter.
+ * @return void* Always returns NULL.
+ */
+void* thread_publisher_routine(void* arg) {
+    // Avoid unused parameter warning
+    (void)arg;
+    trace_thread_name("publisher");
+
+    int stopping = 0;
+    while (1) {
+        zmq_msg_t channel;
+        zmq_msg_init(&channel);
+        if (zmq_msg_recv(&channel, publish_pull, stopping ? ZMQ_DONTWAIT : 0) == -1) {
+            zmq_msg_close(&channel);
+            if (stopping || zmq_errno() == ETERM) {
+                break;
+            }
+            continue;
+        }
+        if (zmq_msg_size(&channel) == 0) {
+            // Stop message, forward what is still queued and exit
+            zmq_msg_close(&channel);
+            stopping = 1;
+            continue;
+        }
+        char channel_type = *(char*)zmq_msg_data(&channel);
+        void* publisher = channel_type == PUBLISH_SCORES ? score_pub : pub;
+        zmq_msg_close(&channel);
+
+        // Forward the envelope and the message, the frames of a message always arrive together
+        TRACE_BEGIN(channel_type == PUBLISH_SCORES ? "publish_scores" : "publish_state");
+        zmq_msg_t part;
+        int more = 1;
+        size_t bytes = 0;
+        int failed = 0;
+        while (more) {
+            zmq_msg_init(&part);
+            zmq_msg_recv(&part, publish_pull, 0);
+            more = zmq_msg_more(&part);
+            bytes += zmq_msg_size(&part);
+            failed |= zmq_msg_send(&part, publisher, more ? ZMQ_SNDMORE : 0) == -1;
+            zmq_msg_close(&part);
+        }
+        TRACE_END(channel_type == PUBLISH_SCORES ? "publish_scores" : "publish_state");
+        if (failed) {
+            metrics_publish_error(channel_type);
+        } else {
+            metrics_published(channel_type, bytes);
+        }
     }
 
     // End of thread
@@ -1107,30 +2243,95 @@ void* thread_publisher_routine(void* arg) {
 /**
  * @brief Sets the game over flag to end the game.
  *
- * This function sets the game over flag to 1, indicating that the game has ended.
- * It is used to stop the game logic loop .
+ * This function sets the game over flag to 1, indicating that the server has ended.
+ * It is used to stop the game logic loop. The arenas that are still running
+ * send their game over state when server_logic finishes.
  * 
  * Is it called by main program when terminal 'q' keypress is received.
  * 
  */
 void end_server_logic(){
-    pthread_mutex_lock(&server_lock);
+    pthread_mutex_lock(&job_lock);
     game_over_server = 1;
-    pthread_mutex_unlock(&server_lock);
+    pthread_mutex_unlock(&job_lock);
+}
+
+/**
+ * @brief Sets the number of arenas hosted by the server.
+ *
+ * Must be called before server_logic. Values outside 1 to MAX_ARENAS are clamped.
+ *
+ * @param count The number of arenas.
+ */
+void set_server_arena_count(int count) {
+    if (count < 1) {
+        count = 1;
+    } else if (count > MAX_ARENAS) {
+        count = MAX_ARENAS;
+    }
+    arena_count = count;
 }
 
 /**
- * @brief Retrieves the current game state from the server.
+ * @brief Sets the number of worker threads that update the arenas.
  *
- * This function locks the game state mutex, copies the current game state
- * string into the provided buffer, and then unlocks the mutex.
+ * Must be called before server_logic.
  *
- * @param buffer A pointer to a character array where the game state string will be copied.
+ * @param count The number of workers, 0 to use one per online core.
  */
-void get_server_game_state(char* buffer) {
-    pthread_mutex_lock(&game_state_lock);
-    strcpy(buffer, game_state_string);
-    pthread_mutex_unlock(&game_state_lock);
+void set_server_worker_count(int count) {
+    worker_count = count < 0 ? 0 : count;
+}
+
+/**
+ * @brief Prints the jobs run by each worker, the deadlines missed, sessions reaped and commands throttled by each arena,
+ * the requests and throttled commands of each connected player, and the time the requests waited in each priority lane.
+ *
+ * The deadline of a job is the next tick after it was queued. Skipped ticks are the ticks
+ * where the previous update job of the arena had not finished yet.
+ * Must be called after server_logic returns.
+ *
+ * @param out The stream where the report is written.
+ */
+void print_scheduler_report(FILE* out) {
+    if (workers == NULL || arenas == NULL) {
+        return;
+    }
+
+    unsigned long total = 0;
+    unsigned long stolen = 0;
+    for (int i = 0; i < n_workers; i++) {
+        total += workers[i].jobs_run;
+        stolen += workers[i].steals;
+    }
+    fprintf(out, "Scheduler: %d workers, %lu jobs, %lu stolen\n", n_workers, total, stolen);
+    for (int i = 0; i < n_workers; i++) {
+        fprintf(out, "  worker %2d: %8lu jobs %8lu stolen\n", i, workers[i].jobs_run, workers[i].steals);
+    }
+
+    fprintf(out, "Arena  Worker      Jobs    Missed   Skipped  Max late (ms)    Reaped  Throttled\n");
+    for (int i = 0; i < arena_count; i++) {
+        Arena_t* arena = &arenas[i];
+        fprintf(out, "  " ARENA_TOPIC_FORMAT "  %6d  %8lu  %8lu  %8lu  %13.2f  %8lu  %9lu\n", arena->id, arena->home_worker,
+                arena->jobs_run, arena->missed_deadlines, arena->skipped_ticks, arena->max_lateness * 1000.0,
+                arena->sessions_reaped, arena->throttled);
+        // Players still connected
+        for (int j = 0; j < MAX_PLAYERS; j++) {
+            Player_t* player = &arena->players[j];
+            if (player->id != '\0') {
+                fprintf(out, "    player %c: %8lu requests %8lu throttled\n", player->id, player->requests, player->throttled);
+            }
+        }
+    }
+
+    const char* lane_names[PRIORITY_LANES] = { "high", "bulk" };
+    fprintf(out, "Lane    Requests  Collapsed  p50 wait (ms)  p99 wait (ms)  Max wait (ms)\n");
+    for (int i = 0; i < PRIORITY_LANES; i++) {
+        Lane_t* lane = &listener_queue.lanes[i];
+        fprintf(out, "  %-4s  %8lu  %9lu  %13.3f  %13.3f  %13.3f\n", lane_names[i], lane->wait.count, lane->collapsed,
+                histogram_percentile(&lane->wait, 0.5) / 1e6, histogram_percentile(&lane->wait, 0.99) / 1e6,
+                lane->wait.max / 1e6);
+    }
 }
 
 
@@ -1138,48 +2339,130 @@ void get_server_game_state(char* buffer) {
  * @brief Main server logic function that initializes mutexes, condition variables,
  *        game state, and creates necessary threads for game operation.
  *
+ * The threads are a tick thread that queues the arena jobs, a pool of worker threads
+ * that run them, a listener for the client requests, a lobby that assigns arenas to
+ * connecting players, a snapshot service for late joining displays, a metrics service
+ * for monitoring, and a publisher that owns the publisher sockets. The function
+ * returns when all arenas are over or end_server_logic is called, after the game over
+ * state of every arena was published.
+ *
+ * @param context The ZeroMQ context, used to create the internal sockets.
  * @param responder Pointer to the responder object.
  * @param publisher Pointer to the publisher object.
  * @param score_publisher Pointer to the score publisher object.
+ * @param lobby_responder Pointer to the lobby responder object, or NULL to run without a lobby.
+ * @param snapshot_responder Pointer to the snapshot responder object, or NULL to run without the snapshot service.
+ * @param metrics_responder Pointer to the metrics responder object, or NULL to run without the metrics service.
  * @return int Returns 0 on success, -1 on failure.
  */
-int server_logic(void* responder, void* publisher, void* score_publisher) {
-    pthread_t thread_alien;
-    pthread_t thread_updater;
+int server_logic(void* context, void* responder, void* publisher, void* score_publisher, void* lobby_responder, void* snapshot_responder, void* metrics_responder) {
+    pthread_t thread_tick;
+    pthread_t thread_metrics;
     pthread_t thread_listener;
+    pthread_t thread_lobby;
+    pthread_t thread_snapshot;
     pthread_t thread_publisher;
     int ret;
+    trace_thread_name("server");
 
+    ctx = context;
     pub = publisher;
     resp = responder;
     score_pub = score_publisher;
+    lobby = lobby_responder;
+    snapshot = snapshot_responder;
+    metrics = metrics_responder;
+
+    // The sequence numbers start again at 1, the epoch tells the subscribers it is a new server
+    struct timespec start;
+    clock_gettime(CLOCK_REALTIME, &start);
+    server_epoch = (unsigned long)start.tv_sec * 1000000UL + (unsigned long)(start.tv_nsec / 1000);
 
     // Intialize mutexes and conditions
-    if (pthread_mutex_init(&server_lock, NULL) != 0) {
-        perror("Failed to initialize server_lock mutex");
+    if (pthread_mutex_init(&job_lock, NULL) != 0) {
+        perror("Failed to initialize job_lock mutex");
         return -1;
     }
-    if (pthread_mutex_init(&game_state_lock, NULL) != 0) {
-        perror("Failed to initialize game_state_lock mutex");
+    if (pthread_cond_init(&job_cond, NULL) != 0) {
+        perror("Failed to initialize job_cond condition variable");
         return -1;
     }
-    if (pthread_cond_init(&publish_cond, NULL) != 0) {
-        perror("Failed to initialize publish_cond condition variable");
+
+    // Initialize the arenas, with space for the ones created by the lobby
+    srand(time(NULL));
+    arenas = calloc(MAX_ARENAS, sizeof(Arena_t));
+    if (arenas == NULL) {
+        perror("Failed to allocate arenas");
         return -1;
     }
+    for (int i = 0; i < arena_count; i++) {
+        if (initialize_arena(&arenas[i], i) != 0) {
+            perror("Failed to initialize arena lock");
+            return -1;
+        }
+    }
+
+    // Socket where the other threads send their updates to the publisher thread
+    publish_pull = zmq_socket(ctx, ZMQ_PULL);
+    if (zmq_bind(publish_pull, PUBLISH_INPROC_ENDPOINT) != 0) {
+        perror("Failed to bind publish socket");
+        return -1;
+    }
+
+    // The listener wakes up periodically to check for game over, so that it can be joined
+    int timeout = LISTENER_POLL_INTERVAL;
+    zmq_setsockopt(resp, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    if (lobby != NULL) {
+        zmq_setsockopt(lobby, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    if (snapshot != NULL) {
+        zmq_setsockopt(snapshot, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    if (metrics != NULL) {
+        zmq_setsockopt(metrics, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    }
 
-    // Initialize game state
-    initialize_game_state();
+    // Create the workers, the arenas are spread over their deques
+    n_workers = worker_count;
+    if (n_workers == 0) {
+        n_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (n_workers < 1) {
+            n_workers = 1;
+        }
+    }
+    workers = calloc(n_workers, sizeof(Worker_t));
+    pthread_t* thread_workers = malloc(n_workers * sizeof(pthread_t));
+    if (workers == NULL || thread_workers == NULL) {
+        perror("Failed to allocate worker threads");
+        return -1;
+    }
+    for (int i = 0; i < n_workers; i++) {
+        workers[i].id = i;
+        if (pthread_mutex_init(&workers[i].lock, NULL) != 0) {
+            perror("Failed to initialize worker lock");
+            return -1;
+        }
+    }
+    for (int i = 0; i < arena_count; i++) {
+        arenas[i].home_worker = i % n_workers;
+    }
 
     // Create Threads
-    ret = pthread_create(&thread_alien, NULL, thread_alien_routine, NULL);
+    ret = pthread_create(&thread_publisher, NULL, thread_publisher_routine, NULL);
     if (ret != 0) {
-        perror("Failed to create thread_alien");
+        perror("Failed to create thread_publisher");
         return -1;
     }
-    ret = pthread_create(&thread_updater, NULL, thread_updater_routine, NULL);
+    for (int i = 0; i < n_workers; i++) {
+        ret = pthread_create(&thread_workers[i], NULL, thread_worker_routine, &workers[i]);
+        if (ret != 0) {
+            perror("Failed to create thread_worker");
+            return -1;
+        }
+    }
+    ret = pthread_create(&thread_tick, NULL, thread_tick_routine, NULL);
     if (ret != 0) {
-        perror("Failed to create thread_updater");
+        perror("Failed to create thread_tick");
         return -1;
     }
     ret = pthread_create(&thread_listener, NULL, thread_listener_routine, NULL);
@@ -1187,18 +2470,71 @@ int server_logic(void* responder, void* publisher, void* score_publisher) {
         perror("Failed to create thread_listener");
         return -1;
     }
-    ret = pthread_create(&thread_publisher, NULL, thread_publisher_routine, NULL);
-    if (ret != 0) {
-        perror("Failed to create thread_publisher");
-        return -1;
+    if (lobby != NULL) {
+        ret = pthread_create(&thread_lobby, NULL, thread_lobby_routine, NULL);
+        if (ret != 0) {
+            perror("Failed to create thread_lobby");
+            return -1;
+        }
+    }
+    if (snapshot != NULL) {
+        ret = pthread_create(&thread_snapshot, NULL, thread_snapshot_routine, NULL);
+        if (ret != 0) {
+            perror("Failed to create thread_snapshot");
+            return -1;
+        }
+    }
+    if (metrics != NULL) {
+        ret = pthread_create(&thread_metrics, NULL, thread_metrics_routine, NULL);
+        if (ret != 0) {
+            perror("Failed to create thread_metrics");
+            return -1;
+        }
     }
 
-    //pthread_join(thread_alien, NULL); // This thread is not joined because at max it would take ALIEN_MOVE_INTERVAL to finish, delaying the game over
-    pthread_join(thread_updater, NULL);
-    //pthread_join(thread_listener, NULL); // This thread is not joined because it can be blocked by zmq_recv
-    //pthread_join(thread_publisher, NULL); // This thread is not joined because it can take some time to end zmq_send and a new update will be requested at gameover
+    pthread_join(thread_tick, NULL);
 
-    send_game_over_state();
+    // Stop the workers, the queued jobs are discarded
+    pthread_mutex_lock(&job_lock);
+    jobs_stopping = 1;
+    pthread_cond_broadcast(&job_cond);
+    pthread_mutex_unlock(&job_lock);
+    for (int i = 0; i < n_workers; i++) {
+        pthread_join(thread_workers[i], NULL);
+    }
+    free(thread_workers);
+    pthread_join(thread_listener, NULL); // Wakes up every LISTENER_POLL_INTERVAL to check for game over
+    if (lobby != NULL) {
+        pthread_join(thread_lobby, NULL); // Same as the listener, no arenas are created after this
+    }
+    if (snapshot != NULL) {
+        pthread_join(thread_snapshot, NULL);
+    }
+    if (metrics != NULL) {
+        pthread_join(thread_metrics, NULL);
+    }
+
+    // Send the game over state of the arenas that are still running
+    void* socket = create_publish_socket();
+    if (socket == NULL) {
+        perror("Failed to create publish socket");
+        return -1;
+    }
+    for (int i = 0; i < arena_count; i++) {
+        lock_arena(&arenas[i]);
+        if (!arenas[i].game_over_sent) {
+            arenas[i].game_over = 1;
+            send_game_over_state(&arenas[i], socket);
+            arenas[i].game_over_sent = 1;
+        }
+        unlock_arena(&arenas[i]);
+    }
+
+    // Stop the publisher after it forwards the game over states
+    zmq_send(socket, "", 0, 0);
+    pthread_join(thread_publisher, NULL);
+    zmq_close(socket);
+    zmq_close(publish_pull);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -23,8 +23,11 @@
 #include <unistd.h>
 #include <zmq.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "scores.pb-c.h"
 #include "config.h"
+#include "fair-queue.h"
 
 /**
  * @brief Structure representing a laser in the game.
@@ -38,6 +41,27 @@ typedef struct {
     double creation_time; // Seconds since epoch with microsecond precision
 } Laser_t;
 
+/**
+ * @struct TokenBucket_t
+ * @brief Token bucket limiting the rate of one type of command of a player.
+ *
+ * @var TokenBucket_t::tokens
+ * Tokens left at last_refill, each command takes one or more.
+ *
+ * @var TokenBucket_t::last_refill
+ * Timestamp of the last refill. 0 for a new player, whose bucket is then full.
+ */
+typedef struct {
+    double tokens;
+    double last_refill; // Seconds since epoch with microsecond precision
+} TokenBucket_t;
+
+// Types of commands with their own token bucket (see config.h for the rates)
+#define RATE_CLASS_MOVE 0
+#define RATE_CLASS_ZAP 1
+#define RATE_CLASS_OTHER 2 // Keepalives and resumes
+#define RATE_CLASSES 3
+
 /**
  * @struct Player_t
  * @brief Represents a player in the game.
@@ -66,11 +90,26 @@ typedef struct {
  * @var Player_t::last_stun_time
  * The timestamp of the last time the player was stunned. Seconds since epoch with microsecond precision
  *
+ * @var Player_t::last_seen
+ * The timestamp of the last valid request of the player. Seconds since epoch with microsecond precision
+ *
  * @var Player_t::session_token
  * A 32-character hexadecimal session token used to identify the player's session.
  *
  * @var Player_t::laser
  * The laser associated with the player.
+ *
+ * @var Player_t::buckets
+ * Token buckets of the commands of the player, one per RATE_CLASS.
+ *
+ * @var Player_t::requests
+ * Number of authenticated requests of the session.
+ *
+ * @var Player_t::throttled
+ * Number of commands of the session rejected with ERR_THROTTLED.
+ *
+ * @var Player_t::last_command
+ * Largest command ID applied (see COMMAND_TAG), published with the player. 0 if the client does not tag its commands.
  */
 typedef struct {
     char id;
@@ -80,8 +119,13 @@ typedef struct {
     int score;
     double last_fire_time; // Seconds since epoch with microsecond precision
     double last_stun_time; // Seconds since epoch with microsecond precision
+    double last_seen; // Seconds since epoch with microsecond precision
     char session_token[33]; // 32-char hex token + null terminator
     Laser_t laser; //The laser of the player 
+    TokenBucket_t buckets[RATE_CLASSES];
+    unsigned long requests;
+    unsigned long throttled;
+    unsigned long last_command;
 } Player_t;
 
 /**
@@ -95,6 +139,122 @@ typedef struct {
     int active;
 } Alien_t;
 
+/**
+ * @struct Arena_t
+ * @brief An independent game hosted by the server.
+ *
+ * Each arena has its own players, aliens and game over state. All the fields
+ * are protected by the arena lock, except the ones noted as owned by the tick thread.
+ *
+ * @var Arena_t::id
+ * Index of the arena in the server, used to route commands and at the start of the envelope of its published messages.
+ *
+ * @var Arena_t::game_over
+ * Set when all aliens of the arena are destroyed or the server is ending.
+ *
+ * @var Arena_t::game_over_sent
+ * Set once the game over state of the arena was published, the arena is no longer updated.
+ * Written with the arena lock held, read without it by the tick thread.
+ *
+ * @var Arena_t::last_alien_move_time
+ * Timestamp of the last alien movement job queued for the arena. Owned by the tick thread.
+ *
+ * @var Arena_t::home_worker
+ * Worker whose deque receives the jobs of the arena. Set by server_logic before the threads start.
+ *
+ * @var Arena_t::update_queued
+ * Set while an update job of the arena is queued or running. Protected by the deque lock of the home worker.
+ *
+ * @var Arena_t::aliens_queued
+ * Set while an alien movement job of the arena is queued or running. Protected by the deque lock of the home worker.
+ *
+ * @var Arena_t::missed_deadlines
+ * Number of jobs of the arena that finished after their deadline.
+ *
+ * @var Arena_t::skipped_ticks
+ * Number of ticks where the update job of the arena was not queued because the previous one
+ * was still queued or running. Protected by the deque lock of the home worker.
+ *
+ * @var Arena_t::sessions_reaped
+ * Number of players removed because they sent no request for SESSION_TIMEOUT seconds.
+ *
+ * @var Arena_t::throttled
+ * Number of commands of the players of the arena rejected with ERR_THROTTLED, including the players that left.
+ *
+ * @var Arena_t::lock_time
+ * Timestamp of when the lock was taken by lock_arena, in nanoseconds (see stage_time). Owned by the lock holder.
+ *
+ * @var Arena_t::state_seq
+ * Sequence number of the last message of the arena on the game state publisher.
+ *
+ * @var Arena_t::score_seq
+ * Sequence number of the last message of the arena on the scores publisher.
+ */
+typedef struct {
+    int id;
+    Player_t players[MAX_PLAYERS];
+    Alien_t aliens[MAX_ALIENS];
+    int game_over;
+    atomic_int game_over_sent;
+    double last_update_time; // Seconds since epoch with microsecond precision
+    double last_kill_time; // Seconds since epoch with microsecond precision
+    double last_alien_move_time; // Seconds since epoch with microsecond precision
+    int home_worker;
+    int update_queued;
+    int aliens_queued;
+    unsigned long jobs_run;
+    unsigned long missed_deadlines;
+    unsigned long skipped_ticks;
+    double max_lateness; // Seconds the latest job finished after its deadline
+    unsigned long sessions_reaped;
+    unsigned long throttled;
+    unsigned long long lock_time;
+    unsigned long state_seq;
+    unsigned long score_seq;
+    pthread_mutex_t lock; // Mutex used to synchronize access to the arena
+} Arena_t;
+
+// Publisher sockets of the messages sent to the publisher thread
+#define PUBLISH_GAME_STATE 'G' // Game state publisher, for the displays
+#define PUBLISH_SCORES 'S' // Score publisher, for the high scores application
+
+// Types of the jobs run by the worker threads
+#define JOB_UPDATE 0 // Runs reap_stale_sessions and update_game_state for an arena
+#define JOB_ALIENS 1 // Runs update_alien_positions for an arena
+
+/**
+ * @brief A job for the worker threads, queued by the tick thread.
+ */
+typedef struct {
+    Arena_t* arena;
+    int type; // JOB_UPDATE or JOB_ALIENS
+    double deadline; // Seconds since epoch, the next tick of the arena
+} Job_t;
+
+/**
+ * @struct Worker_t
+ * @brief A worker thread and its deque of jobs.
+ *
+ * The tick thread pushes the jobs of an arena to the deque of its home worker.
+ * Jobs are taken from the head, which holds the earliest deadline, both by the owner
+ * and by idle workers stealing from a busy one. All fields are protected by the deque lock.
+ *
+ * @var Worker_t::jobs
+ * Circular buffer of jobs. Each arena has at most one job of each type queued, so it never overflows.
+ *
+ * @var Worker_t::steals
+ * Number of jobs this worker took from the deques of other workers.
+ */
+typedef struct {
+    int id;
+    Job_t jobs[MAX_ARENAS * 2];
+    int head;
+    int count;
+    unsigned long jobs_run;
+    unsigned long steals;
+    pthread_mutex_t lock; // Mutex used to synchronize access to the deque
+} Worker_t;
+
 
 /**
  * @brief Returns the current time in seconds since the epoch.
@@ -112,50 +272,73 @@ double get_time_in_seconds();
  */
 int has_duration_passed(double start_time, double duration);
 
+/**
+ * @brief Returns the game ticks left until the specified duration has passed since the start time.
+ *
+ * @param start_time The start time in seconds.
+ * @param duration The duration in seconds.
+ * @return The ticks left, rounded up, 0 if the duration has passed.
+ */
+int remaining_ticks(double start_time, double duration);
+
 /**
  * @brief Finds a player by their ID.
  *
+ * @param arena The arena of the player.
  * @param id The ID of the player to find.
  * @return A pointer to the player with the specified ID, or NULL if not found.
  */
-Player_t* find_by_id(const char id);
+Player_t* find_by_id(Arena_t* arena, const char id);
 
 /**
  * @brief Finds a player by their session token.
  *
+ * @param arena The arena of the player.
  * @param session_token The session token of the player to find.
  * @return A pointer to the player with the specified session token, or NULL if not found.
  */
-Player_t* find_by_session_token(const char* session_token);
+Player_t* find_by_session_token(Arena_t* arena, const char* session_token);
 
 /**
  * @brief Finds a player by their zone.
  *
+ * @param arena The arena of the player.
  * @param zone The zone of the player to find.
  * @return A pointer to the player in the specified zone, or NULL if not found.
  */
-Player_t* find_by_zone(const char zone);
+Player_t* find_by_zone(Arena_t* arena, const char zone);
 
 /**
- * @brief Generates a random session token.
+ * @brief Generates a random session token that encodes the arena of the player.
  *
  * @param token A pointer to a character array where the generated token will be stored.
+ * @param arena The arena of the player.
  */
-void generate_session_token(char* token);
+void generate_session_token(char* token, int arena);
+
+/**
+ * @brief Returns the arena encoded in a session token.
+ *
+ * @param token The session token.
+ * @return The arena ID, or -1 if the token does not start with an arena.
+ */
+int session_token_arena(const char* token);
 
 /**
  * @brief Assigns a unique player ID.
  *
+ * @param arena The arena the player joins.
  * @return A unique player ID, or '\0' if no IDs are available.
  */
-char assign_player_id();
+char assign_player_id(Arena_t* arena);
 
 /**
  * @brief Selects a random unoccupied zone.
  *
+ * @param arena The arena the player joins.
  * @return An integer representing the randomly selected unoccupied zone.
  */
-int get_random_zone();
+int get_random_zone(Arena_t* arena);
 
 /**
  * @brief Clears the player's data.
@@ -167,14 +350,71 @@ void clear_player(Player_t *player);
 /**
  * @brief Checks if all aliens have been destroyed.
  *
+ * @param arena The arena to check.
  * @return 1 if all aliens are inactive, 0 if at least one alien is still active.
  */
-int all_aliens_destroyed();
+int all_aliens_destroyed(Arena_t* arena);
+
+/**
+ * @brief Initializes the game state of an arena.
+ *
+ * @param arena The arena to initialize.
+ * @param id The index of the arena in the server.
+ * @return 0 on success, -1 if the arena lock could not be initialized.
+ */
+int initialize_arena(Arena_t* arena, int id);
+
+/**
+ * @brief Takes the lock of an arena, recording the time waited for it.
+ *
+ * @param arena The arena.
+ */
+void lock_arena(Arena_t* arena);
+
+/**
+ * @brief Releases the lock of an arena, recording the time it was held.
+ *
+ * @param arena The arena, locked with lock_arena.
+ */
+void unlock_arena(Arena_t* arena);
+
+/**
+ * @brief Finds an arena by its ID.
+ *
+ * @param id The ID of the arena.
+ * @return A pointer to the arena, or NULL if there is no arena with that ID.
+ */
+Arena_t* find_arena(int id);
+
+/**
+ * @brief Finds the first running arena with space for another player.
+ *
+ * @return A pointer to the arena, or NULL if all arenas are full or over.
+ */
+Arena_t* find_free_arena();
+
+/**
+ * @brief Counts the players connected to an arena.
+ *
+ * @param arena The arena to check.
+ * @return The number of players in the arena.
+ */
+int count_players(Arena_t* arena);
+
+/**
+ * @brief Creates a new arena.
+ *
+ * @param home_worker The worker whose deque receives the jobs of the arena.
+ * @return A pointer to the new arena, or NULL if there are already MAX_ARENAS arenas.
+ */
+Arena_t* create_arena(int home_worker);
 
 /**
- * @brief Initializes the game state.
+ * @brief Chooses the arena of a player connecting through the lobby, creating one if all are full.
+ *
+ * @return A pointer to the arena, or NULL if all arenas are full and no more can be created.
  */
-void initialize_game_state();
+Arena_t* find_lobby_arena();
 
 /**
  * @brief Checks if the player's move in the specified direction is valid.
@@ -185,6 +425,69 @@ void initialize_game_state();
  */
 int is_valid_move(Player_t* player, const char direction);
 
+/**
+ * @brief Writes the reply to a command of a player: the result, the score, the laser cooldown and stun ticks left
+ * and the sequence number of the last game state published for the arena.
+ *
+ * @param response Where the reply is written, BUFFER_SIZE bytes.
+ * @param code The result of the command, RESP_OK or an error code.
+ * @param arena The arena of the player.
+ * @param player The player.
+ * @return The length of the reply.
+ */
+int format_player_reply(char* response, int code, Arena_t* arena, Player_t* player);
+
+/**
+ * @brief Takes tokens from a token bucket of a player, for a command of the player.
+ *
+ * @param arena The arena of the player.
+ * @param player The player.
+ * @param rate_class The class of the command, RATE_CLASS_MOVE, RATE_CLASS_ZAP or RATE_CLASS_OTHER.
+ * @param cost The tokens of the command.
+ * @return 1 if the command can be applied, 0 if it is throttled.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
+ */
+int take_tokens(Arena_t* arena, Player_t* player, int rate_class, double cost);
+
+/**
+ * @brief Moves a player, the arguments of a MOVE command.
+ *
+ * @param arena The arena of the player.
+ * @param player The player, already authenticated.
+ * @param args The arguments of the command, "<direction> [steps]".
+ * @return RESP_OK if the player moved, or the error code.
+ */
+int move_player(Arena_t* arena, Player_t* player, const char* args);
+
+/**
+ * @brief Fires the laser of a player, a ZAP command.
+ *
+ * @param arena The arena of the player.
+ * @param player The player, already authenticated.
+ * @return RESP_OK if the laser was fired, or the error code.
+ */
+int zap_player(Arena_t* arena, Player_t* player);
+
+/**
+ * @brief Records the ID of a command applied to a player, published in the next game states.
+ *
+ * @param player The player.
+ * @param command_id The ID of the tag of the command, 0 if it had none.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
+ */
+void record_command(Player_t* player, unsigned long command_id);
+
+/**
+ * @brief Finds the zone of a player from its position.
+ *
+ * @param x The x-coordinate of the player.
+ * @param y The y-coordinate of the player.
+ * @return The zone, or 0 if the position is not in any zone.
+ */
+int zone_from_position(int x, int y);
+
 /**
  * @brief Initializes the player's position based on their zone.
  *
@@ -193,70 +496,184 @@ int is_valid_move(Player_t* player, const char direction);
 void initialize_player_position(Player_t* player);
 
 /**
- * @brief Processes a message from a client and generates a response.
+ * @brief Processes a message from a client for the given arena and generates a response.
+ *
+ * @param arena The arena the message is for.
+ * @param message The message received from the client.
+ * @param response The response to be sent back to the client.
+ * @return 0 if the game state was not updated, 1 if it was updated.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
+ */
+int process_arena_message(Arena_t* arena, char* message, char* response);
+
+/**
+ * @brief Routes a message from a client to its arena, processes it and generates a response.
+ *
+ * If the game state of the arena was updated, the new state is published.
  *
  * @param message The message received from the client.
  * @param response The response to be sent back to the client.
+ * @param socket The PUSH socket of the calling thread, connected to the publisher thread.
  * @return 0 if the game state was not updated, 1 if it was updated.
  */
-int process_client_message(char* message, char* response);
+int process_client_message(char* message, char* response, void* socket);
 
 /**
  * @brief Checks for collisions between lasers and aliens or players.
+ *
+ * @param arena The arena to check.
  */
-void check_laser_collisions();
+void check_laser_collisions(Arena_t* arena);
 
 /**
  * @brief Updates the positions of active aliens.
+ *
+ * @param arena The arena to update.
  */
-void update_alien_positions();
+void update_alien_positions(Arena_t* arena);
 
 /**
  * @brief Updates the game state.
+ *
+ * @param arena The arena to update.
+ */
+void update_game_state(Arena_t* arena);
+
+/**
+ * @brief Removes the players of an arena that sent no request for SESSION_TIMEOUT seconds.
+ *
+ * @param arena The arena to check.
+ * @param now The current time, seconds since epoch.
+ * @return The number of players removed.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
+ */
+int reap_stale_sessions(Arena_t* arena, double now);
+
+/**
+ * @brief Sends a message of an arena to the publisher thread, with its envelope.
+ *
+ * @param socket The PUSH socket of the calling thread.
+ * @param channel PUBLISH_GAME_STATE or PUBLISH_SCORES, selects the publisher socket.
+ * @param arena The arena the message belongs to.
+ * @param type The message type, one of the MSG_TYPE_* constants.
+ * @param data The message.
+ * @param len The length of the message in bytes.
+ */
+void publish_message(void* socket, char channel, Arena_t* arena, char type, const void* data, size_t len);
+
+/**
+ * @brief Builds the current game state message of an arena.
+ *
+ * @param arena The arena.
+ * @param message Where the message is written, BUFFER_SIZE bytes.
+ */
+void build_game_state(Arena_t* arena, char* message);
+
+/**
+ * @brief Builds the game over message of an arena.
+ *
+ * @param arena The arena.
+ * @param message Where the message is written, BUFFER_SIZE bytes.
  */
-void update_game_state();
+void build_game_over_state(Arena_t* arena, char* message);
 
 /**
- * @brief Sends the current game state to all subscribers.
+ * @brief Sends the current game state of an arena to all subscribers.
+ *
+ * @param arena The arena to send.
+ * @param socket The PUSH socket of the calling thread.
  */
-void send_game_state();
+void send_game_state(Arena_t* arena, void* socket);
 
 /**
- * @brief Sends score updates for all players.
+ * @brief Sends score updates for all players of an arena.
+ *
+ * @param arena The arena to send.
+ * @param socket The PUSH socket of the calling thread.
  */
-void send_score_updates();
+void send_score_updates(Arena_t* arena, void* socket);
 
 /**
- * @brief Sends the game over state to all subscribers.
+ * @brief Sends the game over state of an arena to all subscribers.
+ *
+ * @param arena The arena to send.
+ * @param socket The PUSH socket of the calling thread.
  */
-void send_game_over_state();
+void send_game_over_state(Arena_t* arena, void* socket);
 
 /**
- * @brief Thread routine for alien movement and game state updates.
+ * @brief Publishes the game state and scores of an arena, and its game over state if the game ended.
+ *
+ * @param arena The arena to publish.
+ * @param socket The PUSH socket of the calling thread.
+ *
+ * @note This function is not thread-safe and should be called with the arena lock held.
+ */
+void publish_arena_state(Arena_t* arena, void* socket);
+
+/**
+ * @brief Thread routine that queues the update and alien movement jobs of every arena at a fixed rate.
  *
  * @param arg Unused parameter.
  * @return None.
  */
-void* thread_alien_routine(void* arg);
+void* thread_tick_routine(void* arg);
 
 /**
- * @brief Thread routine to periodically update the game state.
+ * @brief Thread routine of the worker pool, runs the jobs of its deque and steals from the others when idle.
  *
- * @param arg Unused parameter.
+ * @param arg Pointer to the Worker_t of the thread.
  * @return None.
  */
-void* thread_updater_routine(void* arg);
+void* thread_worker_routine(void* arg);
+
+/**
+ * @brief Processes a request of an astronaut and sends the reply.
+ *
+ * @param requests The request, followed by the requests collapsed with it, closed once replied.
+ * @param count The number of requests.
+ * @param socket The PUSH socket of the listener thread, connected to the publisher thread.
+ */
+void serve_request(Request_t* requests, int count, void* socket);
 
 /**
  * @brief Thread routine for listening to client messages and processing them.
  *
+ * Serves the connections with requests waiting in turn, one request each, high priority lane first.
+ *
  * @param arg Unused parameter.
  * @return None.
  */
 void* thread_listener_routine(void* arg);
 
 /**
- * @brief Thread routine for publishing game state and score updates.
+ * @brief Thread routine of the lobby, assigns the connecting players to arenas.
+ *
+ * @param arg Unused parameter.
+ * @return None.
+ */
+void* thread_lobby_routine(void* arg);
+
+/**
+ * @brief Thread routine of the snapshot service, sends the current state of an arena to late joiners.
+ *
+ * @param arg Unused parameter.
+ * @return None.
+ */
+void* thread_snapshot_routine(void* arg);
+
+/**
+ * @brief Thread routine of the metrics service, sends the counters of the server to monitoring.
+ *
+ * @param arg Unused parameter.
+ * @return None.
+ */
+void* thread_metrics_routine(void* arg);
+
+/**
+ * @brief Thread routine that owns the publisher sockets and forwards the updates of the other threads.
  *
  * @param arg Unused parameter.
  * @return void* Always returns NULL.
@@ -269,21 +686,46 @@ void* thread_publisher_routine(void* arg);
 void end_server_logic();
 
 /**
- * @brief Retrieves the current game state from the server.
+ * @brief Sets the number of arenas hosted by the server.
+ *
+ * Must be called before server_logic.
+ *
+ * @param count The number of arenas created at startup, between 1 and MAX_ARENAS.
+ */
+void set_server_arena_count(int count);
+
+/**
+ * @brief Sets the number of worker threads that update the arenas.
+ *
+ * Must be called before server_logic.
+ *
+ * @param count The number of workers, 0 to use one per online core.
+ */
+void set_server_worker_count(int count);
+
+/**
+ * @brief Prints the jobs run by each worker, the deadlines missed, sessions reaped and commands throttled by each arena,
+ * the requests and throttled commands of each connected player, and the time the requests waited in each priority lane.
+ *
+ * Must be called after server_logic returns.
  *
- * @param buffer A pointer to a character array where the game state string will be copied.
+ * @param out The stream where the report is written.
  */
-void get_server_game_state(char* buffer);
+void print_scheduler_report(FILE* out);
 
 /**
  * @brief Main server logic function that initializes mutexes, condition variables,
  *        game state, and creates necessary threads for game operation.
  *
- * @param responder Pointer to the responder object.
+ * @param context The ZeroMQ context, used to create the internal sockets.
+ * @param responder Pointer to the ROUTER socket of the astronauts, which connect with REQ sockets.
  * @param publisher Pointer to the publisher object.
  * @param score_publisher Pointer to the score publisher object.
+ * @param lobby_responder Pointer to the lobby responder object, or NULL to run without a lobby.
+ * @param snapshot_responder Pointer to the snapshot responder object, or NULL to run without the snapshot service.
+ * @param metrics_responder Pointer to the metrics responder object, or NULL to run without the metrics service.
  * @return int Returns 0 on success, -1 on failure.
  */
-int server_logic(void* responder, void* publisher, void* score_publisher);
+int server_logic(void* context, void* responder, void* publisher, void* score_publisher, void* lobby_responder, void* snapshot_responder, void* metrics_responder);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,40 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: heartbeat.c
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Liveness of the connections between the server and the clients, with the
+ * heartbeats of the ZeroMQ protocol (ZMTP) on the data sockets themselves.
+ */
+
+#include <zmq.h>
+#include "config.h"
+#include "heartbeat.h"
+
+
+/**
+ * @brief Enables the ZMTP heartbeats of a socket.
+ *
+ * Each side sends a PING on connections idle for HEARTBEAT_INTERVAL and closes the
+ * connections without traffic for HEARTBEAT_TIMEOUT. The peer is also told to close
+ * the connection after HEARTBEAT_TIMEOUT, so a dead server or client is detected on
+ * both sides without messages from the application. ZeroMQ then frees the queues of
+ * the connection, or reconnects if the socket was connected.
+ * The options only apply to the connections made after they are set.
+ *
+ * @param socket The ZeroMQ socket.
+ */
+void set_socket_heartbeat(void* socket) {
+    int interval = HEARTBEAT_INTERVAL;
+    int timeout = HEARTBEAT_TIMEOUT;
+    zmq_setsockopt(socket, ZMQ_HEARTBEAT_IVL, &interval, sizeof(interval));
+    zmq_setsockopt(socket, ZMQ_HEARTBEAT_TIMEOUT, &timeout, sizeof(timeout));
+    zmq_setsockopt(socket, ZMQ_HEARTBEAT_TTL, &timeout, sizeof(timeout));
+}
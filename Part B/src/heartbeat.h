@@ -0,0 +1,28 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: heartbeat.h
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Header file for heartbeat.c
+ */
+
+#ifndef HEARTBEAT_H
+#define HEARTBEAT_H
+
+/**
+ * @brief Enables the ZMTP heartbeats of a socket.
+ *
+ * Must be called before the socket is bound or connected.
+ *
+ * @param socket The ZeroMQ socket.
+ */
+void set_socket_heartbeat(void* socket);
+
+#endif
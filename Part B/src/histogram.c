@@ -0,0 +1,129 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: histogram.c
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Histograms of latencies with a bounded relative error and a fixed size, in the style of
+ * HdrHistogram. The values below HISTOGRAM_SUB_BUCKETS have a bucket each, the larger ones
+ * share a bucket with the values that have the same HISTOGRAM_SUB_BITS + 1 leading bits.
+ */
+
+#include "histogram.h"
+
+
+/**
+ * @brief Returns the bucket of a value.
+ *
+ * The bucket is found from the position of the leading bit of the value and the bits after it.
+ *
+ * @param value The value.
+ * @return The index of the bucket in Histogram_t::counts.
+ */
+int histogram_bucket(unsigned long long value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int magnitude = 63 - __builtin_clzll(value); // Position of the leading bit
+    if (magnitude >= HISTOGRAM_MAX_BITS) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    int shift = magnitude - HISTOGRAM_SUB_BITS;
+    int sub_bucket = (int)(value >> shift) - HISTOGRAM_SUB_BUCKETS;
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+/**
+ * @brief Returns the largest value counted in a bucket.
+ *
+ * @param bucket The index of the bucket.
+ * @return The largest value of the bucket.
+ */
+unsigned long long histogram_bucket_max(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return (unsigned long long)bucket;
+    }
+    int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    int sub_bucket = bucket % HISTOGRAM_SUB_BUCKETS;
+    unsigned long long lowest = (unsigned long long)(HISTOGRAM_SUB_BUCKETS + sub_bucket) << shift;
+    return lowest + (1ULL << shift) - 1;
+}
+
+/**
+ * @brief Records a value.
+ *
+ * @param histogram The histogram.
+ * @param value The value.
+ */
+void histogram_record(Histogram_t* histogram, unsigned long long value) {
+    histogram->counts[histogram_bucket(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+/**
+ * @brief Adds the values of a histogram to another one.
+ *
+ * @param dst The histogram where the values are added.
+ * @param src The histogram added.
+ */
+void histogram_merge(Histogram_t* dst, const Histogram_t* src) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+/**
+ * @brief Returns a percentile of the values recorded.
+ *
+ * @param histogram The histogram.
+ * @param percentile The percentile, between 0 and 1.
+ * @return The largest value of the bucket of the percentile, at most the largest value recorded, 0 if empty.
+ */
+unsigned long long histogram_percentile(const Histogram_t* histogram, double percentile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+    // Rank of the value of the percentile, from 1
+    unsigned long rank = (unsigned long)(percentile * histogram->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    unsigned long seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            unsigned long long value = histogram_bucket_max(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/**
+ * @brief Returns the mean of the values recorded.
+ *
+ * @param histogram The histogram.
+ * @return The mean, 0 if empty.
+ */
+double histogram_mean(const Histogram_t* histogram) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+    return (double)histogram->sum / histogram->count;
+}
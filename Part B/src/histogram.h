@@ -0,0 +1,100 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: histogram.h
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Header file for histogram.c
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+// Buckets of the histograms: each power of two is split in HISTOGRAM_SUB_BUCKETS linear buckets,
+// so a value is known within 1/HISTOGRAM_SUB_BUCKETS of itself whatever its magnitude
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 36 // Values up to 2^36 (68 s in nanoseconds), larger ones are counted in the last bucket
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * @struct Histogram_t
+ * @brief Histogram of values with a bounded relative error, like HdrHistogram.
+ *
+ * Recording a value is an increment, without allocation or search. A zeroed histogram is empty.
+ *
+ * @var Histogram_t::counts
+ * Values recorded in each bucket, see histogram_bucket.
+ *
+ * @var Histogram_t::count
+ * Number of values recorded.
+ *
+ * @var Histogram_t::sum
+ * Sum of the values recorded, for the mean.
+ *
+ * @var Histogram_t::max
+ * Largest value recorded, exact.
+ */
+typedef struct {
+    unsigned long counts[HISTOGRAM_BUCKETS];
+    unsigned long count;
+    unsigned long long sum;
+    unsigned long long max;
+} Histogram_t;
+
+/**
+ * @brief Returns the bucket of a value.
+ *
+ * @param value The value.
+ * @return The index of the bucket in Histogram_t::counts.
+ */
+int histogram_bucket(unsigned long long value);
+
+/**
+ * @brief Returns the largest value counted in a bucket.
+ *
+ * @param bucket The index of the bucket.
+ * @return The largest value of the bucket.
+ */
+unsigned long long histogram_bucket_max(int bucket);
+
+/**
+ * @brief Records a value.
+ *
+ * @param histogram The histogram.
+ * @param value The value.
+ */
+void histogram_record(Histogram_t* histogram, unsigned long long value);
+
+/**
+ * @brief Adds the values of a histogram to another one.
+ *
+ * @param dst The histogram where the values are added.
+ * @param src The histogram added.
+ */
+void histogram_merge(Histogram_t* dst, const Histogram_t* src);
+
+/**
+ * @brief Returns a percentile of the values recorded.
+ *
+ * @param histogram The histogram.
+ * @param percentile The percentile, between 0 and 1.
+ * @return The largest value of the bucket of the percentile, at most the largest value recorded, 0 if empty.
+ */
+unsigned long long histogram_percentile(const Histogram_t* histogram, double percentile);
+
+/**
+ * @brief Returns the mean of the values recorded.
+ *
+ * @param histogram The histogram.
+ * @return The mean, 0 if empty.
+ */
+double histogram_mean(const Histogram_t* histogram);
+
+#endif
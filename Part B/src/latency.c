@@ -0,0 +1,200 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: latency.c
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * End to end latency of the commands of the astronaut, as seen by the player.
+ * Each command is sent with a tag that has its ID (see COMMAND_TAG), and the server publishes the
+ * largest ID applied with the player. Measured from the key press:
+ * - ack: the reply to the command arrived
+ * - publish: a game state that includes the command arrived
+ * - render: that game state was drawn on the screen
+ * All times come from the clock of the client, so the clocks of client and server need not agree.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include "config.h"
+#include "client-logic.h"
+#include "histogram.h"
+#include "state-parser.h"
+#include "latency.h"
+
+// Commands sent and not yet drawn, the command with ID n is in slot n % MAX_TRACKED_COMMANDS
+TrackedCommand_t tracked_commands[MAX_TRACKED_COMMANDS];
+unsigned long next_command_id = 1;
+unsigned long states_received = 0; // Game states received, numbered like the frame hook of the display
+char latency_player_id = '\0';
+
+// Latencies in nanoseconds
+Histogram_t ack_latency;
+Histogram_t publish_latency;
+Histogram_t render_latency;
+unsigned long commands_dropped = 0; // Overwritten by newer commands before being drawn
+unsigned long commands_rejected = 0; // Not applied by the server, only their ack is measured
+
+pthread_mutex_t latency_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * @brief Records the time since a command was input.
+ *
+ * @param histogram The histogram of the latency.
+ * @param command The command.
+ * @param now The current time, from client_time.
+ *
+ * @note Must be called with latency_lock held.
+ */
+void record_latency(Histogram_t* histogram, const TrackedCommand_t* command, double now) {
+    double latency = now - command->input_time;
+    histogram_record(histogram, latency > 0 ? (unsigned long long)(latency * 1e9) : 0);
+}
+
+/**
+ * @brief Starts measuring the commands of an astronaut, once the client is connected.
+ *
+ * Commands sent before a reconnection are dropped, the new player has no command applied.
+ *
+ * @param id The astronaut of the client.
+ */
+void latency_start(char id) {
+    pthread_mutex_lock(&latency_lock);
+    latency_player_id = id;
+    memset(tracked_commands, 0, sizeof(tracked_commands));
+    pthread_mutex_unlock(&latency_lock);
+}
+
+/**
+ * @brief Records a command about to be sent and returns the ID of its tag.
+ *
+ * @param input_time Time the first key of the command was pressed, from client_time.
+ * @return The ID of the command, never 0.
+ */
+unsigned long latency_command_sent(double input_time) {
+    pthread_mutex_lock(&latency_lock);
+    unsigned long id = next_command_id++;
+    TrackedCommand_t* command = &tracked_commands[id % MAX_TRACKED_COMMANDS];
+    if (command->id != 0) {
+        commands_dropped++;
+    }
+    command->id = id;
+    command->input_time = input_time;
+    command->acked = 0;
+    command->state = 0;
+    pthread_mutex_unlock(&latency_lock);
+    return id;
+}
+
+/**
+ * @brief Records the reply to a command, the input to ack latency.
+ *
+ * A command that was not applied is dropped, the server does not publish its ID. It would
+ * otherwise be counted as published with the next command applied, whose ID is larger.
+ *
+ * @param id The ID of the command.
+ * @param applied 1 if the command was applied, 0 if the server rejected it.
+ */
+void latency_command_acked(unsigned long id, int applied) {
+    pthread_mutex_lock(&latency_lock);
+    TrackedCommand_t* command = &tracked_commands[id % MAX_TRACKED_COMMANDS];
+    if (command->id == id && !command->acked) {
+        command->acked = 1;
+        record_latency(&ack_latency, command, client_time());
+        if (!applied) {
+            command->id = 0;
+            commands_rejected++;
+        }
+    }
+    pthread_mutex_unlock(&latency_lock);
+}
+
+/**
+ * @brief Records the commands included in a game state received from the server, the input to publish latency.
+ *
+ * The game state includes all the commands up to the ID published with the player,
+ * the IDs are sent in order and the server keeps the largest.
+ * Must be called for every game state, before it is given to set_display_game_state, so that
+ * its number is the one given to the frame hook and the commands are marked before it is drawn.
+ *
+ * @param msg The game state message, does not need to be null terminated.
+ * @param len The length of the message in bytes.
+ */
+void latency_state_received(const char* msg, size_t len) {
+    pthread_mutex_lock(&latency_lock);
+    unsigned long state = ++states_received;
+    if (latency_player_id == '\0') {
+        // Not connected yet
+        pthread_mutex_unlock(&latency_lock);
+        return;
+    }
+
+    unsigned long applied = 0;
+    StateParser_t parser;
+    StateEntry_t entry;
+    state_parser_init(&parser, msg, len);
+    while (state_parser_next(&parser, &entry)) {
+        if (entry.type == CMD_PLAYER && entry.id == latency_player_id && entry.command > 0) {
+            applied = entry.command;
+        }
+    }
+
+    double now = client_time();
+    for (int i = 0; i < MAX_TRACKED_COMMANDS; i++) {
+        TrackedCommand_t* command = &tracked_commands[i];
+        if (command->id != 0 && command->id <= applied && command->state == 0) {
+            command->state = state;
+            record_latency(&publish_latency, command, now);
+        }
+    }
+    pthread_mutex_unlock(&latency_lock);
+}
+
+/**
+ * @brief Records the commands of the game states drawn on the screen, the input to render latency.
+ *
+ * The commands drawn are done and their slots are freed.
+ *
+ * @param state The number of the last game state drawn.
+ */
+void latency_state_drawn(unsigned long state) {
+    pthread_mutex_lock(&latency_lock);
+    double now = client_time();
+    for (int i = 0; i < MAX_TRACKED_COMMANDS; i++) {
+        TrackedCommand_t* command = &tracked_commands[i];
+        if (command->id != 0 && command->state != 0 && command->state <= state) {
+            record_latency(&render_latency, command, now);
+            command->id = 0;
+        }
+    }
+    pthread_mutex_unlock(&latency_lock);
+}
+
+/**
+ * @brief Prints the distributions of the input to ack, publish and render latencies.
+ *
+ * @param out The stream to print to.
+ */
+void print_latency_report(FILE* out) {
+    static const char* names[] = { "input_to_ack", "input_to_publish", "input_to_render" };
+    Histogram_t* histograms[] = { &ack_latency, &publish_latency, &render_latency };
+
+    pthread_mutex_lock(&latency_lock);
+    fprintf(out, "Latency              Count   Mean (ms)    p50 (ms)    p90 (ms)    p99 (ms)    Max (ms)\n");
+    for (int i = 0; i < 3; i++) {
+        Histogram_t* histogram = histograms[i];
+        fprintf(out, "  %-16s  %7lu  %10.2f  %10.2f  %10.2f  %10.2f  %10.2f\n", names[i], histogram->count,
+                histogram_mean(histogram) / 1e6, histogram_percentile(histogram, 0.5) / 1e6,
+                histogram_percentile(histogram, 0.9) / 1e6, histogram_percentile(histogram, 0.99) / 1e6,
+                histogram->max / 1e6);
+    }
+    fprintf(out, "Commands sent: %lu, rejected: %lu, dropped before being drawn: %lu\n", next_command_id - 1,
+            commands_rejected, commands_dropped);
+    pthread_mutex_unlock(&latency_lock);
+}
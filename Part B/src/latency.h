@@ -0,0 +1,97 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: latency.h
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Header file for latency.c
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define MAX_TRACKED_COMMANDS 256 // Commands waiting to be drawn, the oldest are dropped when more are sent
+
+/**
+ * @struct TrackedCommand_t
+ * @brief A command sent with a tag whose latency is being measured.
+ *
+ * @var TrackedCommand_t::id
+ * ID of the command, sent in its tag. 0 when the slot is free.
+ *
+ * @var TrackedCommand_t::input_time
+ * Time the first key of the command was pressed, from client_time.
+ *
+ * @var TrackedCommand_t::acked
+ * Set once the reply to the command arrived.
+ *
+ * @var TrackedCommand_t::state
+ * Number of the first game state that includes the command, counted like the frame hook of the display
+ * (see set_display_frame_hook). 0 while no such game state arrived.
+ */
+typedef struct {
+    unsigned long id;
+    double input_time;
+    int acked;
+    unsigned long state;
+} TrackedCommand_t;
+
+/**
+ * @brief Starts measuring the commands of an astronaut, once the client is connected.
+ *
+ * @param id The astronaut of the client.
+ */
+void latency_start(char id);
+
+/**
+ * @brief Records a command about to be sent and returns the ID of its tag.
+ *
+ * @param input_time Time the first key of the command was pressed, from client_time.
+ * @return The ID of the command, never 0.
+ */
+unsigned long latency_command_sent(double input_time);
+
+/**
+ * @brief Records the reply to a command, the input to ack latency.
+ *
+ * A command that was not applied is dropped, the server does not publish its ID.
+ *
+ * @param id The ID of the command.
+ * @param applied 1 if the command was applied, 0 if the server rejected it.
+ */
+void latency_command_acked(unsigned long id, int applied);
+
+/**
+ * @brief Records the commands included in a game state received from the server, the input to publish latency.
+ *
+ * Must be called for every game state, before it is given to set_display_game_state.
+ *
+ * @param msg The game state message, does not need to be null terminated.
+ * @param len The length of the message in bytes.
+ */
+void latency_state_received(const char* msg, size_t len);
+
+/**
+ * @brief Records the commands of the game states drawn on the screen, the input to render latency.
+ *
+ * @param state The number of the last game state drawn.
+ */
+void latency_state_drawn(unsigned long state);
+
+/**
+ * @brief Prints the distributions of the input to ack, publish and render latencies.
+ *
+ * @param out The stream to print to.
+ */
+void print_latency_report(FILE* out);
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: prediction.c
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Client side prediction of the moves of the astronaut, drawn before the server publishes them.
+ * The published game states are authoritative: the moves are replayed over the position of the
+ * last game state until a game state that includes them arrives.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include "config.h"
+#include "game-logic.h"
+#include "space-display.h"
+#include "state-parser.h"
+#include "prediction.h"
+
+// Moves kept until a game state includes them, one request in flight and the ones replied within a tick
+#define MAX_PENDING_MOVES (2 * MAX_BATCH_COMMANDS)
+
+/**
+ * @struct PendingMove_t
+ * @brief A move sent to the server that is not yet in a game state.
+ *
+ * @var PendingMove_t::direction
+ * Direction of the move (MOVE_UP, MOVE_DOWN, MOVE_LEFT or MOVE_RIGHT).
+ *
+ * @var PendingMove_t::steps
+ * Steps of the move.
+ *
+ * @var PendingMove_t::ack_seq
+ * Sequence number of the last game state published before the server applied the move,
+ * from its reply. 0 while the reply has not arrived.
+ */
+typedef struct {
+    char direction;
+    int steps;
+    unsigned long ack_seq;
+} PendingMove_t;
+
+// Moves sent and not yet in a game state, oldest first
+PendingMove_t pending_moves[MAX_PENDING_MOVES];
+int pending_count = 0;
+
+// Astronaut of the client and its position in the last game state
+char prediction_id = '\0';
+int base_x = -1; // -1 until a game state with the astronaut arrives
+int base_y = -1;
+unsigned long base_seq = 0; // Sequence number of the last game state
+int prediction_drawn = 0; // Set while the display draws a predicted position
+
+pthread_mutex_t prediction_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * @brief Replays the pending moves over the position of the last game state and draws the result.
+ *
+ * Uses is_valid_move, the rules of the server, with the zone found from the position.
+ * The prediction is cleared when there are no pending moves, the game state is then drawn as is.
+ *
+ * @note Must be called with prediction_lock held.
+ */
+void update_prediction() {
+    if (pending_count == 0 || base_x < 0) {
+        if (prediction_drawn) {
+            set_display_prediction('\0', 0, 0);
+            prediction_drawn = 0;
+        }
+        return;
+    }
+
+    Player_t player;
+    memset(&player, 0, sizeof(player));
+    player.id = prediction_id;
+    player.x = base_x;
+    player.y = base_y;
+    player.zone = zone_from_position(base_x, base_y);
+    for (int i = 0; i < pending_count; i++) {
+        char direction = pending_moves[i].direction;
+        for (int step = 0; step < pending_moves[i].steps && is_valid_move(&player, direction); step++) {
+            if (direction == MOVE_LEFT) player.x--;
+            else if (direction == MOVE_RIGHT) player.x++;
+            else if (direction == MOVE_UP) player.y--;
+            else if (direction == MOVE_DOWN) player.y++;
+        }
+    }
+    set_display_prediction(prediction_id, player.x, player.y);
+    prediction_drawn = 1;
+}
+
+/**
+ * @brief Removes the pending moves included in the last game state.
+ *
+ * A move is included in the game states published after the one its reply points to.
+ *
+ * @note Must be called with prediction_lock held.
+ */
+void drop_included_moves() {
+    int kept = 0;
+    for (int i = 0; i < pending_count; i++) {
+        if (pending_moves[i].ack_seq == 0 || pending_moves[i].ack_seq >= base_seq) {
+            pending_moves[kept++] = pending_moves[i];
+        }
+    }
+    pending_count = kept;
+}
+
+/**
+ * @brief Starts predicting the moves of an astronaut, once the client is connected.
+ *
+ * @param id The astronaut of the client.
+ */
+void prediction_start(char id) {
+    pthread_mutex_lock(&prediction_lock);
+    prediction_id = id;
+    pending_count = 0;
+    base_x = -1;
+    base_y = -1;
+    update_prediction();
+    pthread_mutex_unlock(&prediction_lock);
+}
+
+/**
+ * @brief Records a move sent to the server and draws it right away.
+ *
+ * If too many moves are pending, the prediction is dropped and the game states are drawn as they arrive.
+ *
+ * @param direction The direction of the move.
+ * @param steps The steps of the move.
+ */
+void prediction_move_sent(char direction, int steps) {
+    pthread_mutex_lock(&prediction_lock);
+    if (pending_count == MAX_PENDING_MOVES) {
+        pending_count = 0;
+    } else {
+        pending_moves[pending_count].direction = direction;
+        pending_moves[pending_count].steps = steps;
+        pending_moves[pending_count].ack_seq = 0;
+        pending_count++;
+    }
+    update_prediction();
+    pthread_mutex_unlock(&prediction_lock);
+}
+
+/**
+ * @brief Records the reply to the request of the moves sent since the last reply.
+ *
+ * A game state that includes the moves may have arrived before the reply, the moves are then dropped now.
+ *
+ * @param seq The sequence number of the last game state published before the request, from the reply.
+ */
+void prediction_request_replied(unsigned long seq) {
+    pthread_mutex_lock(&prediction_lock);
+    for (int i = 0; i < pending_count; i++) {
+        if (pending_moves[i].ack_seq == 0) {
+            // 0 is never published, the first game state has sequence number 1
+            pending_moves[i].ack_seq = seq > 0 ? seq : 1;
+        }
+    }
+    drop_included_moves();
+    update_prediction();
+    pthread_mutex_unlock(&prediction_lock);
+}
+
+/**
+ * @brief Drops all pending moves, the game states are drawn as they arrive.
+ *
+ * Used when a request got no valid reply, its moves may or may not have been applied.
+ */
+void prediction_reset() {
+    pthread_mutex_lock(&prediction_lock);
+    pending_count = 0;
+    update_prediction();
+    pthread_mutex_unlock(&prediction_lock);
+}
+
+/**
+ * @brief Reconciles the prediction with a game state received from the server.
+ *
+ * The position of the astronaut in the game state becomes the base of the prediction,
+ * the moves it includes are dropped and the others are replayed over it.
+ * Must be called after the game state was given to the display.
+ *
+ * @param seq The sequence number of the game state.
+ * @param msg The game state message, does not need to be null terminated.
+ * @param len The length of the message in bytes.
+ */
+void prediction_reconcile(unsigned long seq, const char* msg, size_t len) {
+    pthread_mutex_lock(&prediction_lock);
+    if (prediction_id == '\0') {
+        // Not connected yet
+        pthread_mutex_unlock(&prediction_lock);
+        return;
+    }
+
+    base_x = -1;
+    base_y = -1;
+    StateParser_t parser;
+    StateEntry_t entry;
+    state_parser_init(&parser, msg, len);
+    while (state_parser_next(&parser, &entry)) {
+        if (entry.type == CMD_PLAYER && entry.id == prediction_id) {
+            base_x = entry.x;
+            base_y = entry.y;
+        }
+    }
+    base_seq = seq;
+    drop_included_moves();
+    update_prediction();
+    pthread_mutex_unlock(&prediction_lock);
+}
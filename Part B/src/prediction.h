@@ -0,0 +1,73 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: prediction.h
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Header file for prediction.c
+ */
+
+#ifndef PREDICTION_H
+#define PREDICTION_H
+
+#include <stddef.h>
+
+/**
+ * @brief Replays the pending moves over the position of the last game state and draws the result.
+ *
+ * @note Must be called with prediction_lock held.
+ */
+void update_prediction();
+
+/**
+ * @brief Removes the pending moves included in the last game state.
+ *
+ * @note Must be called with prediction_lock held.
+ */
+void drop_included_moves();
+
+/**
+ * @brief Starts predicting the moves of an astronaut, once the client is connected.
+ *
+ * @param id The astronaut of the client.
+ */
+void prediction_start(char id);
+
+/**
+ * @brief Records a move sent to the server and draws it right away.
+ *
+ * @param direction The direction of the move.
+ * @param steps The steps of the move.
+ */
+void prediction_move_sent(char direction, int steps);
+
+/**
+ * @brief Records the reply to the request of the moves sent since the last reply.
+ *
+ * @param seq The sequence number of the last game state published before the request, from the reply.
+ */
+void prediction_request_replied(unsigned long seq);
+
+/**
+ * @brief Drops all pending moves, the game states are drawn as they arrive.
+ */
+void prediction_reset();
+
+/**
+ * @brief Reconciles the prediction with a game state received from the server.
+ *
+ * Must be called after the game state was given to the display.
+ *
+ * @param seq The sequence number of the game state.
+ * @param msg The game state message, does not need to be null terminated.
+ * @param len The length of the message in bytes.
+ */
+void prediction_reconcile(unsigned long seq, const char* msg, size_t len);
+
+#endif
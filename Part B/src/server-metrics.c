@@ -0,0 +1,329 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: server-metrics.c
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Counters and gauges of the server, exported in the Prometheus text format by the metrics
+ * service. They are atomics updated with relaxed ordering, so the threads update them without
+ * locks on their hot paths. The metrics service is a REP socket, not an HTTP endpoint that
+ * Prometheus scrapes and computes rates from, so the rates (commands, ticks and messages per second)
+ * are also computed here from the counter deltas over METRICS_RATE_WINDOW, and exported as gauges.
+ * The latency histograms of stage-metrics.c are exported as summaries.
+ */
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "game-logic.h"
+#include "stage-metrics.h"
+#include "server-metrics.h"
+
+// Commands by command stage (see stage-metrics.h) and reply code, index -code
+atomic_ulong command_counts[STAGE_CMD_OTHER + 1][METRICS_CODES];
+atomic_ulong tick_count = 0;
+atomic_ulong missed_deadline_count = 0;
+atomic_ulong skipped_tick_count = 0;
+atomic_ulong published_messages[METRICS_CHANNELS];
+atomic_ulong published_bytes[METRICS_CHANNELS];
+atomic_ulong publish_errors[METRICS_CHANNELS];
+atomic_long session_count = 0;
+atomic_long alien_count = 0;
+atomic_ulong lock_count = 0;
+atomic_ulong lock_contended_count = 0;
+atomic_ulong lock_wait_ns = 0;
+
+// Rates over the last complete window, updated by the tick thread
+_Atomic double command_rates[STAGE_CMD_OTHER + 1][METRICS_CODES];
+_Atomic double tick_rate = 0;
+_Atomic double published_rates[METRICS_CHANNELS];
+
+// Counters at the start of the current window, only used by the tick thread
+unsigned long window_commands[STAGE_CMD_OTHER + 1][METRICS_CODES];
+unsigned long window_ticks = 0;
+unsigned long window_published[METRICS_CHANNELS];
+unsigned long long window_start = 0;
+
+const char* channel_names[METRICS_CHANNELS] = { "game_state", "scores" };
+
+
+/**
+ * @brief Counts a command of an astronaut and its reply code.
+ *
+ * Codes that are not in config.h are not counted.
+ *
+ * @param cmd The command character.
+ * @param code The reply code, RESP_OK or an error code.
+ */
+void metrics_command(char cmd, int code) {
+    if (code > 0 || -code >= METRICS_CODES) {
+        return;
+    }
+    atomic_fetch_add_explicit(&command_counts[command_stage(cmd)][-code], 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Computes the rate of a counter over the window and starts the next window.
+ *
+ * @param counter The counter.
+ * @param start The value of the counter at the start of the window, updated.
+ * @param seconds The length of the window.
+ * @return The increase of the counter per second.
+ */
+double window_rate(atomic_ulong* counter, unsigned long* start, double seconds) {
+    unsigned long value = atomic_load_explicit(counter, memory_order_relaxed);
+    double rate = (value - *start) / seconds;
+    *start = value;
+    return rate;
+}
+
+/**
+ * @brief Counts a tick of the server, and updates the rates at the end of each window.
+ *
+ * The tick thread is the only caller, so the window is not shared. The first window
+ * starts at the first tick, the rates are 0 until it ends.
+ */
+void metrics_tick() {
+    atomic_fetch_add_explicit(&tick_count, 1, memory_order_relaxed);
+
+    unsigned long long now = stage_time();
+    if (window_start == 0) {
+        window_start = now;
+        return;
+    }
+    double seconds = (now - window_start) / 1e9;
+    if (seconds < METRICS_RATE_WINDOW) {
+        return;
+    }
+    window_start = now;
+
+    for (int stage = 0; stage <= STAGE_CMD_OTHER; stage++) {
+        for (int code = 0; code < METRICS_CODES; code++) {
+            double rate = window_rate(&command_counts[stage][code], &window_commands[stage][code], seconds);
+            atomic_store_explicit(&command_rates[stage][code], rate, memory_order_relaxed);
+        }
+    }
+    atomic_store_explicit(&tick_rate, window_rate(&tick_count, &window_ticks, seconds), memory_order_relaxed);
+    for (int i = 0; i < METRICS_CHANNELS; i++) {
+        double rate = window_rate(&published_messages[i], &window_published[i], seconds);
+        atomic_store_explicit(&published_rates[i], rate, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Counts an arena job that finished after its deadline.
+ */
+void metrics_missed_deadline() {
+    atomic_fetch_add_explicit(&missed_deadline_count, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Counts an arena update that was not queued because the previous one was still running.
+ */
+void metrics_skipped_tick() {
+    atomic_fetch_add_explicit(&skipped_tick_count, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Counts a message forwarded to a publisher socket.
+ *
+ * @param channel The publisher, PUBLISH_GAME_STATE or PUBLISH_SCORES.
+ * @param bytes The bytes of the message, envelope included.
+ */
+void metrics_published(char channel, size_t bytes) {
+    int i = channel == PUBLISH_SCORES;
+    atomic_fetch_add_explicit(&published_messages[i], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&published_bytes[i], bytes, memory_order_relaxed);
+}
+
+/**
+ * @brief Counts a message that a publisher socket failed to send.
+ *
+ * A PUB socket drops the messages for a slow subscriber at its high water mark without
+ * an error, so those are not counted here. They are counted by the spectator relay.
+ *
+ * @param channel The publisher, PUBLISH_GAME_STATE or PUBLISH_SCORES.
+ */
+void metrics_publish_error(char channel) {
+    atomic_fetch_add_explicit(&publish_errors[channel == PUBLISH_SCORES], 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Updates the number of connected astronauts.
+ *
+ * @param delta 1 when a player connects, -1 when it leaves.
+ */
+void metrics_sessions(int delta) {
+    atomic_fetch_add_explicit(&session_count, delta, memory_order_relaxed);
+}
+
+/**
+ * @brief Updates the number of active aliens.
+ *
+ * @param delta The aliens created (positive) or destroyed (negative).
+ */
+void metrics_aliens(int delta) {
+    atomic_fetch_add_explicit(&alien_count, delta, memory_order_relaxed);
+}
+
+/**
+ * @brief Counts an acquisition of an arena lock.
+ *
+ * @param contended Set if the lock was held by another thread.
+ * @param wait The time waited for the lock in nanoseconds.
+ */
+void metrics_lock(int contended, unsigned long long wait) {
+    atomic_fetch_add_explicit(&lock_count, 1, memory_order_relaxed);
+    if (contended) {
+        atomic_fetch_add_explicit(&lock_contended_count, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&lock_wait_ns, wait, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Appends text to the metrics being written, the text that does not fit is dropped.
+ *
+ * @param buffer The metrics.
+ * @param size The size of the buffer.
+ * @param len The length of the metrics written so far, updated.
+ * @param format The printf format of the text.
+ */
+void append_metrics(char* buffer, size_t size, int* len, const char* format, ...) {
+    if ((size_t)*len >= size - 1) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buffer + *len, size - *len, format, args);
+    va_end(args);
+    if (written > 0) {
+        *len += written;
+        if ((size_t)*len > size - 1) {
+            *len = size - 1;
+        }
+    }
+}
+
+/**
+ * @brief Writes the metrics in the Prometheus text format.
+ *
+ * Only the commands and reply codes that happened are written.
+ *
+ * @param buffer Where the metrics are written.
+ * @param size The size of the buffer, METRICS_BUFFER_SIZE is enough.
+ * @return The length of the metrics, at most size - 1.
+ */
+int format_metrics(char* buffer, size_t size) {
+    int len = 0;
+    buffer[0] = '\0';
+
+    append_metrics(buffer, size, &len, "# HELP spcinvdrs_commands_total Commands of the astronauts by command and reply code.\n"
+                   "# TYPE spcinvdrs_commands_total counter\n");
+    for (int stage = 0; stage <= STAGE_CMD_OTHER; stage++) {
+        // The stage names of the commands are "cmd_<command>"
+        const char* command = stage_name(stage) + strlen("cmd_");
+        for (int code = 0; code < METRICS_CODES; code++) {
+            unsigned long count = atomic_load_explicit(&command_counts[stage][code], memory_order_relaxed);
+            if (count > 0) {
+                append_metrics(buffer, size, &len, "spcinvdrs_commands_total{command=\"%s\",code=\"%d\"} %lu\n", command, -code, count);
+            }
+        }
+    }
+    append_metrics(buffer, size, &len, "# HELP spcinvdrs_commands_per_second Commands of the astronauts per second by command and reply code, over the last %d seconds.\n"
+                   "# TYPE spcinvdrs_commands_per_second gauge\n", METRICS_RATE_WINDOW);
+    for (int stage = 0; stage <= STAGE_CMD_OTHER; stage++) {
+        const char* command = stage_name(stage) + strlen("cmd_");
+        for (int code = 0; code < METRICS_CODES; code++) {
+            // Written for the same commands and codes as the counter, so an idle command drops to 0
+            if (atomic_load_explicit(&command_counts[stage][code], memory_order_relaxed) > 0) {
+                append_metrics(buffer, size, &len, "spcinvdrs_commands_per_second{command=\"%s\",code=\"%d\"} %.3f\n", command, -code,
+                               atomic_load_explicit(&command_rates[stage][code], memory_order_relaxed));
+            }
+        }
+    }
+
+    append_metrics(buffer, size, &len, "# HELP spcinvdrs_sessions Astronauts connected.\n# TYPE spcinvdrs_sessions gauge\n"
+                   "spcinvdrs_sessions %ld\n", atomic_load_explicit(&session_count, memory_order_relaxed));
+    append_metrics(buffer, size, &len, "# HELP spcinvdrs_aliens Aliens alive in all arenas.\n# TYPE spcinvdrs_aliens gauge\n"
+                   "spcinvdrs_aliens %ld\n", atomic_load_explicit(&alien_count, memory_order_relaxed));
+    append_metrics(buffer, size, &len, "# HELP spcinvdrs_ticks_total Ticks of the server.\n# TYPE spcinvdrs_ticks_total counter\n"
+                   "spcinvdrs_ticks_total %lu\n", atomic_load_explicit(&tick_count, memory_order_relaxed));
+    append_metrics(buffer, size, &len, "# HELP spcinvdrs_ticks_per_second Ticks of the server per second, over the last %d seconds.\n"
+                   "# TYPE spcinvdrs_ticks_per_second gauge\n"
+                   "spcinvdrs_ticks_per_second %.3f\n", METRICS_RATE_WINDOW, atomic_load_explicit(&tick_rate, memory_order_relaxed));
+    append_metrics(buffer, size, &len, "# HELP spcinvdrs_tick_overruns_total Arena jobs late, by reason: finished after their deadline, or not queued because the previous one was still running.\n"
+                   "# TYPE spcinvdrs_tick_overruns_total counter\n"
+                   "spcinvdrs_tick_overruns_total{reason=\"missed_deadline\"} %lu\n"
+                   "spcinvdrs_tick_overruns_total{reason=\"skipped\"} %lu\n",
+                   atomic_load_explicit(&missed_deadline_count, memory_order_relaxed),
+                   atomic_load_explicit(&skipped_tick_count, memory_order_relaxed));
+
+    append_metrics(buffer, size, &len, "# HELP spcinvdrs_published_messages_total Messages sent by the publishers.\n"
+                   "# TYPE spcinvdrs_published_messages_total counter\n");
+    for (int i = 0; i < METRICS_CHANNELS; i++) {
+        append_metrics(buffer, size, &len, "spcinvdrs_published_messages_total{channel=\"%s\"} %lu\n", channel_names[i],
+                       atomic_load_explicit(&published_messages[i], memory_order_relaxed));
+    }
+    append_metrics(buffer, size, &len, "# HELP spcinvdrs_published_messages_per_second Messages sent by the publishers per second, over the last %d seconds.\n"
+                   "# TYPE spcinvdrs_published_messages_per_second gauge\n", METRICS_RATE_WINDOW);
+    for (int i = 0; i < METRICS_CHANNELS; i++) {
+        append_metrics(buffer, size, &len, "spcinvdrs_published_messages_per_second{channel=\"%s\"} %.3f\n", channel_names[i],
+                       atomic_load_explicit(&published_rates[i], memory_order_relaxed));
+    }
+    append_metrics(buffer, size, &len, "# HELP spcinvdrs_published_bytes_total Bytes sent by the publishers, envelopes included.\n"
+                   "# TYPE spcinvdrs_published_bytes_total counter\n");
+    for (int i = 0; i < METRICS_CHANNELS; i++) {
+        append_metrics(buffer, size, &len, "spcinvdrs_published_bytes_total{channel=\"%s\"} %lu\n", channel_names[i],
+                       atomic_load_explicit(&published_bytes[i], memory_order_relaxed));
+    }
+    append_metrics(buffer, size, &len, "# HELP spcinvdrs_publish_errors_total Messages the publisher sockets failed to send. "
+                   "Not the subscriber drops, which ZeroMQ makes at the high water mark without telling the server, "
+                   "the spectator relay counts them from the sequence gaps.\n"
+                   "# TYPE spcinvdrs_publish_errors_total counter\n");
+    for (int i = 0; i < METRICS_CHANNELS; i++) {
+        append_metrics(buffer, size, &len, "spcinvdrs_publish_errors_total{channel=\"%s\"} %lu\n", channel_names[i],
+                       atomic_load_explicit(&publish_errors[i], memory_order_relaxed));
+    }
+
+    append_metrics(buffer, size, &len, "# HELP spcinvdrs_lock_acquisitions_total Acquisitions of the arena locks.\n"
+                   "# TYPE spcinvdrs_lock_acquisitions_total counter\n"
+                   "spcinvdrs_lock_acquisitions_total %lu\n"
+                   "# HELP spcinvdrs_lock_contended_total Acquisitions of the arena locks that waited for another thread.\n"
+                   "# TYPE spcinvdrs_lock_contended_total counter\n"
+                   "spcinvdrs_lock_contended_total %lu\n"
+                   "# HELP spcinvdrs_lock_wait_seconds_total Time waited for the arena locks held by other threads.\n"
+                   "# TYPE spcinvdrs_lock_wait_seconds_total counter\n"
+                   "spcinvdrs_lock_wait_seconds_total %.9f\n",
+                   atomic_load_explicit(&lock_count, memory_order_relaxed),
+                   atomic_load_explicit(&lock_contended_count, memory_order_relaxed),
+                   atomic_load_explicit(&lock_wait_ns, memory_order_relaxed) / 1e9);
+
+    // Latency of the stages, as summaries
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    append_metrics(buffer, size, &len, "# HELP spcinvdrs_stage_seconds Latency of the stages of the server.\n"
+                   "# TYPE spcinvdrs_stage_seconds summary\n");
+    for (int stage = 0; stage < STAGES; stage++) {
+        Histogram_t histogram;
+        memset(&histogram, 0, sizeof(histogram));
+        stage_metrics_merge(stage, &histogram);
+        if (histogram.count == 0) {
+            continue;
+        }
+        for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+            append_metrics(buffer, size, &len, "spcinvdrs_stage_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n", stage_name(stage),
+                           quantiles[i], histogram_percentile(&histogram, quantiles[i]) / 1e9);
+        }
+        append_metrics(buffer, size, &len, "spcinvdrs_stage_seconds_sum{stage=\"%s\"} %.9f\n"
+                       "spcinvdrs_stage_seconds_count{stage=\"%s\"} %lu\n",
+                       stage_name(stage), histogram.sum / 1e9, stage_name(stage), histogram.count);
+    }
+    return len;
+}
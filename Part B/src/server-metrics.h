@@ -0,0 +1,96 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: server-metrics.h
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Header file for server-metrics.c
+ */
+
+#ifndef SERVER_METRICS_H
+#define SERVER_METRICS_H
+
+#include <stddef.h>
+
+#define METRICS_CODES 12 // Reply codes counted per command, RESP_OK to ERR_THROTTLED
+#define METRICS_CHANNELS 2 // Publishers, game state and scores
+#define METRICS_BUFFER_SIZE 65536 // Largest metrics reply
+
+/**
+ * @brief Counts a command of an astronaut and its reply code.
+ *
+ * @param cmd The command character.
+ * @param code The reply code, RESP_OK or an error code.
+ */
+void metrics_command(char cmd, int code);
+
+/**
+ * @brief Counts a tick of the server, and updates the rates at the end of each window.
+ *
+ * Only called by the tick thread.
+ */
+void metrics_tick();
+
+/**
+ * @brief Counts an arena job that finished after its deadline.
+ */
+void metrics_missed_deadline();
+
+/**
+ * @brief Counts an arena update that was not queued because the previous one was still running.
+ */
+void metrics_skipped_tick();
+
+/**
+ * @brief Counts a message forwarded to a publisher socket.
+ *
+ * @param channel The publisher, PUBLISH_GAME_STATE or PUBLISH_SCORES.
+ * @param bytes The bytes of the message, envelope included.
+ */
+void metrics_published(char channel, size_t bytes);
+
+/**
+ * @brief Counts a message that a publisher socket failed to send.
+ *
+ * @param channel The publisher, PUBLISH_GAME_STATE or PUBLISH_SCORES.
+ */
+void metrics_publish_error(char channel);
+
+/**
+ * @brief Updates the number of connected astronauts.
+ *
+ * @param delta 1 when a player connects, -1 when it leaves.
+ */
+void metrics_sessions(int delta);
+
+/**
+ * @brief Updates the number of active aliens.
+ *
+ * @param delta The aliens created (positive) or destroyed (negative).
+ */
+void metrics_aliens(int delta);
+
+/**
+ * @brief Counts an acquisition of an arena lock.
+ *
+ * @param contended Set if the lock was held by another thread.
+ * @param wait The time waited for the lock in nanoseconds.
+ */
+void metrics_lock(int contended, unsigned long long wait);
+
+/**
+ * @brief Writes the metrics in the Prometheus text format.
+ *
+ * @param buffer Where the metrics are written.
+ * @param size The size of the buffer, METRICS_BUFFER_SIZE is enough.
+ * @return The length of the metrics, at most size - 1.
+ */
+int format_metrics(char* buffer, size_t size);
+
+#endif
@@ -11,37 +11,504 @@
  *
  * Description:
  * Logic for the UI and screen using ncurses. All the UI code is here
+ * Also has a direct ANSI renderer that writes each frame to the terminal with a single write()
+ * and a headless renderer that draws into an in-memory screen, for benchmarks without a terminal
  */
 
 #include <ncurses.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <stdarg.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <time.h>
 #include "config.h"
 #include "space-display.h"
+#include "state-parser.h"
 #include <string.h>
 
+// Size of the ANSI frame buffer, fits a full redraw of the grid and scores
+#define ANSI_FRAME_SIZE 16384
+
+// Size of the in-memory screen of the headless renderer
+#define HEADLESS_ROWS 24
+#define HEADLESS_COLS 80
+
+// SGR sequences used by the ANSI renderer, match the ncurses color pairs
+#define ANSI_SGR_NORMAL "\033[0m"
+#define ANSI_SGR_BOLD "\033[0;1m"
+#define ANSI_SGR_ALIEN "\033[0;31m"
+#define ANSI_SGR_LASER "\033[0;1;31m"
+#define ANSI_SGR_ASTRONAUT "\033[0;32m"
+
 // Array to store the display information of players
 disp_Player_t players_disp[MAX_PLAYERS];
 
 // 2D array to represent the game grid
 disp_Cell_t grid[GRID_HEIGHT][GRID_WIDTH];
 
+// Game grid of the last game state, before the predicted position of the astronaut is drawn over it
+disp_Cell_t state_grid[GRID_HEIGHT][GRID_WIDTH];
+
+// Predicted position of the astronaut of the client, see set_display_prediction
+char predicted_id = '\0'; // No prediction if '\0'
+int predicted_x = 0;
+int predicted_y = 0;
+
 // Flag indicating whether the game is over
 int game_over_display = 0;
 
+// ncurses windows for the parts of the screen that change every frame
+// The static frame (row/column numbers, borders and score header) is drawn once in stdscr
+WINDOW* grid_win;   // Game grid cells
+WINDOW* score_win;  // Score rows
+
+// Last grid and score rows sent to ncurses
+// Used to only redraw the cells and rows that changed since the previous frame
+disp_Cell_t rendered_grid[GRID_HEIGHT][GRID_WIDTH];
+disp_Player_t rendered_scores[MAX_PLAYERS];
+
+// Renderer used to draw the screen, selected at startup with set_display_backend
+int display_backend = DISPLAY_BACKEND_NCURSES;
+
+// ANSI renderer state
+char ansi_frame[ANSI_FRAME_SIZE]; // Frame being composed
+size_t ansi_frame_len = 0;
+int ansi_cursor_y = -1; // Terminal cursor position after the last character written, -1 if unknown
+int ansi_cursor_x = -1;
+const char* ansi_sgr = NULL; // SGR sequence currently active in the terminal, NULL if unknown
+struct termios ansi_saved_termios; // Terminal settings restored at exit
+int ansi_terminal_started = 0; // Set once display_start_terminal has changed the terminal
+
+// Headless renderer state
+char headless_screen[HEADLESS_ROWS][HEADLESS_COLS]; // In-memory screen
+FILE* headless_dump_file = NULL; // File the screen is dumped to, NULL to not dump
+double headless_dump_interval_ns = 0; // Minimum time between two dumps
+double headless_last_dump_ns = 0;
+long headless_frames_dumped = 0;
+
+// Per-frame timing of update_grid (decode) and draw_grid (render)
+long decode_frames = 0;
+double decode_total_ns = 0;
+double decode_max_ns = 0;
+double last_decode_ns = 0;
+long render_frames = 0;
+double render_total_ns = 0;
+double render_max_ns = 0;
+
+// Game states given to the display, and the function told when they are drawn
+unsigned long states_given = 0;
+void (*frame_hook)(unsigned long state) = NULL;
+
 // Mutex for internal display data
-pthread_mutex_t display_lock;
+pthread_mutex_t display_lock = PTHREAD_MUTEX_INITIALIZER;
 
-// Flag to request the display to update the game grid
+// Flag to request the display to draw the game grid
 int state_changed = 0;
-// Condition variable to signal display
-pthread_cond_t state_changed_cond;
+// Flag set once display_main has drawn the static frame and is ready to draw game states
+int display_started = 0;
+// Condition variable to signal display, also signaled when a game state was drawn
+pthread_cond_t state_changed_cond = PTHREAD_COND_INITIALIZER;
+
+
+/**
+ * @brief Returns a monotonic timestamp in nanoseconds.
+ *
+ * @return The current time in nanoseconds.
+ */
+double display_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/**
+ * @brief Writes text into the in-memory screen of the headless renderer.
+ *
+ * Text outside the screen is clipped.
+ *
+ * @param y Screen row, starting at 0.
+ * @param x Screen column, starting at 0.
+ * @param text The text to write.
+ * @param len The length of the text.
+ */
+void headless_put(int y, int x, const char* text, size_t len) {
+    if (y < 0 || y >= HEADLESS_ROWS) {
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (x + (int)i >= 0 && x + (int)i < HEADLESS_COLS) {
+            headless_screen[y][x + i] = text[i];
+        }
+    }
+}
+
+/**
+ * @brief Writes the in-memory screen to the dump file.
+ *
+ * Each dump has a header line with the frame number and the timing of the last frame,
+ * followed by the screen rows without trailing spaces and an empty line.
+ * Dumps are skipped if less than the dump interval passed since the previous one, unless forced.
+ *
+ * @param render_ns Time spent drawing the last frame.
+ * @param force 1 to dump regardless of the dump interval.
+ */
+void headless_dump_screen(double render_ns, int force) {
+    if (headless_dump_file == NULL) {
+        return;
+    }
+    double now = display_now_ns();
+    if (!force && headless_frames_dumped > 0 && now - headless_last_dump_ns < headless_dump_interval_ns) {
+        return;
+    }
+    headless_last_dump_ns = now;
+    headless_frames_dumped++;
+
+    fprintf(headless_dump_file, "frame %ld decode_ns %.0f render_ns %.0f\n", render_frames, last_decode_ns, render_ns);
+    for (int y = 0; y < HEADLESS_ROWS; y++) {
+        int len = HEADLESS_COLS;
+        while (len > 0 && headless_screen[y][len - 1] == ' ') {
+            len--;
+        }
+        fwrite(headless_screen[y], 1, len, headless_dump_file);
+        fputc('\n', headless_dump_file);
+    }
+    fputc('\n', headless_dump_file);
+    fflush(headless_dump_file);
+}
+
+
+/**
+ * @brief Sends the composed ANSI frame to the terminal.
+ *
+ * The whole frame is sent with a single write() call.
+ */
+void ansi_flush() {
+    size_t written = 0;
+    while (written < ansi_frame_len) {
+        ssize_t n = write(STDOUT_FILENO, ansi_frame + written, ansi_frame_len - written);
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    ansi_frame_len = 0;
+}
+
+/**
+ * @brief Appends bytes to the ANSI frame.
+ *
+ * If the frame buffer is full, the frame composed so far is flushed first.
+ *
+ * @param data The bytes to append.
+ * @param len The number of bytes.
+ */
+void ansi_append(const char* data, size_t len) {
+    if (ansi_frame_len + len > sizeof(ansi_frame)) {
+        ansi_flush();
+    }
+    memcpy(ansi_frame + ansi_frame_len, data, len);
+    ansi_frame_len += len;
+}
+
+/**
+ * @brief Moves the terminal cursor, only if it is not already at that position.
+ *
+ * @param y Screen row, starting at 0.
+ * @param x Screen column, starting at 0.
+ */
+void ansi_move(int y, int x) {
+    if (y == ansi_cursor_y && x == ansi_cursor_x) {
+        return;
+    }
+    char seq[24];
+    int len = snprintf(seq, sizeof(seq), "\033[%d;%dH", y + 1, x + 1);
+    ansi_append(seq, len);
+    ansi_cursor_y = y;
+    ansi_cursor_x = x;
+}
+
+/**
+ * @brief Sets the SGR attributes, only if they are not already active.
+ *
+ * @param sgr One of the ANSI_SGR_* sequences.
+ */
+void ansi_set_sgr(const char* sgr) {
+    if (sgr == ansi_sgr) {
+        return;
+    }
+    ansi_append(sgr, strlen(sgr));
+    ansi_sgr = sgr;
+}
+
+/**
+ * @brief Writes text at a screen position with the given attributes.
+ *
+ * With the headless renderer the text is written into the in-memory screen instead.
+ *
+ * @param y Screen row, starting at 0.
+ * @param x Screen column, starting at 0.
+ * @param sgr One of the ANSI_SGR_* sequences.
+ * @param fmt printf style format of the text.
+ */
+void ansi_print(int y, int x, const char* sgr, const char* fmt, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    if (len >= (int)sizeof(text)) {
+        len = sizeof(text) - 1;
+    }
+
+    // The headless renderer keeps the text, attributes are not stored
+    if (display_backend == DISPLAY_BACKEND_HEADLESS) {
+        headless_put(y, x, text, len);
+        return;
+    }
+
+    ansi_move(y, x);
+    ansi_set_sgr(sgr);
+    ansi_append(text, len);
+    ansi_cursor_x += len;
+}
+
+/**
+ * @brief Clears the whole terminal screen.
+ */
+void ansi_clear_screen() {
+    if (display_backend == DISPLAY_BACKEND_HEADLESS) {
+        memset(headless_screen, ' ', sizeof(headless_screen));
+        return;
+    }
+    ansi_set_sgr(ANSI_SGR_NORMAL);
+    ansi_append("\033[2J", strlen("\033[2J"));
+    ansi_cursor_y = -1;
+    ansi_cursor_x = -1;
+}
+
+/**
+ * @brief Draws the static frame with the ANSI or headless renderer.
+ *
+ * Same layout as the ncurses frame: row and column numbers, the grid border,
+ * the scores header and the border around the scores.
+ */
+void ansi_initialize_display() {
+    ansi_clear_screen();
+
+    // Draw row numbers on the left
+    for (int i = 0; i < GRID_HEIGHT; i++) {
+        ansi_print(i + 3, 1, ANSI_SGR_NORMAL, "%d", (i + 1) % 10);
+    }
+
+    // Draw column numbers on the top
+    for (int i = 0; i < GRID_WIDTH; i++) {
+        ansi_print(1, i + 4, ANSI_SGR_NORMAL, "%d", (i + 1) % 10);
+    }
+
+    // Draw border around the grid
+    for (int y = 1; y <= GRID_HEIGHT; y++) {
+        ansi_print(y + 2, 3, ANSI_SGR_NORMAL, "|");
+        ansi_print(y + 2, GRID_WIDTH + 4, ANSI_SGR_NORMAL, "|");
+    }
+    for (int x = 4; x < GRID_WIDTH + 4; x++) {
+        ansi_print(2, x, ANSI_SGR_NORMAL, "-");
+        ansi_print(GRID_HEIGHT + 3, x, ANSI_SGR_NORMAL, "-");
+    }
+    ansi_print(2, 3, ANSI_SGR_NORMAL, "+");
+    ansi_print(2, GRID_WIDTH + 4, ANSI_SGR_NORMAL, "+");
+    ansi_print(GRID_HEIGHT + 3, 3, ANSI_SGR_NORMAL, "+");
+    ansi_print(GRID_HEIGHT + 3, GRID_WIDTH + 4, ANSI_SGR_NORMAL, "+");
+
+    // Draw scores header
+    ansi_print(3, SCORE_START_X, ANSI_SGR_BOLD, "SCORES:");
+
+    // Draw border around scores, sized for the maximum number of players
+    int score_height = MAX_PLAYERS + 4;  // Header + padding + scores
+    for (int y = 3; y < score_height + 3; y++) {
+        ansi_print(y, SCORE_START_X - 2, ANSI_SGR_NORMAL, "|");
+        ansi_print(y, SCORE_START_X + 18, ANSI_SGR_NORMAL, "|");
+    }
+    for (int x = SCORE_START_X - 1; x < SCORE_START_X + 18; x++) {
+        ansi_print(2, x, ANSI_SGR_NORMAL, "-");
+        ansi_print(score_height + 3, x, ANSI_SGR_NORMAL, "-");
+    }
+    ansi_print(2, SCORE_START_X - 2, ANSI_SGR_NORMAL, "+");
+    ansi_print(2, SCORE_START_X + 18, ANSI_SGR_NORMAL, "+");
+    ansi_print(score_height + 3, SCORE_START_X - 2, ANSI_SGR_NORMAL, "+");
+    ansi_print(score_height + 3, SCORE_START_X + 18, ANSI_SGR_NORMAL, "+");
+
+    ansi_flush();
+}
+
+/**
+ * @brief Draws the changed grid cells and score rows with the ANSI or headless renderer.
+ *
+ * The cursor moves, SGR codes and characters of all the cells and rows that changed
+ * since the previous frame are composed into one buffer and sent with a single write().
+ * Cursor moves are skipped for consecutive cells and SGR codes when the color does not change.
+ */
+void ansi_draw_grid() {
+    for (int y = 0; y < GRID_HEIGHT; y++) {
+        for (int x = 0; x < GRID_WIDTH; x++) {
+            char ch = grid[y][x].ch;
+
+            // Skip cells that did not change
+            if (rendered_grid[y][x].ch == ch) {
+                continue;
+            }
+            rendered_grid[y][x].ch = ch;
+
+            const char* sgr = ANSI_SGR_NORMAL;
+            if (ch == '*') {
+                sgr = ANSI_SGR_ALIEN;
+            } else if (ch == LASER_HORIZONTAL || ch == LASER_VERTICAL) {
+                sgr = ANSI_SGR_LASER;
+            } else if (ch >= 'A' && ch <= 'H') {
+                sgr = ANSI_SGR_ASTRONAUT;
+            } else {
+                ch = ' ';
+            }
+            ansi_print(y + 3, x + 4, sgr, "%c", ch);
+        }
+    }
+
+    // Draw the score rows that changed
+    int active_players = 0;
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        if (players_disp[i].active) {
+            disp_Player_t* row = &rendered_scores[active_players];
+            if (row->active != 1 || row->id != players_disp[i].id || row->score != players_disp[i].score) {
+                ansi_print(5 + active_players, SCORE_START_X, ANSI_SGR_ASTRONAUT, "%-18.18s", "");
+                ansi_print(5 + active_players, SCORE_START_X, ANSI_SGR_ASTRONAUT, "Astronaut %c: %d",
+                        players_disp[i].id, players_disp[i].score);
+                row->active = 1;
+                row->id = players_disp[i].id;
+                row->score = players_disp[i].score;
+            }
+            active_players++;
+        }
+    }
+    for (int i = active_players; i < MAX_PLAYERS; i++) {
+        if (rendered_scores[i].active != 0) {
+            ansi_print(5 + i, SCORE_START_X, ANSI_SGR_NORMAL, "%-18.18s", "");
+            rendered_scores[i].active = 0;
+        }
+    }
+
+    ansi_flush();
+}
+
+/**
+ * @brief Selects the renderer used to draw the screen.
+ *
+ * Must be called before display_start_terminal.
+ *
+ * @param backend DISPLAY_BACKEND_NCURSES (default), DISPLAY_BACKEND_ANSI or DISPLAY_BACKEND_HEADLESS.
+ */
+void set_display_backend(int backend) {
+    display_backend = backend;
+}
+
+/**
+ * @brief Prepares the terminal for the selected renderer.
+ *
+ * For ncurses it initializes ncurses mode. For the ANSI renderer it disables line buffering
+ * and echo, switches to the alternate screen and hides the cursor.
+ * The headless renderer does not use the terminal.
+ */
+void display_start_terminal() {
+    if (display_backend == DISPLAY_BACKEND_HEADLESS) {
+        return;
+    }
+    if (display_backend == DISPLAY_BACKEND_ANSI) {
+        if (tcgetattr(STDIN_FILENO, &ansi_saved_termios) == 0) {
+            struct termios raw = ansi_saved_termios;
+            raw.c_lflag &= ~(ICANON | ECHO);
+            raw.c_cc[VMIN] = 1;
+            raw.c_cc[VTIME] = 0;
+            tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        }
+        const char* seq = "\033[?1049h\033[?25l"; // Alternate screen, hide cursor
+        ansi_append(seq, strlen(seq));
+        ansi_flush();
+        ansi_terminal_started = 1;
+        return;
+    }
+
+    // Initialize ncurses
+    initscr();
+    noecho();
+    curs_set(FALSE); // Hide the cursor
+    cbreak();
+    keypad(stdscr, TRUE);
+    start_color();
+}
+
+/**
+ * @brief Restores the terminal to the state before display_start_terminal.
+ */
+void display_end_terminal() {
+    if (display_backend == DISPLAY_BACKEND_HEADLESS) {
+        return;
+    }
+    if (display_backend == DISPLAY_BACKEND_ANSI) {
+        if (!ansi_terminal_started) {
+            return;
+        }
+        ansi_terminal_started = 0;
+        const char* seq = ANSI_SGR_NORMAL "\033[?25h\033[?1049l"; // Show cursor, leave alternate screen
+        ansi_append(seq, strlen(seq));
+        ansi_flush();
+        tcsetattr(STDIN_FILENO, TCSANOW, &ansi_saved_termios);
+        return;
+    }
+    endwin();
+}
+
+/**
+ * @brief Sets the file the headless renderer dumps its screen to.
+ *
+ * @param file The file to dump to, NULL to not dump.
+ * @param interval_ms Minimum time between two dumps in milliseconds, 0 to dump every frame.
+ */
+void set_display_dump(FILE* file, int interval_ms) {
+    headless_dump_file = file;
+    headless_dump_interval_ns = (double)interval_ms * 1e6;
+}
+
+/**
+ * @brief Prints the decode and render timing of the frames handled so far.
+ *
+ * @param out The stream to print to.
+ */
+void display_report_timing(FILE* out) {
+    pthread_mutex_lock(&display_lock);
+    fprintf(out, "Frames decoded: %ld, avg %.0f ns, max %.0f ns\n", decode_frames,
+            decode_frames > 0 ? decode_total_ns / decode_frames : 0, decode_max_ns);
+    fprintf(out, "Frames rendered: %ld, avg %.0f ns, max %.0f ns\n", render_frames,
+            render_frames > 0 ? render_total_ns / render_frames : 0, render_max_ns);
+    if (headless_dump_file != NULL) {
+        fprintf(out, "Frames dumped: %ld\n", headless_frames_dumped);
+    }
+    pthread_mutex_unlock(&display_lock);
+}
+
+/**
+ * @brief Sets a function called after each frame is drawn, with the number of the last game state drawn.
+ *
+ * The game states are numbered from 1 in the order they are given to set_display_game_state.
+ * Used to measure when a game state reaches the screen. Must be called before display_main.
+ *
+ * @param hook The function, NULL to not call any.
+ */
+void set_display_frame_hook(void (*hook)(unsigned long state)) {
+    frame_hook = hook;
+}
 
-// This string is parsed to obtain the grid and player data
-//The game state string contains information about the game state, including player positions.
-//The string can either be passed from the server thread for the game-server.c application or
-//read via zeroMQ for outer-space-display.c. and astronaut-client.c applications.
-char game_state_display[BUFFER_SIZE];
 
 
 /**
@@ -54,12 +521,16 @@ char game_state_display[BUFFER_SIZE];
  * Row numbers are drawn on the left side of the grid, and column numbers are
  * drawn on the top. A border is drawn around the grid to visually separate it
  * from the rest of the display.
+ *
+ * The static frame (numbers, borders and the score header) is drawn only here.
+ * The grid cells and score rows are drawn in their own windows by draw_grid and draw_scores.
  */
 void initialize_display() {
     // Initialize grid to empty spaces
     for (int y = 0; y < GRID_HEIGHT; y++) {
         for (int x = 0; x < GRID_WIDTH; x++) {
             grid[y][x].ch = ' ';
+            rendered_grid[y][x].ch = '\0'; // Forces the first frame to draw every cell
         }
     }
 
@@ -67,6 +538,14 @@ void initialize_display() {
     for (int i = 0; i < MAX_PLAYERS; i++) {
         players_disp[i].id = '\0';
         players_disp[i].score = 0;
+        rendered_scores[i].id = '\0';
+        rendered_scores[i].score = 0;
+        rendered_scores[i].active = -1; // Forces the first frame to draw every row
+    }
+
+    if (display_backend == DISPLAY_BACKEND_ANSI || display_backend == DISPLAY_BACKEND_HEADLESS) {
+        ansi_initialize_display();
+        return;
     }
 
     // Initialize color pairs
@@ -99,24 +578,60 @@ void initialize_display() {
     mvaddch(GRID_HEIGHT + 3, 3, '+');
     mvaddch(GRID_HEIGHT + 3, GRID_WIDTH + 4, '+');
 
-    refresh();
+    // Draw scores header
+    attron(A_BOLD);
+    mvprintw(3, SCORE_START_X, "SCORES:");
+    attroff(A_BOLD);
+
+    // Draw border around scores, sized for the maximum number of players
+    int score_height = MAX_PLAYERS + 4;  // Header + padding + scores
+
+    // Vertical lines
+    for (int y = 2; y < score_height + 3; y++) {
+        mvaddch(y, SCORE_START_X - 2, '|');
+        mvaddch(y, SCORE_START_X + 18, '|');
+    }
+
+    // Horizontal lines
+    for (int x = SCORE_START_X - 2; x < SCORE_START_X + 19; x++) {
+        mvaddch(2, x, '-');
+        mvaddch(score_height + 3, x, '-');
+    }
+
+    // Corners
+    mvaddch(2, SCORE_START_X - 2, '+');
+    mvaddch(2, SCORE_START_X + 18, '+');
+    mvaddch(score_height + 3, SCORE_START_X - 2, '+');
+    mvaddch(score_height + 3, SCORE_START_X + 18, '+');
+
+    // Create the windows for the dynamic parts of the screen
+    grid_win = newwin(GRID_HEIGHT, GRID_WIDTH, 3, 4);
+    score_win = newwin(MAX_PLAYERS, 18, 5, SCORE_START_X);
+
+    // Static frame is only sent to the terminal once
+    wnoutrefresh(stdscr);
+    doupdate();
 }
 
 /**
- * @brief Updates the game grid and player statuses based on the current game state string.
+ * @brief Updates the game grid and player statuses based on a game state message.
  *
- * This function clears the current grid and player statuses, then parses the state string
+ * This function clears the current grid and player statuses, then parses the message
  * to update the grid with new player positions, alien positions, laser beams, and player scores.
  * It also sets a flag if the game is over.
  * 
  *
- * The game state string contains information about the game state, including player positions.
- * The string can either be passed from the server thread for the game-server.c application or
+ * The game state message contains information about the game state, including player positions.
+ * The message can either be passed from the server thread for the game-server.c application or
  * read via zeroMQ for outer-space-display.c. and astronaut-display-client.c applications.
+ * The message is parsed in place, it is not modified and does not need to be null terminated.
+ *
+ * @param msg The game state message.
+ * @param len The length of the message in bytes.
  * 
  * @note This functions is not thread-safe and should be called with the display_lock mutex held.
  */
-void update_grid() {
+void update_grid(const char* msg, size_t len) {
     // Clear the grid first
     for (int y = 0; y < GRID_HEIGHT; y++) {
         for (int x = 0; x < GRID_WIDTH; x++) {
@@ -128,38 +643,43 @@ void update_grid() {
         players_disp[i].active = 0;
     }
 
-     // Parse the message line by line
-    char* line = strtok(game_state_display, "\n");
-    while (line != NULL) {
-        if (line[0] == CMD_GAME_OVER) {
+    // Parse the message line by line
+    StateParser_t parser;
+    StateEntry_t entry;
+    state_parser_init(&parser, msg, len);
+    while (state_parser_next(&parser, &entry)) {
+        if (entry.type == CMD_GAME_OVER) {
             game_over_display = 1; // Set a flag to indicate the game is over
 
-        } else if (line[0] == CMD_PLAYER) {
-            char id;
-            int x, y;
-            sscanf(line, "%*c %c %d %d", &id, &x, &y);
-            
+        } else if (entry.type == CMD_PLAYER) {
+            int x = entry.x;
+            int y = entry.y;
             if (x >= 0 && x < GRID_WIDTH && y >= 0 && y < GRID_HEIGHT) {
-                grid[y][x].ch = id;
+                grid[y][x].ch = entry.id;
                 // Update player status
-                int idx = id - 'A';
+                int idx = entry.id - 'A';
                 if (idx >= 0 && idx < MAX_PLAYERS) {
-                    players_disp[idx].id = id;
+                    players_disp[idx].id = entry.id;
                     players_disp[idx].active = 1;
+                    players_disp[idx].x = x;
+                    players_disp[idx].y = y;
                 }
             }
-        } else if (line[0] == CMD_ALIEN) {
+        } else if (entry.type == CMD_ALIEN) {
             // Format: ALIEN <x> <y>
-            int x, y;
-            sscanf(line, "%*c %d %d", &x, &y);
+            int x = entry.x;
+            int y = entry.y;
             if (x >= 0 && x < GRID_WIDTH && y >= 0 && y < GRID_HEIGHT) {
                 grid[y][x].ch = '*'; // Represent aliens with '*'
             }
-        } else if (line[0] == CMD_LASER) {
-            int x, y;
-            int zone;
-            sscanf(line, "%*c %d %d %d", &x, &y, &zone);
-            
+        } else if (entry.type == CMD_LASER) {
+            int x = entry.x;
+            int y = entry.y;
+            int zone = entry.value;
+            if (x < 0 || x >= GRID_WIDTH || y < 0 || y >= GRID_HEIGHT) {
+                continue; // Laser outside the grid
+            }
+
             if (zone == ZONE_A || zone == ZONE_H) {
                 for (int i = x; i < GRID_WIDTH; i++) {
                     grid[y][i].ch = LASER_HORIZONTAL;
@@ -179,86 +699,67 @@ void update_grid() {
                 }
             }
             
-        } else if (line[0] == CMD_SCORE) {
-            char id;
-            int player_score;
-            sscanf(line, "%*c %c %d", &id, &player_score);
-            
-            int idx = id - 'A';
+        } else if (entry.type == CMD_SCORE) {
+            int idx = entry.id - 'A';
             if (idx >= 0 && idx < MAX_PLAYERS) {
                 players_disp[idx].active = 1;
-                players_disp[idx].score = player_score;
+                players_disp[idx].score = entry.value;
             }
         }
-        // Move to the next line
-        line = strtok(NULL, "\n");
     }
 }
 
 /**
  * @brief Draws the scores of active players on the screen.
  *
- * This function clears the score area, displays the scores header, 
- * and lists the scores of all active players. It also draws a border 
- * around the scores area.
+ * This function lists the scores of all active players, one per row of the score window.
+ * Only the rows that differ from the previously drawn frame are sent to ncurses.
+ * The scores header and the border around the scores area are static and drawn
+ * once by initialize_display.
  *
- * The scores are displayed in bold and color-coded for astronauts.
+ * The scores are color-coded for astronauts.
  * The function assumes that the players_disp array contains information 
  * about the players, including their active status, ID, and score.
  *
- * The score area is cleared before displaying the scores, and a border 
- * is drawn around the scores area to visually separate it from other 
- * parts of the screen.
+ * The score window is staged with wnoutrefresh, draw_grid sends it to the terminal.
  * 
  * @note This functions is not thread-safe and should be called with the display_lock mutex held.
  */
 void draw_scores() {
-    // Clear the score area first
-    for (int y = 3; y < GRID_HEIGHT + 3; y++) {
-        for (int x = SCORE_START_X; x < SCORE_START_X + 20; x++) {
-            mvaddch(y, x, ' ');
-        }
-    }
-
-    // Draw scores header
-    attron(A_BOLD);
-    mvprintw(3, SCORE_START_X, "SCORES:");
-    attroff(A_BOLD);
-
     // Track number of active players
     int active_players = 0;
 
     // Display scores for all active players
     for (int i = 0; i < MAX_PLAYERS; i++) {
         if (players_disp[i].active) {  // Only show active players
-            attron(COLOR_PAIR(COLOR_ASTRONAUT));
-            mvprintw(5 + active_players, SCORE_START_X, "Astronaut %c: %d", 
-                    players_disp[i].id, players_disp[i].score);
-            attroff(COLOR_PAIR(COLOR_ASTRONAUT));
+            disp_Player_t* row = &rendered_scores[active_players];
+
+            // Skip rows that did not change
+            if (row->active != 1 || row->id != players_disp[i].id || row->score != players_disp[i].score) {
+                wmove(score_win, active_players, 0);
+                wclrtoeol(score_win);
+                wattron(score_win, COLOR_PAIR(COLOR_ASTRONAUT));
+                wprintw(score_win, "Astronaut %c: %d", players_disp[i].id, players_disp[i].score);
+                wattroff(score_win, COLOR_PAIR(COLOR_ASTRONAUT));
+
+                row->active = 1;
+                row->id = players_disp[i].id;
+                row->score = players_disp[i].score;
+            }
             active_players++;
         }
     }
 
-    // Draw border around scores
-    int score_height = active_players + 4;  // Header + padding + scores
-    
-    // Vertical lines
-    for (int y = 2; y < score_height + 3; y++) {
-        mvaddch(y, SCORE_START_X - 2, '|');
-        mvaddch(y, SCORE_START_X + 18, '|');
-    }
-    
-    // Horizontal lines
-    for (int x = SCORE_START_X - 2; x < SCORE_START_X + 19; x++) {
-        mvaddch(2, x, '-');
-        mvaddch(score_height + 3, x, '-');
+    // Clear rows of players that left
+    for (int i = active_players; i < MAX_PLAYERS; i++) {
+        if (rendered_scores[i].active != 0) {
+            wmove(score_win, i, 0);
+            wclrtoeol(score_win);
+            rendered_scores[i].active = 0;
+        }
     }
-    
-    // Corners
-    mvaddch(2, SCORE_START_X - 2, '+');
-    mvaddch(2, SCORE_START_X + 18, '+');
-    mvaddch(score_height + 3, SCORE_START_X - 2, '+');
-    mvaddch(score_height + 3, SCORE_START_X + 18, '+');
+
+    wnoutrefresh(score_win);
 }
 
 
@@ -266,50 +767,61 @@ void draw_scores() {
  * @brief Draws the game grid on the screen.
  *
  * This function iterates through the game grid and draws each cell based on its content.
+ * Only the cells that differ from the previously drawn frame are sent to ncurses.
  * It handles the following elements:
  * - Aliens ('*') with a specific color.
  * - Lasers (horizontal and vertical) with a specific color and bold attribute.
  * - Astronauts (characters 'A' to 'H') with a specific color.
  * - Empty cells as spaces.
  *
- * The function also draws the scores and refreshes the screen.
+ * The function also draws the scores and sends both windows to the terminal in a single update.
  * 
  * @note This functions is not thread-safe and should be called with the display_lock mutex held.
  */
 void draw_grid(void) {
+    if (display_backend == DISPLAY_BACKEND_ANSI || display_backend == DISPLAY_BACKEND_HEADLESS) {
+        ansi_draw_grid();
+        return;
+    }
+
     for (int y = 0; y < GRID_HEIGHT; y++) {
         for (int x = 0; x < GRID_WIDTH; x++) {
             char ch = grid[y][x].ch;
-            int display_y = y + 3;
-            int display_x = x + 4;
+
+            // Skip cells that did not change
+            if (rendered_grid[y][x].ch == ch) {
+                continue;
+            }
+            rendered_grid[y][x].ch = ch;
 
             if (ch == '*') {
                 // Draw alien
-                attron(COLOR_PAIR(COLOR_ALIEN));
-                mvaddch(display_y, display_x, ch);
-                attroff(COLOR_PAIR(COLOR_ALIEN));
+                wattron(grid_win, COLOR_PAIR(COLOR_ALIEN));
+                mvwaddch(grid_win, y, x, ch);
+                wattroff(grid_win, COLOR_PAIR(COLOR_ALIEN));
             } else if (ch == LASER_HORIZONTAL || ch == LASER_VERTICAL) {
                 // Draw laser
-                attron(COLOR_PAIR(COLOR_LASER) | A_BOLD);
-                mvaddch(display_y, display_x, ch);
-                attroff(COLOR_PAIR(COLOR_LASER) | A_BOLD);
+                wattron(grid_win, COLOR_PAIR(COLOR_LASER) | A_BOLD);
+                mvwaddch(grid_win, y, x, ch);
+                wattroff(grid_win, COLOR_PAIR(COLOR_LASER) | A_BOLD);
             } else if (ch >= 'A' && ch <= 'H') {
                 // Draw astronaut
-                attron(COLOR_PAIR(COLOR_ASTRONAUT));
-                mvaddch(display_y, display_x, ch);
-                attroff(COLOR_PAIR(COLOR_ASTRONAUT));
+                wattron(grid_win, COLOR_PAIR(COLOR_ASTRONAUT));
+                mvwaddch(grid_win, y, x, ch);
+                wattroff(grid_win, COLOR_PAIR(COLOR_ASTRONAUT));
             } else {
                 // Draw empty cell
-                mvaddch(display_y, display_x, ' ');
+                mvwaddch(grid_win, y, x, ' ');
             }
         }
     }
+    wnoutrefresh(grid_win);
 
     // Draw scores
     draw_scores();
 
-    // Refresh the screen
-    refresh();
+    // Send the staged windows to the terminal
+    doupdate();
 }
 
 /**
@@ -324,12 +836,30 @@ void draw_grid(void) {
  * @note This functions is not thread-safe.
  */
 void show_victory_screen() {
-    // Clear the screen
-    clear();
-
     // Get the dimensions of the terminal window
     int term_height, term_width;
-    getmaxyx(stdscr, term_height, term_width);
+    if (display_backend == DISPLAY_BACKEND_HEADLESS) {
+        term_height = HEADLESS_ROWS;
+        term_width = HEADLESS_COLS;
+    } else if (display_backend == DISPLAY_BACKEND_ANSI) {
+        struct winsize ws;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+            term_height = ws.ws_row;
+            term_width = ws.ws_col;
+        } else {
+            term_height = 24;
+            term_width = 80;
+        }
+    } else {
+        getmaxyx(stdscr, term_height, term_width);
+    }
+
+    // Clear the screen
+    if (display_backend == DISPLAY_BACKEND_ANSI || display_backend == DISPLAY_BACKEND_HEADLESS) {
+        ansi_clear_screen();
+    } else {
+        clear();
+    }
 
     // Calculate center positions
     int center_y = term_height / 2;
@@ -347,9 +877,13 @@ void show_victory_screen() {
 
     // Display victory message
     char title[] = "GAME OVER";
-    attron(A_BOLD);
-    mvprintw(center_y - 4, center_x - (int)(strlen(title) / 2), "%s", title);
-    attroff(A_BOLD);
+    if (display_backend == DISPLAY_BACKEND_ANSI || display_backend == DISPLAY_BACKEND_HEADLESS) {
+        ansi_print(center_y - 4, center_x - (int)(strlen(title) / 2), ANSI_SGR_BOLD, "%s", title);
+    } else {
+        attron(A_BOLD);
+        mvprintw(center_y - 4, center_x - (int)(strlen(title) / 2), "%s", title);
+        attroff(A_BOLD);
+    }
 
     // Display winner information
     char winner_msg[100];
@@ -358,45 +892,137 @@ void show_victory_screen() {
     } else {
         snprintf(winner_msg, sizeof(winner_msg), "No winner!");
     }
-    mvprintw(center_y - 2, center_x - (int)(strlen(winner_msg) / 2), "%s", winner_msg);
+
+    // Collect the remaining lines, they are drawn the same way by both renderers
+    char lines[MAX_PLAYERS + 2][100];
+    int line_y[MAX_PLAYERS + 2];
+    int n_lines = 0;
+    snprintf(lines[n_lines], sizeof(lines[n_lines]), "%s", winner_msg);
+    line_y[n_lines++] = center_y - 2;
 
     // Display scores of all players
-    mvprintw(center_y, center_x - 7, "Final Scores:");
     int line = center_y + 1;
     for (int i = 0; i < MAX_PLAYERS; i++) {
         if (players_disp[i].active) {
-            char score_msg[50];
-            snprintf(score_msg, sizeof(score_msg), "Astronaut %c: %d", players_disp[i].id, players_disp[i].score);
-            mvprintw(line++, center_x - (int)(strlen(score_msg) / 2), "%s", score_msg);
+            snprintf(lines[n_lines], sizeof(lines[n_lines]), "Astronaut %c: %d", players_disp[i].id, players_disp[i].score);
+            line_y[n_lines++] = line++;
         }
     }
 
     // Prompt to exit
-    char exit_msg[] = "Press any key to exit...";
-    mvprintw(line + 2, center_x - (int)(strlen(exit_msg) / 2), "%s", exit_msg);
+    snprintf(lines[n_lines], sizeof(lines[n_lines]), "Press any key to exit...");
+    line_y[n_lines++] = line + 2;
+
+    if (display_backend == DISPLAY_BACKEND_ANSI || display_backend == DISPLAY_BACKEND_HEADLESS) {
+        ansi_print(center_y, center_x - 7, ANSI_SGR_NORMAL, "Final Scores:");
+        for (int i = 0; i < n_lines; i++) {
+            ansi_print(line_y[i], center_x - (int)(strlen(lines[i]) / 2), ANSI_SGR_NORMAL, "%s", lines[i]);
+        }
+        ansi_flush();
+        return;
+    }
+
+    mvprintw(center_y, center_x - 7, "Final Scores:");
+    for (int i = 0; i < n_lines; i++) {
+        mvprintw(line_y[i], center_x - (int)(strlen(lines[i]) / 2), "%s", lines[i]);
+    }
 
     // Refresh to display changes
     refresh();
 }
 
 /**
- * @brief Sets the game state display to the provided buffer content.
+ * @brief Draws the predicted position of the astronaut over the grid of the last game state.
  *
- * This function locks the display mutex, copies the provided buffer content
- * to the game state display, sets the state_changed flag to 1, signals the
- * condition variable to indicate the state has changed, and then unlocks the
- * display mutex.
+ * The astronaut is moved from its cell in the game state to the predicted cell.
+ *
+ * @note This functions is not thread-safe and should be called with the display_lock mutex held.
+ */
+void apply_display_prediction() {
+    memcpy(grid, state_grid, sizeof(grid));
+    int idx = predicted_id - 'A';
+    if (predicted_id == '\0' || idx < 0 || idx >= MAX_PLAYERS || !players_disp[idx].active) {
+        return;
+    }
+    disp_Cell_t* cell = &grid[players_disp[idx].y][players_disp[idx].x];
+    if (cell->ch == predicted_id) {
+        cell->ch = ' ';
+    }
+    grid[predicted_y][predicted_x].ch = predicted_id;
+}
+
+/**
+ * @brief Sets the predicted position of an astronaut, drawn instead of its position in the game state.
+ *
+ * Used by the astronaut client to show its own moves before the server publishes them.
+ * The prediction is kept over the next game states until it is changed or cleared.
+ *
+ * @param id The astronaut, or '\0' to clear the prediction.
+ * @param x The predicted x-coordinate.
+ * @param y The predicted y-coordinate.
+ */
+void set_display_prediction(char id, int x, int y) {
+    if (x < 0 || x >= GRID_WIDTH || y < 0 || y >= GRID_HEIGHT) {
+        id = '\0';
+    }
+    pthread_mutex_lock(&display_lock);
+    predicted_id = id;
+    predicted_x = x;
+    predicted_y = y;
+    apply_display_prediction();
+    state_changed = 1;
+    pthread_cond_broadcast(&state_changed_cond);
+    pthread_mutex_unlock(&display_lock);
+}
+
+/**
+ * @brief Sets the game state display to the provided message.
+ *
+ * This function locks the display mutex, parses the message into the display grid,
+ * sets the state_changed flag to 1, signals the condition variable to indicate the
+ * state has changed, and then unlocks the display mutex.
+ * The message is parsed directly from the caller's buffer, it is not copied.
+ * The grid of the game state is kept, the predicted position of the astronaut is drawn over it.
  *
  * @param buffer A pointer to the buffer containing the new game state to display.
+ * @param len The length of the message in bytes.
  */
-void set_display_game_state(char* buffer) {
+void set_display_game_state(const char* buffer, size_t len) {
     pthread_mutex_lock(&display_lock);
-    strcpy(game_state_display, buffer);
+    double start = display_now_ns();
+    update_grid(buffer, len);
+    memcpy(state_grid, grid, sizeof(grid));
+    apply_display_prediction();
+    last_decode_ns = display_now_ns() - start;
+    decode_frames++;
+    decode_total_ns += last_decode_ns;
+    if (last_decode_ns > decode_max_ns) {
+        decode_max_ns = last_decode_ns;
+    }
+    states_given++;
     state_changed = 1;
-    pthread_cond_signal(&state_changed_cond);
+    pthread_cond_broadcast(&state_changed_cond);
     pthread_mutex_unlock(&display_lock);
 }
 
+/**
+ * @brief Waits until the display has drawn the last game state it was given.
+ *
+ * Used to feed recorded game states one at a time, so that every state is drawn.
+ * Returns without waiting once the game is over, the display no longer draws game states.
+ *
+ * @return 1 if the game is over, 0 otherwise.
+ */
+int display_wait_idle() {
+    pthread_mutex_lock(&display_lock);
+    while (!display_started || (state_changed && !game_over_display)) {
+        pthread_cond_wait(&state_changed_cond, &display_lock);
+    }
+    int game_over = game_over_display;
+    pthread_mutex_unlock(&display_lock);
+    return game_over;
+}
+
 /**
  * @brief Main display function that initializes the display and handles the main display loop.
  *
@@ -408,17 +1034,12 @@ void set_display_game_state(char* buffer) {
  */
 int display_main() {
     // Initialize the display
+    // The mutex and condition variable are statically initialized, game states can arrive before this point
+    pthread_mutex_lock(&display_lock);
     initialize_display();
-
-    // Initialize Mutex
-    if (pthread_mutex_init(&display_lock, NULL) != 0) {
-        perror("Failed to initialize display_lock mutex");
-        return -1;
-    }
-    if (pthread_cond_init(&state_changed_cond, NULL) != 0) {
-        perror("Failed to initialize display_cond condition");
-        return -1;
-    }
+    display_started = 1;
+    pthread_cond_broadcast(&state_changed_cond);
+    pthread_mutex_unlock(&display_lock);
 
     // Main loop
     while (!game_over_display) {
@@ -430,16 +1051,35 @@ int display_main() {
             pthread_cond_wait(&state_changed_cond, &display_lock);
         }
 
-        // Update the grid and draw it
-        update_grid();
+        // Draw the grid, it was already updated by set_display_game_state
+        double start = display_now_ns();
         draw_grid();
+        double render_ns = display_now_ns() - start;
+        render_frames++;
+        render_total_ns += render_ns;
+        if (render_ns > render_max_ns) {
+            render_max_ns = render_ns;
+        }
+        if (display_backend == DISPLAY_BACKEND_HEADLESS) {
+            headless_dump_screen(render_ns, 0);
+        }
 
         state_changed = 0;
+        unsigned long drawn = states_given;
+        pthread_cond_broadcast(&state_changed_cond);
         pthread_mutex_unlock(&display_lock);
+        if (frame_hook != NULL) {
+            frame_hook(drawn);
+        }
     }
 
     // Show victory screen if game_over flag is set
+    pthread_mutex_lock(&display_lock);
     show_victory_screen();
+    if (display_backend == DISPLAY_BACKEND_HEADLESS) {
+        headless_dump_screen(0, 1);
+    }
+    pthread_mutex_unlock(&display_lock);
 
     // Note: Not destroying mutexes because they can be blocked
     // Note: Not problem because function will exit and this code will not be used after game over screen
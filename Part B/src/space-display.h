@@ -16,6 +16,14 @@
 #ifndef SPACE_DISPLAY_H
 #define SPACE_DISPLAY_H
 
+#include <stddef.h>
+#include <stdio.h>
+
+// Renderers available to draw the screen
+#define DISPLAY_BACKEND_NCURSES 0 // Default, draws through ncurses windows
+#define DISPLAY_BACKEND_ANSI 1 // Writes ANSI escape sequences directly, one write() per frame
+#define DISPLAY_BACKEND_HEADLESS 2 // Draws into an in-memory screen, no terminal needed
+
 /**
  * @brief Structure to represent a player in the display system.
  * 
@@ -27,6 +35,8 @@ typedef struct {
     char id;
     int score;
     int active;  // flag to track if we've seen this player
+    int x; // Position in the last game state
+    int y;
 } disp_Player_t;
 
 /**
@@ -55,39 +65,45 @@ typedef struct {
  * Row numbers are drawn on the left side of the grid, and column numbers are
  * drawn on the top. A border is drawn around the grid to visually separate it
  * from the rest of the display.
+ *
+ * The static frame (numbers, borders and the score header) is drawn only here.
+ * The grid cells and score rows are drawn in their own windows by draw_grid and draw_scores.
  */
 void initialize_display();
 
 /**
- * @brief Updates the game grid and player statuses based on the current game state string.
+ * @brief Updates the game grid and player statuses based on a game state message.
  *
- * This function clears the current grid and player statuses, then parses the state string
+ * This function clears the current grid and player statuses, then parses the message
  * to update the grid with new player positions, alien positions, laser beams, and player scores.
  * It also sets a flag if the game is over.
  * 
  *
- * The game state string contains information about the game state, including player positions.
- * The string can either be passed from the server thread for the game-server.c application or
+ * The game state message contains information about the game state, including player positions.
+ * The message can either be passed from the server thread for the game-server.c application or
  * read via zeroMQ for outer-space-display.c. and astronaut-display-client.c applications.
+ * The message is parsed in place, it is not modified and does not need to be null terminated.
+ *
+ * @param msg The game state message.
+ * @param len The length of the message in bytes.
  * 
  * @note This functions is not thread-safe and should be called with the display_lock mutex held.
  */
-void update_grid();
+void update_grid(const char* msg, size_t len);
 
 /**
  * @brief Draws the scores of active players on the screen.
  *
- * This function clears the score area, displays the scores header, 
- * and lists the scores of all active players. It also draws a border 
- * around the scores area.
+ * This function lists the scores of all active players, one per row of the score window.
+ * Only the rows that differ from the previously drawn frame are sent to ncurses.
+ * The scores header and the border around the scores area are static and drawn
+ * once by initialize_display.
  *
- * The scores are displayed in bold and color-coded for astronauts.
+ * The scores are color-coded for astronauts.
  * The function assumes that the players_disp array contains information 
  * about the players, including their active status, ID, and score.
  *
- * The score area is cleared before displaying the scores, and a border 
- * is drawn around the scores area to visually separate it from other 
- * parts of the screen.
+ * The score window is staged with wnoutrefresh, draw_grid sends it to the terminal.
  * 
  * @note This functions is not thread-safe and should be called with the display_lock mutex held.
  */
@@ -97,13 +113,15 @@ void draw_scores();
  * @brief Draws the game grid on the screen.
  *
  * This function iterates through the game grid and draws each cell based on its content.
+ * Only the cells that differ from the previously drawn frame are sent to ncurses.
  * It handles the following elements:
  * - Aliens ('*') with a specific color.
  * - Lasers (horizontal and vertical) with a specific color and bold attribute.
  * - Astronauts (characters 'A' to 'H') with a specific color.
  * - Empty cells as spaces.
  *
- * The function also draws the scores and refreshes the screen.
+ * The function also draws the scores and sends both windows to the terminal in a single update.
+ * With the ANSI renderer the changed cells and score rows are written with a single write() call.
  * 
  * @note This functions is not thread-safe and should be called with the display_lock mutex held.
  */
@@ -123,16 +141,92 @@ void draw_grid(void);
 void show_victory_screen();
 
 /**
- * @brief Sets the game state display to the provided buffer content.
+ * @brief Sets the game state display to the provided message.
  *
- * This function locks the display mutex, copies the provided buffer content
- * to the game state display, sets the state_changed flag to 1, signals the
- * condition variable to indicate the state has changed, and then unlocks the
- * display mutex.
+ * This function locks the display mutex, parses the message into the display grid,
+ * sets the state_changed flag to 1, signals the condition variable to indicate the
+ * state has changed, and then unlocks the display mutex.
+ * The message is parsed directly from the caller's buffer, it is not copied.
  *
  * @param buffer A pointer to the buffer containing the new game state to display.
+ * @param len The length of the message in bytes.
+ */
+void set_display_game_state(const char* buffer, size_t len);
+
+/**
+ * @brief Sets the predicted position of an astronaut, drawn instead of its position in the game state.
+ *
+ * Used by the astronaut client to show its own moves before the server publishes them.
+ * The prediction is kept over the next game states until it is changed or cleared.
+ *
+ * @param id The astronaut, or '\0' to clear the prediction.
+ * @param x The predicted x-coordinate.
+ * @param y The predicted y-coordinate.
+ */
+void set_display_prediction(char id, int x, int y);
+
+/**
+ * @brief Selects the renderer used to draw the screen.
+ *
+ * Must be called before display_start_terminal. ncurses is used if it is never called.
+ *
+ * @param backend DISPLAY_BACKEND_NCURSES, DISPLAY_BACKEND_ANSI or DISPLAY_BACKEND_HEADLESS.
+ */
+void set_display_backend(int backend);
+
+/**
+ * @brief Prepares the terminal for the selected renderer.
+ *
+ * Initializes ncurses mode, or for the ANSI renderer disables line buffering and echo,
+ * switches to the alternate screen and hides the cursor.
+ * The headless renderer does not use the terminal.
+ */
+void display_start_terminal();
+
+/**
+ * @brief Restores the terminal to the state before display_start_terminal.
+ */
+void display_end_terminal();
+
+/**
+ * @brief Sets the file the headless renderer dumps its screen to.
+ *
+ * The screen is dumped after a frame is drawn, at most once per interval, and always after the victory screen.
+ *
+ * @param file The file to dump to, NULL to not dump.
+ * @param interval_ms Minimum time between two dumps in milliseconds, 0 to dump every frame.
+ */
+void set_display_dump(FILE* file, int interval_ms);
+
+/**
+ * @brief Prints the decode and render timing of the frames handled so far.
+ *
+ * Decode is the time spent in update_grid, render the time spent in draw_grid.
+ * Frames decoded while a previous one was still being drawn are not rendered.
+ *
+ * @param out The stream to print to.
+ */
+void display_report_timing(FILE* out);
+
+/**
+ * @brief Sets a function called after each frame is drawn, with the number of the last game state drawn.
+ *
+ * The game states are numbered from 1 in the order they are given to set_display_game_state.
+ * The function is called by the display thread without the display lock held.
+ *
+ * @param hook The function, NULL to not call any.
+ */
+void set_display_frame_hook(void (*hook)(unsigned long state));
+
+/**
+ * @brief Waits until the display has drawn the last game state it was given.
+ *
+ * Used to feed recorded game states one at a time, so that every state is drawn.
+ * Returns without waiting once the game is over, the display no longer draws game states.
+ *
+ * @return 1 if the game is over, 0 otherwise.
  */
-void set_display_game_state(char* buffer);
+int display_wait_idle();
 
 /**
  * @brief Main display function that initializes the display and handles the main display loop.
@@ -0,0 +1,154 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: stage-metrics.c
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Latency histograms of the stages of the server: commands, arena locks, game updates,
+ * publishing and ticks. Each thread records in its own shard, created the first time it
+ * records, and the shards are only added together when the histograms are printed.
+ * The shards are read without locks, a report may miss the values recorded while it is built.
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "stage-metrics.h"
+
+// Shards of the threads, in the order they first recorded
+StageShard_t* shards[MAX_METRIC_SHARDS];
+atomic_int shard_count = 0;
+
+// Shard of the calling thread, NULL until it records, or if there were already MAX_METRIC_SHARDS
+_Thread_local StageShard_t* thread_shard = NULL;
+_Thread_local int thread_shard_full = 0;
+
+const char* stage_names[STAGES] = {
+    "cmd_connect", "cmd_move", "cmd_zap", "cmd_batch", "cmd_keepalive", "cmd_resume", "cmd_disconnect", "cmd_other",
+    "lock_wait", "lock_hold", "update_game", "update_aliens", "send_state", "send_scores", "tick_jitter",
+};
+
+
+/**
+ * @brief Returns a monotonic timestamp, to measure the stages.
+ *
+ * @return The current time in nanoseconds.
+ */
+unsigned long long stage_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/**
+ * @brief Records the duration of a stage in the shard of the calling thread.
+ *
+ * The first time a thread records, its shard is allocated and published for the reports.
+ *
+ * @param stage The stage, one of the STAGE_ constants.
+ * @param duration The duration in nanoseconds.
+ */
+void stage_record(int stage, unsigned long long duration) {
+    if (thread_shard == NULL) {
+        if (thread_shard_full) {
+            return;
+        }
+        int index = atomic_fetch_add(&shard_count, 1);
+        if (index >= MAX_METRIC_SHARDS) {
+            thread_shard_full = 1;
+            return;
+        }
+        thread_shard = calloc(1, sizeof(StageShard_t));
+        if (thread_shard == NULL) {
+            thread_shard_full = 1;
+            return;
+        }
+        shards[index] = thread_shard;
+    }
+    histogram_record(&thread_shard->stages[stage], duration);
+}
+
+/**
+ * @brief Records the time since a timestamp of stage_time as the duration of a stage.
+ *
+ * @param stage The stage, one of the STAGE_ constants.
+ * @param start The timestamp of the start of the stage.
+ */
+void stage_record_since(int stage, unsigned long long start) {
+    stage_record(stage, stage_time() - start);
+}
+
+/**
+ * @brief Returns the stage of a command of the astronauts.
+ *
+ * @param cmd The command character.
+ * @return The STAGE_CMD_ constant of the command.
+ */
+int command_stage(char cmd) {
+    switch (cmd) {
+        case CMD_CONNECT: return STAGE_CMD_CONNECT;
+        case CMD_MOVE: return STAGE_CMD_MOVE;
+        case MSG_ZAP: return STAGE_CMD_ZAP;
+        case CMD_BATCH: return STAGE_CMD_BATCH;
+        case CMD_KEEPALIVE: return STAGE_CMD_KEEPALIVE;
+        case CMD_RESUME: return STAGE_CMD_RESUME;
+        case CMD_DISCONNECT: return STAGE_CMD_DISCONNECT;
+        default: return STAGE_CMD_OTHER;
+    }
+}
+
+/**
+ * @brief Returns the name of a stage.
+ *
+ * @param stage The stage.
+ * @return The name, in lowercase with underscores.
+ */
+const char* stage_name(int stage) {
+    return stage_names[stage];
+}
+
+/**
+ * @brief Adds the histograms of a stage recorded by all the threads.
+ *
+ * A shard being allocated by its thread is skipped.
+ *
+ * @param stage The stage.
+ * @param histogram Where the histograms are added, zeroed by the caller.
+ */
+void stage_metrics_merge(int stage, Histogram_t* histogram) {
+    int count = atomic_load(&shard_count);
+    for (int i = 0; i < count && i < MAX_METRIC_SHARDS; i++) {
+        if (shards[i] != NULL) {
+            histogram_merge(histogram, &shards[i]->stages[stage]);
+        }
+    }
+}
+
+/**
+ * @brief Prints the count, mean and percentiles of each stage recorded, in microseconds.
+ *
+ * @param out The stream where the report is written.
+ */
+void print_stage_metrics(FILE* out) {
+    fprintf(out, "Stage                Count   Mean (us)    p50 (us)    p99 (us)  p99.9 (us)    Max (us)\n");
+    for (int stage = 0; stage < STAGES; stage++) {
+        Histogram_t histogram;
+        memset(&histogram, 0, sizeof(histogram));
+        stage_metrics_merge(stage, &histogram);
+        if (histogram.count == 0) {
+            continue;
+        }
+        fprintf(out, "  %-14s  %9lu  %10.2f  %10.2f  %10.2f  %10.2f  %10.2f\n", stage_names[stage], histogram.count,
+                histogram_mean(&histogram) / 1e3, histogram_percentile(&histogram, 0.5) / 1e3,
+                histogram_percentile(&histogram, 0.99) / 1e3, histogram_percentile(&histogram, 0.999) / 1e3,
+                histogram.max / 1e3);
+    }
+}
@@ -0,0 +1,108 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: stage-metrics.h
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Header file for stage-metrics.c
+ */
+
+#ifndef STAGE_METRICS_H
+#define STAGE_METRICS_H
+
+#include <stdio.h>
+#include "histogram.h"
+
+// Stages of the server with a latency histogram, all in nanoseconds
+// process_client_message, per command
+#define STAGE_CMD_CONNECT 0
+#define STAGE_CMD_MOVE 1
+#define STAGE_CMD_ZAP 2
+#define STAGE_CMD_BATCH 3
+#define STAGE_CMD_KEEPALIVE 4
+#define STAGE_CMD_RESUME 5
+#define STAGE_CMD_DISCONNECT 6
+#define STAGE_CMD_OTHER 7 // Unknown commands
+#define STAGE_LOCK_WAIT 8 // Time waiting for an arena lock
+#define STAGE_LOCK_HOLD 9 // Time an arena lock is held
+#define STAGE_UPDATE_GAME 10 // update_game_state
+#define STAGE_UPDATE_ALIENS 11 // update_alien_positions
+#define STAGE_SEND_STATE 12 // send_game_state, building the game state and handing it to the publisher
+#define STAGE_SEND_SCORES 13 // send_score_updates, serializing the scores and handing them to the publisher
+#define STAGE_TICK_JITTER 14 // Difference between the time between two ticks and GAME_UPDATE_INTERVAL
+#define STAGES 15
+
+#define MAX_METRIC_SHARDS 64 // Threads that record stages, the ones started after that are not recorded
+
+/**
+ * @struct StageShard_t
+ * @brief Histograms of the stages recorded by one thread.
+ *
+ * Each thread records in its own shard, so that recording needs no lock and the
+ * threads do not write to the same cache lines.
+ */
+typedef struct {
+    Histogram_t stages[STAGES];
+} StageShard_t;
+
+/**
+ * @brief Returns a monotonic timestamp, to measure the stages.
+ *
+ * @return The current time in nanoseconds.
+ */
+unsigned long long stage_time();
+
+/**
+ * @brief Records the duration of a stage in the shard of the calling thread.
+ *
+ * @param stage The stage, one of the STAGE_ constants.
+ * @param duration The duration in nanoseconds.
+ */
+void stage_record(int stage, unsigned long long duration);
+
+/**
+ * @brief Records the time since a timestamp of stage_time as the duration of a stage.
+ *
+ * @param stage The stage, one of the STAGE_ constants.
+ * @param start The timestamp of the start of the stage.
+ */
+void stage_record_since(int stage, unsigned long long start);
+
+/**
+ * @brief Returns the stage of a command of the astronauts.
+ *
+ * @param cmd The command character.
+ * @return The STAGE_CMD_ constant of the command.
+ */
+int command_stage(char cmd);
+
+/**
+ * @brief Returns the name of a stage.
+ *
+ * @param stage The stage.
+ * @return The name, in lowercase with underscores.
+ */
+const char* stage_name(int stage);
+
+/**
+ * @brief Adds the histograms of a stage recorded by all the threads.
+ *
+ * @param stage The stage.
+ * @param histogram Where the histograms are added, zeroed by the caller.
+ */
+void stage_metrics_merge(int stage, Histogram_t* histogram);
+
+/**
+ * @brief Prints the count, mean and percentiles of each stage recorded.
+ *
+ * @param out The stream where the report is written.
+ */
+void print_stage_metrics(FILE* out);
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: trace.c
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Timeline of the spans of the server threads (ticks, jobs, locks, commands and sends),
+ * written in the Chrome trace event format for chrome://tracing or Perfetto.
+ * Each thread writes its events to its own ring, allocated the first time it records during
+ * a capture, so recording takes no lock. When no capture is running the TRACE_ macros only
+ * read trace_active, so the tracing stays compiled in and can be used on a running server.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "stage-metrics.h"
+#include "trace.h"
+
+atomic_int trace_active = 0;
+
+// Rings of the threads, in the order they first recorded
+TraceRing_t* trace_rings[MAX_TRACE_THREADS];
+atomic_int trace_ring_count = 0;
+
+// Ring and name of the calling thread
+_Thread_local TraceRing_t* thread_ring = NULL;
+_Thread_local int thread_ring_full = 0;
+_Thread_local const char* thread_name = NULL;
+
+
+/**
+ * @brief Records an event in the ring of the calling thread. Use TRACE_BEGIN and TRACE_END instead.
+ *
+ * The event is visible to trace_write once head is updated.
+ *
+ * @param phase TRACE_PHASE_BEGIN or TRACE_PHASE_END.
+ * @param name The name of the span.
+ */
+void trace_event(char phase, const char* name) {
+    if (thread_ring == NULL) {
+        if (thread_ring_full) {
+            return;
+        }
+        int index = atomic_fetch_add(&trace_ring_count, 1);
+        if (index >= MAX_TRACE_THREADS) {
+            thread_ring_full = 1;
+            return;
+        }
+        thread_ring = calloc(1, sizeof(TraceRing_t));
+        if (thread_ring == NULL) {
+            thread_ring_full = 1;
+            return;
+        }
+        thread_ring->thread_name = thread_name;
+        trace_rings[index] = thread_ring;
+    }
+
+    unsigned long head = atomic_load_explicit(&thread_ring->head, memory_order_relaxed);
+    TraceEvent_t* event = &thread_ring->events[head % TRACE_RING_SIZE];
+    event->time = stage_time();
+    event->name = name;
+    event->phase = phase;
+    atomic_store_explicit(&thread_ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief Names the calling thread in the timeline.
+ *
+ * @param name The name, a string that is never freed.
+ */
+void trace_thread_name(const char* name) {
+    thread_name = name;
+    if (thread_ring != NULL) {
+        thread_ring->thread_name = name;
+    }
+}
+
+/**
+ * @brief Starts a capture, the events recorded before are dropped.
+ */
+void trace_start() {
+    int count = atomic_load(&trace_ring_count);
+    for (int i = 0; i < count && i < MAX_TRACE_THREADS; i++) {
+        if (trace_rings[i] != NULL) {
+            trace_rings[i]->start = atomic_load_explicit(&trace_rings[i]->head, memory_order_acquire);
+        }
+    }
+    atomic_store(&trace_active, 1);
+}
+
+/**
+ * @brief Stops the capture, the events are kept until the next one starts.
+ *
+ * A thread may still finish the event it was recording.
+ */
+void trace_stop() {
+    atomic_store(&trace_active, 0);
+}
+
+/**
+ * @brief Writes the events of the last capture in the Chrome trace event format.
+ *
+ * Each ring has the last TRACE_RING_SIZE events of its thread. The timestamps are in
+ * microseconds since the first event kept, and each thread is named with a metadata event.
+ *
+ * @param path The file where the events are written.
+ * @return The number of events written, or -1 if the file could not be written.
+ */
+int trace_write(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+
+    // Events kept of each ring, and the earliest timestamp
+    int count = atomic_load(&trace_ring_count);
+    if (count > MAX_TRACE_THREADS) {
+        count = MAX_TRACE_THREADS;
+    }
+    unsigned long first[MAX_TRACE_THREADS];
+    unsigned long last[MAX_TRACE_THREADS];
+    unsigned long long origin = 0;
+    for (int i = 0; i < count; i++) {
+        TraceRing_t* ring = trace_rings[i];
+        first[i] = last[i] = 0;
+        if (ring == NULL) {
+            continue;
+        }
+        last[i] = atomic_load_explicit(&ring->head, memory_order_acquire);
+        first[i] = last[i] - ring->start > TRACE_RING_SIZE ? last[i] - TRACE_RING_SIZE : ring->start;
+        if (first[i] < last[i]) {
+            unsigned long long time = ring->events[first[i] % TRACE_RING_SIZE].time;
+            if (origin == 0 || time < origin) {
+                origin = time;
+            }
+        }
+    }
+
+    int written = 0;
+    const char* separator = ""; // Written before each record, none before the first one
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (int i = 0; i < count; i++) {
+        TraceRing_t* ring = trace_rings[i];
+        if (ring == NULL) {
+            continue;
+        }
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                separator, i + 1, ring->thread_name != NULL ? ring->thread_name : "thread");
+        separator = ",\n";
+        for (unsigned long e = first[i]; e < last[i]; e++) {
+            TraceEvent_t* event = &ring->events[e % TRACE_RING_SIZE];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}", event->name, event->phase,
+                    (event->time - origin) / 1e3, i + 1);
+            written++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file) != 0) {
+        return -1;
+    }
+    return written;
+}
@@ -0,0 +1,110 @@
+/*
+ * PSIS 2024/2025 - Project Part 2
+ *
+ * Filename: trace.h
+ *
+ * Authors:
+ * - Carlos Santos - 102985 - carlos.r.santos@tecnico.ulisboa.pt
+ * - Tomas Corral  - 102446 - tomas.corral@tecnico.ulisboa.pt
+ *
+ * Group ID: 20
+ *
+ * Description:
+ * Header file for trace.c
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+
+#define TRACE_RING_SIZE 65536 // Events kept per thread, the oldest are overwritten
+#define MAX_TRACE_THREADS 64 // Threads that record events, the ones started after that are not recorded
+#define TRACE_PHASE_BEGIN 'B'
+#define TRACE_PHASE_END 'E'
+
+// Set while a capture is running, read by the macros before anything else
+extern atomic_int trace_active;
+
+// Begin and end of a span of the calling thread, the name must be a string that is never freed
+// A relaxed load and a branch when tracing is off
+#define TRACE_BEGIN(name) do { \
+    if (atomic_load_explicit(&trace_active, memory_order_relaxed)) trace_event(TRACE_PHASE_BEGIN, (name)); \
+} while (0)
+#define TRACE_END(name) do { \
+    if (atomic_load_explicit(&trace_active, memory_order_relaxed)) trace_event(TRACE_PHASE_END, (name)); \
+} while (0)
+
+/**
+ * @struct TraceEvent_t
+ * @brief A begin or end event of a span.
+ *
+ * @var TraceEvent_t::time
+ * Monotonic timestamp of the event in nanoseconds.
+ *
+ * @var TraceEvent_t::name
+ * Name of the span, a string that is never freed.
+ *
+ * @var TraceEvent_t::phase
+ * TRACE_PHASE_BEGIN or TRACE_PHASE_END.
+ */
+typedef struct {
+    unsigned long long time;
+    const char* name;
+    char phase;
+} TraceEvent_t;
+
+/**
+ * @struct TraceRing_t
+ * @brief Events of one thread. Written only by its thread, read when the capture is written.
+ *
+ * @var TraceRing_t::head
+ * Number of events written since the ring was created, the next event goes to head % TRACE_RING_SIZE.
+ *
+ * @var TraceRing_t::start
+ * Value of head when the capture started, the events before it are not written.
+ *
+ * @var TraceRing_t::thread_name
+ * Name of the thread, shown in the timeline.
+ */
+typedef struct {
+    TraceEvent_t events[TRACE_RING_SIZE];
+    atomic_ulong head;
+    unsigned long start;
+    const char* thread_name;
+} TraceRing_t;
+
+/**
+ * @brief Records an event in the ring of the calling thread. Use TRACE_BEGIN and TRACE_END instead.
+ *
+ * @param phase TRACE_PHASE_BEGIN or TRACE_PHASE_END.
+ * @param name The name of the span.
+ */
+void trace_event(char phase, const char* name);
+
+/**
+ * @brief Names the calling thread in the timeline.
+ *
+ * @param name The name, a string that is never freed.
+ */
+void trace_thread_name(const char* name);
+
+/**
+ * @brief Starts a capture, the events recorded before are dropped.
+ */
+void trace_start();
+
+/**
+ * @brief Stops the capture, the events are kept until the next one starts.
+ */
+void trace_stop();
+
+/**
+ * @brief Writes the events of the last capture in the Chrome trace event format.
+ *
+ * @param path The file where the events are written.
+ * @return The number of events written, or -1 if the file could not be written.
+ */
+int trace_write(const char* path);
+
+#endif